@@ -0,0 +1,180 @@
+#include "http.h"
+
+/* RFC: 7231 section 5.3.4 */
+
+static const struct
+{
+  const char             *name;
+  enum http_content_coding coding;
+}
+coding_names[] =
+{
+  { "br",       http_coding_br },
+  { "deflate",  http_coding_deflate },
+  { "gzip",     http_coding_gzip },
+  { "identity", http_coding_identity },
+  { "x-gzip",   http_coding_gzip },
+  { "zstd",     http_coding_zstd },
+};
+
+/* Preferred order among equally ranked codings; better compression first,
+   gzip before deflate, which some clients took for raw deflate, identity
+   last. */
+static const enum http_content_coding
+coding_preference[http_coding_count] =
+{
+  http_coding_br,
+  http_coding_zstd,
+  http_coding_gzip,
+  http_coding_deflate,
+  http_coding_identity
+};
+
+static int
+coding_lookup (const char *name,
+               unsigned    length)
+{
+  unsigned i, j;
+  for (i = 0; i < sizeof(coding_names)/sizeof(coding_names[0]); ++i) {
+    const char *n = coding_names[i].name;
+    for (j = 0; j < length; ++j) {
+      char c = name[j];
+      if (c >= 'A' && c <= 'Z')
+        c = c-'A'+'a';
+      if (c != n[j])
+        break;
+    }
+    if (j == length && !n[j])
+      return coding_names[i].coding;
+  }
+  return -1;
+}
+
+static int
+coding_token (char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.'
+      || c == '+' || c == '!' || c == '#' || c == '$' || c == '%'
+      || c == '&' || c == '\'' || c == '^' || c == '`' || c == '|'
+      || c == '~' || c == '*';
+}
+
+static const char*
+coding_ows (const char *p,
+            const char *e)
+{
+  while (p != e && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+/* Parse the parameters of an element, returning the q-value in thousandths,
+   or -1 if malformed. */
+static int
+coding_q (const char **pp,
+          const char  *e)
+{
+  const char *p = *pp;
+  int q = 1000;
+  while ((p = coding_ows (p, e)) != e && *p == ';') {
+    const char *n;
+    p = coding_ows (p+1, e);
+    for (n = p; p != e && coding_token (*p); ++p)
+      ;
+    if (p == e || *p != '=' || n == p)
+      return -1;
+    ++p;
+    if (p - n == 2 && (*n == 'q' || *n == 'Q')) {
+      unsigned d = 0;
+      if (p == e || (*p != '0' && *p != '1'))
+        return -1;
+      q = (*p++ - '0') * 1000;
+      if (p != e && *p == '.') {
+        unsigned scale = 100;
+        for (++p; p != e && *p >= '0' && *p <= '9' && d < 3; ++p, ++d) {
+          q += (*p - '0') * scale;
+          scale /= 10;
+        }
+      }
+      if (q > 1000)
+        return -1;
+    } else {
+      // some other parameter, skip the value.
+      while (p != e && *p != ';' && *p != ',')
+        ++p;
+    }
+  }
+  *pp = p;
+  return q;
+}
+
+int
+minute_http_accept_encoding (const char           *value,
+                             unsigned              length,
+                             minute_http_codings  *codings)
+{
+  const char *p = value, *e = value ? value + length : value;
+  int q[http_coding_count], any = -1, r = 0;
+  unsigned i;
+
+  for (i = 0; i < http_coding_count; ++i)
+    q[i] = -1;
+
+  while (p != e) {
+    const char *n;
+    unsigned l;
+    int c, v;
+    p = coding_ows (p, e);
+    for (n = p; p != e && coding_token (*p); ++p)
+      ;
+    l = p - n;
+    if (l && 0 <= (v = coding_q (&p, e))) {
+      if (l == 1 && *n == '*')
+        any = v;
+      else if (0 <= (c = coding_lookup (n, l)))
+        q[c] = v;
+    } else if (l || (p != e && *p != ',')) {
+      r = -1; // malformed; skip to the next element.
+    }
+    while (p != e && *p != ',')
+      ++p;
+    if (p != e)
+      ++p;
+  }
+
+  codings->accept = 0;
+  for (i = 0; i < http_coding_count; ++i) {
+    if (q[i] < 0) {
+      if (any >= 0)
+        q[i] = any;
+      else if (i == http_coding_identity)
+        q[i] = 1; // acceptable unless excluded, but least preferred.
+      else
+        q[i] = 0;
+    }
+    codings->q[i] = q[i];
+    if (q[i])
+      codings->accept |= MINUTE_HTTP_CODING(i);
+  }
+  return r;
+}
+
+unsigned
+minute_http_codings_rank (const minute_http_codings  *codings,
+                          unsigned                    mask,
+                          enum http_content_coding   *ranked)
+{
+  unsigned i, j, n = 0;
+  for (i = 0; i < http_coding_count; ++i) {
+    enum http_content_coding c = coding_preference[i];
+    if (!(codings->accept & mask & MINUTE_HTTP_CODING(c)))
+      continue;
+    // insertion sort, keeping the preferred order for equal q-values.
+    for (j = n; j && codings->q[ranked[j-1]] < codings->q[c]; --j)
+      ranked[j] = ranked[j-1];
+    ranked[j] = c;
+    ++n;
+  }
+  return n;
+}
@@ -0,0 +1,225 @@
+#include "http.h"
+
+/* RFC: 7231 (dates), 7232 */
+
+static int
+cond_digits (const char **p,
+             const char  *e,
+             unsigned     n,
+             unsigned    *v)
+{
+  const char *q = *p;
+  unsigned r = 0;
+  if ((unsigned)(e - q) < n)
+    return -1;
+  for (; n; --n, ++q) {
+    if (*q < '0' || *q > '9')
+      return -1;
+    r = r * 10 + (*q - '0');
+  }
+  *p = q;
+  *v = r;
+  return 0;
+}
+
+static int
+cond_char (const char **p,
+           const char  *e,
+           char         c)
+{
+  if (*p == e || **p != c)
+    return -1;
+  ++*p;
+  return 0;
+}
+
+static int
+cond_month (const char **p,
+            const char  *e)
+{
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  const char *q = *p;
+  int m;
+  if (e - q < 3)
+    return -1;
+  for (m = 0; m < 12; ++m)
+    if (q[0] == months[3*m] && q[1] == months[3*m+1] && q[2] == months[3*m+2])
+    {
+      *p = q + 3;
+      return m;
+    }
+  return -1;
+}
+
+static int
+cond_time (const char **p,
+           const char  *e,
+           unsigned    *seconds)
+{
+  unsigned h, m, s;
+  if (cond_digits (p, e, 2, &h) || cond_char (p, e, ':')
+      || cond_digits (p, e, 2, &m) || cond_char (p, e, ':')
+      || cond_digits (p, e, 2, &s)
+      || h > 23 || m > 59 || s > 60)
+    return -1;
+  *seconds = h*3600 + m*60 + s;
+  return 0;
+}
+
+int
+minute_http_date (const char *value,
+                  unsigned    length,
+                  unsigned   *epoch)
+{
+  const char *p = value, *e = value + length;
+  unsigned day, year, seconds, days;
+  int month;
+
+  while (p != e && ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')))
+    ++p; // the day name, which is redundant.
+  if (p - value < 3)
+    return -1;
+
+  if (!cond_char (&p, e, ',')) {
+    if (cond_char (&p, e, ' ') || cond_digits (&p, e, 2, &day))
+      return -1;
+    if (!cond_char (&p, e, '-')) {
+      // Sunday, 06-Nov-94 08:49:37 GMT
+      if ((month = cond_month (&p, e)) < 0 || cond_char (&p, e, '-')
+          || cond_digits (&p, e, 2, &year))
+        return -1;
+      year += year < 70 ? 2000 : 1900;
+    } else {
+      // Sun, 06 Nov 1994 08:49:37 GMT
+      if (cond_char (&p, e, ' ') || (month = cond_month (&p, e)) < 0
+          || cond_char (&p, e, ' ') || cond_digits (&p, e, 4, &year))
+        return -1;
+    }
+    if (cond_char (&p, e, ' ') || cond_time (&p, e, &seconds)
+        || cond_char (&p, e, ' ') || cond_char (&p, e, 'G')
+        || cond_char (&p, e, 'M') || cond_char (&p, e, 'T'))
+      return -1;
+  } else {
+    // Sun Nov  6 08:49:37 1994
+    if (cond_char (&p, e, ' ') || (month = cond_month (&p, e)) < 0
+        || cond_char (&p, e, ' '))
+      return -1;
+    if (!cond_char (&p, e, ' ')) {
+      if (cond_digits (&p, e, 1, &day))
+        return -1;
+    } else if (cond_digits (&p, e, 2, &day)) {
+      return -1;
+    }
+    if (cond_char (&p, e, ' ') || cond_time (&p, e, &seconds)
+        || cond_char (&p, e, ' ') || cond_digits (&p, e, 4, &year))
+      return -1;
+  }
+  if (p != e || day < 1 || day > 31 || year < 1970 || year > 2105)
+    return -1;
+
+  // days since the epoch, counting years from March to put leap days last.
+  {
+    unsigned y = year - (month < 2);
+    unsigned m = (month + 10) % 12; // March is zero
+    days = 365*y + y/4 - y/100 + y/400 + (153*m + 2)/5 + day - 1
+         - 719468; // 1970-01-01
+  }
+  *epoch = days * 86400 + seconds;
+  return 0;
+}
+
+static const char*
+cond_ows (const char *p,
+          const char *e)
+{
+  while (p != e && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+int
+minute_http_etags (const char       *value,
+                   unsigned          length,
+                   minute_http_etag *tags,
+                   unsigned          max)
+{
+  const char *p = value, *e = value + length;
+  unsigned n = 0;
+
+  p = cond_ows (p, e);
+  if (p != e && *p == '*') {
+    if (cond_ows (p+1, e) != e || !max)
+      return -1;
+    tags[0].tag = p;
+    tags[0].length = 1;
+    tags[0].weak = 0;
+    return 1;
+  }
+
+  while (1) {
+    const char *t;
+    int weak = 0;
+    p = cond_ows (p, e);
+    if (p == e)
+      break;
+    if (*p == ',') { // empty list elements are allowed.
+      ++p;
+      continue;
+    }
+    if (*p == 'W') {
+      if (e - p < 2 || p[1] != '/')
+        return -1;
+      weak = 1;
+      p += 2;
+    }
+    t = p;
+    if (cond_char (&p, e, '"'))
+      return -1;
+    while (p != e && *p != '"')
+      if ((unsigned char) *p++ < 0x21)
+        return -1;
+    if (cond_char (&p, e, '"'))
+      return -1;
+    if (n == max)
+      return -1;
+    tags[n].tag = t;
+    tags[n].length = p - t;
+    tags[n].weak = weak;
+    ++n;
+
+    p = cond_ows (p, e);
+    if (p == e)
+      break;
+    if (*p++ != ',')
+      return -1;
+  }
+  return n ? (int) n : -1;
+}
+
+int
+minute_http_etags_match (const minute_http_etag *tags,
+                         unsigned                count,
+                         const char             *etag,
+                         unsigned                length,
+                         int                     weak)
+{
+  unsigned i, j;
+  int eweak = length > 2 && etag[0] == 'W' && etag[1] == '/';
+  if (eweak) {
+    etag += 2;
+    length -= 2;
+  }
+  for (i = 0; i < count; ++i) {
+    if (tags[i].length == 1 && tags[i].tag[0] == '*')
+      return 1;
+    if (!weak && (eweak || tags[i].weak))
+      continue;
+    if (tags[i].length != length)
+      continue;
+    for (j = 0; j < length && tags[i].tag[j] == etag[j]; ++j)
+      ;
+    if (j == length)
+      return 1;
+  }
+  return 0;
+}
@@ -1,45 +1,13 @@
 #include "http-headers.h"
 
+/* The name tables are expanded from the same lists as the enums in
+   http-headers.h, and so are indexed by them. */
+#define NAME(symbol, name) name,
 const char*
 http_request_header_names[] =
 {
   "X-Unknown-Header",
-  "Accept",
-  "Accept-Charset",
-  "Accept-Encoding",
-  "Accept-Language",
-  "Authorization",
-  "Cache-Control",
-  "Connection",
-  "Content-Encoding",
-  "Content-Language",
-  "Content-Length",
-  "Content-Location",
-  "Content-MD5",
-  "Content-Type",
-  "Cookie",
-  "Date",
-  "Expect",
-  "From",
-  "Host",
-  "If-Match",
-  "If-Modified-Since",
-  "If-None-Match",
-  "If-Range",
-  "If-Unmodified-Since",
-  "Max-Forwards",
-  "Origin",
-  "Pragma",
-  "Proxy-Authorization",
-  "Range",
-  "Referer",
-  "TE",
-  "Trailer",
-  "Transfer-Encoding",
-  "Upgrade",
-  "User-Agent",
-  "Via",
-  "Warning"
+  HTTP_REQUEST_HEADERS(NAME)
 };
 
 int http_request_header_names_count =
@@ -49,40 +17,17 @@ const char*
 http_response_header_names[] =
 {
   "X-Unknown-Header",
-  "Accept-Ranges",
-  "Age",
-  "Allow",
-  "Cache-Control",
-  "Connection",
-  "Content-Encoding",
-  "Content-Language",
-  "Content-Length",
-  "Content-Location",
-  "Content-MD5",
-  "Content-Disposition",
-  "Content-Range",
-  "Content-Type",
-  "Date",
-  "ETag",
-  "Expires",
-  "Last-Modified",
-  "Link",
-  "Location",
-  "P3P",
-  "Pragma",
-  "Proxy-Authenticate",
-  "Refresh",
-  "Retry-After",
-  "Server",
-  "Set-Cookie",
-  "Strict-Transport-Security",
-  "Trailer",
-  "Transfer-Encoding",
-  "Vary",
-  "Via",
-  "Warning",
-  "WWW-Authenticate"
+  HTTP_RESPONSE_HEADERS(NAME)
 };
 
 int http_response_header_names_count =
   sizeof(http_response_header_names)/sizeof(http_response_header_names[0]);
+
+/* The "Name: " prefixes of the response header lines. */
+#define PREFIX(symbol, name) { name ": ", sizeof(name ": ") - 1 },
+const minute_http_header_prefix
+http_response_header_prefixes[] =
+{
+  PREFIX(http_rsp_unknown_header, "X-Unknown-Header")
+  HTTP_RESPONSE_HEADERS(PREFIX)
+};
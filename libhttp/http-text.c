@@ -14,56 +14,77 @@ minute_http_version_text  (enum http_version version)
   }
 }
 const char*
-minute_http_response_text  (int code)
+minute_http_coding_text  (enum http_content_coding coding)
 {
-  switch (code) {
-    case 100: return "Continue";
-    case 101: return "Switching Protocols";
-
-    case 200: return "OK";
-    case 201: return "Created";
-    case 202: return "Accepted";
-    case 203: return "Non-Authoritative Information";
-    case 204: return "No Content";
-    case 205: return "Reset Content";
-    case 206: return "Partial Content";
-
-    case 300: return "Multiple Choices";
-    case 301: return "Moved Permanently";
-    case 302: return "Found";
-    case 303: return "See Other";
-    case 304: return "Not Modified";
-    case 305: return "Use Proxy";
-    case 306: break; // reserved.
-    case 307: return "Temporary Redirect";
-
-    case 400: return "Bad Request";
-    case 401: return "Not Authorized";
-    case 402: return "Payment Required";
-    case 403: return "Forbidden";
-    case 404: return "Not Found";
-    case 405: return "Method Not Allowed";
-    case 406: return "Not Acceptable";
-    case 407: return "Proxy Authentication Required";
-    case 408: return "Request Timed Out";
-    case 409: return "Conflict";
-    case 410: return "Gone";
-    case 411: return "Length Required";
-    case 412: return "Precondition Failed";
-    case 413: return "Request Entity Too Large";
-    case 414: return "Request-URI Too Long";
-    case 415: return "Unsupported Media Type";
-    case 416: return "Requested Range Not Satisfiable";
-    case 417: return "Expectation Failed";
+  switch(coding) {
+    case http_coding_gzip:
+      return "gzip";
+    case http_coding_br:
+      return "br";
+    case http_coding_zstd:
+      return "zstd";
+    case http_coding_deflate:
+      return "deflate";
+    case http_coding_identity:
+    default:
+      return "identity";
+  }
+}
 
-    case 418: return "I'm a teapot";
+/* The status codes with a known reason phrase, in ascending order. */
+#define STATUSES(X) \
+  X(100, "Continue") \
+  X(101, "Switching Protocols") \
+  \
+  X(200, "OK") \
+  X(201, "Created") \
+  X(202, "Accepted") \
+  X(203, "Non-Authoritative Information") \
+  X(204, "No Content") \
+  X(205, "Reset Content") \
+  X(206, "Partial Content") \
+  \
+  X(300, "Multiple Choices") \
+  X(301, "Moved Permanently") \
+  X(302, "Found") \
+  X(303, "See Other") \
+  X(304, "Not Modified") \
+  X(305, "Use Proxy") \
+  X(307, "Temporary Redirect") \
+  \
+  X(400, "Bad Request") \
+  X(401, "Not Authorized") \
+  X(402, "Payment Required") \
+  X(403, "Forbidden") \
+  X(404, "Not Found") \
+  X(405, "Method Not Allowed") \
+  X(406, "Not Acceptable") \
+  X(407, "Proxy Authentication Required") \
+  X(408, "Request Timed Out") \
+  X(409, "Conflict") \
+  X(410, "Gone") \
+  X(411, "Length Required") \
+  X(412, "Precondition Failed") \
+  X(413, "Request Entity Too Large") \
+  X(414, "Request-URI Too Long") \
+  X(415, "Unsupported Media Type") \
+  X(416, "Requested Range Not Satisfiable") \
+  X(417, "Expectation Failed") \
+  X(418, "I'm a teapot") \
+  \
+  X(500, "Internal Server Error") \
+  X(501, "Not Implemented") \
+  X(502, "Bad Gateway") \
+  X(503, "Service Unavailable") \
+  X(504, "Gateway Timeout") \
+  X(505, "HTTP Version Not Supported")
 
-    case 500: return "Internal Server Error";
-    case 501: return "Not Implemented";
-    case 502: return "Bad Gateway";
-    case 503: return "Service Unavailable";
-    case 504: return "Gateway Timeout";
-    case 505: return "HTTP Version Not Supported";
+const char*
+minute_http_response_text  (int code)
+{
+#define REASON(code, text) case code: return text;
+  switch (code) {
+    STATUSES(REASON)
   }
   switch (code/100) {
     case 1: return "Informational";
@@ -75,6 +96,42 @@ minute_http_response_text  (int code)
   return "Unknown";
 }
 
+#define LINE(version, code, text) \
+  { sizeof(version " " #code " " text "\r\n")-1, \
+    version " " #code " " text "\r\n" }
+#define STATUS_LINES(code, text) \
+  { code, { LINE("HTTP/1.0", code, text), LINE("HTTP/1.1", code, text) } },
+
+static const struct
+{
+  int code;
+  struct { unsigned length; const char *text; } line[2];
+}
+status_lines[] =
+{
+  STATUSES(STATUS_LINES)
+};
+
+const char*
+minute_http_status_line    (enum http_version  version,
+                            int                code,
+                            unsigned          *length)
+{
+  int l = 0, h = sizeof(status_lines)/sizeof(status_lines[0]);
+  while (l < h) {
+    int m = (l+h)/2;
+    if (status_lines[m].code < code)
+      l = m+1;
+    else
+      h = m;
+  }
+  if (l == sizeof(status_lines)/sizeof(status_lines[0])
+      || status_lines[l].code != code)
+    return 0;
+  *length = status_lines[l].line[version == http_1_1].length;
+  return status_lines[l].line[version == http_1_1].text;
+}
+
 #ifdef USE_CONTENT_TYPES
 const char*
 minute_http_content_type    (content_type ct)
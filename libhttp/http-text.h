@@ -3,6 +3,17 @@
 
 const char*   minute_http_version_text   (enum http_version version);
 const char*   minute_http_response_text  (int code);
+const char*   minute_http_coding_text    (enum http_content_coding coding);
+
+/** \brief The status line of a response, "HTTP/1.1 200 OK\r\n", rendered
+           in advance.
+
+  \param length  set to the length of the line.
+  \returns       the line, or NULL if the code has no known reason phrase.
+*/
+const char*   minute_http_status_line    (enum http_version version,
+                                          int               code,
+                                          unsigned         *length);
 
 #ifdef USE_CONTENT_TYPES
 const char*   minute_http_content_type    (content_type   ct);
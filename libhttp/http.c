@@ -2,9 +2,12 @@
 #include "textint.h"
 #include "http.h"
 #include "http-headers.h"
+#include "http-headers-hash.h"
+#include "scan.h"
 
 #include <errno.h>
 #include <stddef.h>
+#include <string.h>
 
 /* RFC: 2616 */
 
@@ -33,71 +36,6 @@ typedef struct triestate
   unsigned slot;  // current table slot
 }
 triestate;
-                      // Check
-static const          //    Next
-patricia headers[] =  //       Offset
-{                     //          Terminal
-  {"a",                  0, 1, 4, 0},
-  {NULL,                 0, 0, 0, 0},
-  {"c",                  0, 8,13, 0},
-  {"date",               0,99, 0, http_rq_date},
-  {"expect",             0,99, 0, http_rq_expect},
-  {"from",               0,99, 0, http_rq_from},
-  {"ccept",              1, 2, 0, http_rq_accept},
-  {"host",               0,99, 0, http_rq_host},
-  {"if-",                0,26,30, 0},
-  {"charset",            3,99, 0, http_rq_accept_charset},
-  {"e",                 41,99, 0, http_rq_te},
-  {"encoding",           3,99, 0, http_rq_accept_encoding},
-  {"max-forwards",       0,99, 0, http_rq_max_forwards},
-  {"ache-control",       8,99, 0, http_rq_cache_control},
-  {"origin",             0,99, 0, http_rq_origin},
-  {"pr",                 0,35,25, 0},
-  {"atch",              27,99, 0, http_rq_if_match},
-  {"r",                  0,38,28, 0},
-  {"language",           3,99, 0, http_rq_accept_language},
-  {"t",                  0,41, 6, 0},
-  {"u",                  0,46,31, 0},
-  {"via",                0,99, 0, http_rq_via},
-  {"warning",            0,99, 0, http_rq_warning},
-  {"ra",                41,43,21, 0},
-  {"uthorization",       1,99, 0, http_rq_authorization},
-  {"agma",              35,99, 0, http_rq_pragma},
-  {"-",                  2, 3, 7, 0},
-  {"o",                  8,10,23, 0},
-  {"ange",              38,99, 0, http_rq_range},
-  {"iler",              43,99, 0, http_rq_trailer},
-  {"odified-since",     27,99, 0, http_rq_if_modified_since},
-  {"anguage",           15,99, 0, http_rq_content_language},
-  {"eferer",            38,99, 0, http_rq_referer},
-  {"encoding",          13,99, 0, http_rq_content_encoding},
-  {"nsfer-encoding",    43,99, 0, http_rq_transfer_encoding},
-  {"ength",             15,99, 0, http_rq_content_length},
-  {"n",                 10,11,25, 0},
-  {"okie",              10,99, 0, http_rq_cookie},
-  {"nection",           11,99, 0, http_rq_connection},
-  {"oxy-authorization", 35,99, 0, http_rq_proxy_authorization},
-  {"l",                 13,15,31, 0},
-  {"md5",               13,99, 0, http_rq_content_md5},
-  {"m",                 26,27,16, 0},
-  {"none-match",        26,99, 0, http_rq_if_none_match},
-  {"tent-",             11,13,29, 0},
-  {"ocation",           15,99, 0, http_rq_content_location},
-  {"pgrade",            46,99, 0, http_rq_upgrade},
-  {"range",             26,99, 0, http_rq_if_range},
-  {"type",              13,99, 0, http_rq_content_type},
-  {"ser-agent",         46,99, 0, http_rq_user_agent},
-  {"unmodified-since",  26,99, 0, http_rq_if_unmodified_since},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0},
-  {NULL,                 0, 0, 0, 0}
-};
-static const patricia patinitial_headers = { "", 0, 0, 0, 0 };
 
 // Methods: state 0, offset 0
 // Protocol: state 10, offset 1
@@ -153,7 +91,7 @@ typedef enum
   h_prot, h_prot_slash,
   h_prot_http_x, h_prot_http_x_dot, h_prot_http_x_x,
   h_cr, h_nl, h_newline, h_skipline,
-  h_header, h_header_unknown, h_escaped_1, h_escaped_2,
+  h_header, h_escaped_1, h_escaped_2,
   h_value_lead, h_cont,
   h_value,
   h_head_connection,
@@ -169,10 +107,21 @@ http_request_state;
 
 typedef enum
 {
-  hrf_collect_header = 0x1
+  hrf_collect_header = 0x1,
+  hrf_zerocopy       = 0x2,
+  hrf_ref            = 0x4
 }
 http_request_flags;
 
+typedef enum
+{
+  hv_none = 0,
+  hv_path,
+  hv_query,
+  hv_header
+}
+http_value_kind;
+
 typedef enum
 {
   hm_get = 0,
@@ -194,14 +143,35 @@ utility_trie_map (char c)
   else
     return 'Z'-'A'+1;
 }
-static unsigned
-header_trie_map (char c)
+
+/* Header names are recognized using a perfect hash generated from
+   tools/headers.txt at build time. The hash is computed incrementally while
+   reading the name, and the name is verified against the canonical name of
+   the header in its slot once the colon is reached. */
+static int
+header_lookup (unsigned      hash,
+               unsigned      ns,
+               unsigned      len,
+               const iobuf  *io)
 {
-  if (c >= 'a' && c <= 'z')
-    return c-'a';
-  else if (c == '-')
-    return 'z'-'a'+1;
-  else return 'z'-'a'+2;
+  int r = header_hash[HEADER_HASH_SLOT (hash)];
+  const char *name;
+  unsigned i;
+
+  if (!r)
+    return -1;
+  name = http_request_header_names[r];
+  for (i = 0; i < len; ++i) {
+    char c = io->data[(ns+i)&io->mask];
+    char n = name[i];
+    if (c >= 'A' && c <= 'Z')
+      c = c-'A'+'a';
+    if (n >= 'A' && n <= 'Z')
+      n = n-'A'+'a';
+    if (c != n)
+      return -1; // including n being the terminating null character.
+  }
+  return name[len] ? -1 : r;
 }
 
 static int
@@ -305,6 +275,257 @@ uri_uric(int c)
   return uri_unreserved(c) || uri_reserved(c);
 }
 
+/* Collected values (path, query and header values) are tracked as a span of
+   the input buffer [vs, ve) for as long as they can be referenced in place,
+   and are otherwise copied to the text buffer starting at vt. */
+static void
+value_open (minute_http_rqs *s,
+            unsigned         kind,
+            unsigned         m)
+{
+  s->vk = kind;
+  s->vs = s->ve = m;
+  s->vt = s->text->text;
+  if (s->flags & hrf_zerocopy)
+    s->flags |= hrf_ref;
+  else
+    s->flags &= ~hrf_ref;
+}
+
+static int
+value_copy (minute_http_rqs *s)
+{
+  if (s->flags & hrf_ref) {
+    iobuf *io = s->io;
+    unsigned i;
+    s->vt = s->text->text;
+    for (i = s->vs; i != s->ve; ++i)
+      if (1 != minute_textint_putc (io->data[i&io->mask], s->text))
+        return -1;
+    s->flags &= ~hrf_ref;
+  }
+  return 0;
+}
+
+/* Append l characters to the open value, data being the input at s->m
+   unless the characters have been transformed. */
+static int
+value_write (minute_http_rqs *s,
+             const char      *data,
+             unsigned         l)
+{
+  if (s->flags & hrf_ref) {
+    unsigned mask = s->io->mask;
+    if (s->vs == s->ve)
+      s->vs = s->ve = s->m; // nothing collected yet, rebase the span.
+    if (s->m == s->ve
+        && data == s->io->data + (s->m&mask)
+        && ((s->m&mask) || s->m == s->vs))
+    {
+      s->ve += l;
+      return l;
+    }
+    // not contiguous, transformed or wrapping the buffer; copy.
+    if (value_copy (s))
+      return -1;
+  }
+  return minute_textint_write (data, l, s->text);
+}
+
+static inline int
+value_putc (minute_http_rqs *s,
+            char             c)
+{
+  iobuf *io = s->io;
+  char *raw = io->data + (s->m&io->mask);
+  return 1 == value_write (s, *raw == c ? raw : &c, 1) ? 0 : -1;
+}
+
+static int
+value_close (minute_http_rq  *rq,
+             minute_http_rqs *s)
+{
+  unsigned ref, len;
+  if (s->flags & hrf_ref) {
+    ref = MINUTE_HTTP_REF_IN | (s->vs&s->io->mask);
+    len = s->ve - s->vs;
+  } else {
+    ref = s->vt;
+    len = s->text->text - s->vt;
+    if (1 != minute_textint_putc (0, s->text))
+      return -1;
+  }
+  switch (s->vk) {
+    case hv_path:
+      rq->path = ref;
+      rq->path_length = len;
+      break;
+    case hv_query:
+      rq->query = ref;
+      rq->query_length = len;
+      break;
+    case hv_header:
+      minute_textint_replacei (-2, ref, s->text);
+      minute_textint_replacei (-1, len, s->text);
+      break;
+  }
+  s->vk = hv_none;
+  return 0;
+}
+
+/* Reopen the last closed header value for a continuation line. */
+static int
+value_reopen (minute_http_rqs *s)
+{
+  s->vk = hv_header;
+  if (s->flags & hrf_ref)
+    return value_copy (s);
+  // drop the terminating null character.
+  -- s->text->text;
+  return 0;
+}
+
+static int
+detach_ref (unsigned   *ref,
+            unsigned    len,
+            const char *in,
+            textint    *text)
+{
+  unsigned t = text->text;
+  if (! (*ref & MINUTE_HTTP_REF_IN))
+    return 0;
+  if (0 > minute_textint_write (in + (*ref & ~MINUTE_HTTP_REF_IN), len, text)
+      || 1 != minute_textint_putc (0, text))
+    return -1;
+  *ref = t;
+  return 0;
+}
+
+unsigned
+minute_http_detach (minute_http_rq   *rq,
+                    textint          *text)
+{
+  int i, ints = minute_textint_intsize (text);
+  if (detach_ref (&rq->path, rq->path_length, rq->in, text)
+      || detach_ref (&rq->query, rq->query_length, rq->in, text))
+    return 413;
+  for (i = 0; i+MINUTE_HTTP_RECORD <= ints; i += MINUTE_HTTP_RECORD) {
+    unsigned ref = minute_textint_geti (i+1, text);
+    if (detach_ref (&ref, minute_textint_geti (i+2, text), rq->in, text))
+      return 413;
+    minute_textint_replacei (i+1, ref, text);
+  }
+  return 0;
+}
+
+// the header enum starts at one, after the unknown header.
+typedef char header_slots_check[HEADER_HASH_NAMES < MINUTE_HTTP_HEADER_SLOTS
+                                ? 1 : -1];
+
+/* Add a record of header h to the index of the request, if it's the first
+   one. Called before the record is written. */
+static int
+index_record (minute_http_rq *rq,
+              unsigned        h,
+              textint        *text)
+{
+  unsigned long long bit = 1ull << h;
+  if (!(rq->headers & bit)) {
+    unsigned n = minute_textint_intsize (text) / MINUTE_HTTP_RECORD;
+    if (n > 0xffff)
+      return -1;
+    rq->headers |= bit;
+    rq->header_record[h] = n;
+  }
+  return 0;
+}
+
+const char*
+minute_http_header (unsigned              header,
+                    unsigned             *length,
+                    const minute_http_rq *rq,
+                    textint              *text)
+{
+  int i;
+  if (header == http_rq_unknown_header || header >= MINUTE_HTTP_HEADER_SLOTS
+      || !(rq->headers & (1ull << header)))
+    return NULL;
+  i = rq->header_record[header] * MINUTE_HTTP_RECORD;
+  if (length)
+    *length = minute_textint_geti (i+2, text);
+  return minute_http_text (minute_textint_geti (i+1, text), rq, text);
+}
+
+int
+minute_http_header_id (const char *name)
+{
+  // the name in place of the input buffer, which never wraps.
+  iobuf io = {0, 0, ~0u, 0, (char*) name};
+  unsigned hash = 0, len;
+  int r;
+  for (len = 0; name[len]; ++len) {
+    char c = name[len];
+    if (len >= HEADER_HASH_MAXLEN)
+      return http_rq_unknown_header;
+    if (c >= 'A' && c <= 'Z')
+      c = c-'A'+'a';
+    hash = HEADER_HASH_STEP (hash, c);
+  }
+  r = header_lookup (hash, 0, len, &io);
+  return r < 0 ? http_rq_unknown_header : r;
+}
+
+const char*
+minute_http_unknown_header (const char           *name,
+                            unsigned             *length,
+                            const minute_http_rq *rq,
+                            textint              *text)
+{
+  int i, ints = rq->records * MINUTE_HTTP_RECORD;
+  unsigned namelen = strlen (name);
+  if (!(rq->headers & 1))
+    return NULL;
+  // start at the first unknown header.
+  i = rq->header_record[http_rq_unknown_header] * MINUTE_HTTP_RECORD;
+  for (; i+2*MINUTE_HTTP_RECORD <= ints; i += MINUTE_HTTP_RECORD) {
+    const char *n;
+    unsigned j;
+    if (minute_textint_geti (i, text) != http_rq_unknown_header)
+      continue;
+    // unknown headers come in pairs; name first, value second.
+    if (namelen == minute_textint_geti (i+2, text)) {
+      n = minute_http_text (minute_textint_geti (i+1, text), rq, text);
+      for (j = 0; j < namelen; ++j) {
+        char a = n[j], b = name[j];
+        if (a >= 'A' && a <= 'Z')
+          a = a-'A'+'a';
+        if (b >= 'A' && b <= 'Z')
+          b = b-'A'+'a';
+        if (a != b)
+          break;
+      }
+      if (j == namelen) {
+        i += MINUTE_HTTP_RECORD;
+        if (length)
+          *length = minute_textint_geti (i+2, text);
+        return minute_http_text (minute_textint_geti (i+1, text), rq, text);
+      }
+    }
+    i += MINUTE_HTTP_RECORD;
+  }
+  return NULL;
+}
+
+const char*
+minute_http_text (unsigned              ref,
+                  const minute_http_rq *rq,
+                  textint              *text)
+{
+  if (ref & MINUTE_HTTP_REF_IN)
+    return rq->in + (ref & ~MINUTE_HTTP_REF_IN);
+  return minute_textint_gets (ref, text);
+}
+
 static void
 minute_http_rqs_init (unsigned          hmask,
                       iobuf            *io,
@@ -321,6 +542,10 @@ minute_http_rqs_init (unsigned          hmask,
     h_initial,  // est
     0,          // nl
     hmask,      // hmask
+    hv_none,    // vk
+    0,0,0,      // vs, ve, vt
+    0,          // hash
+    io->read,   // ns
     io,
     text
   };
@@ -342,6 +567,16 @@ minute_http_init (unsigned          hmask,
   text->ints = text->size;
 }
 
+void
+minute_http_init_zerocopy (unsigned          hmask,
+                           iobuf            *io,
+                           textint          *text,
+                           minute_http_rqs  *s)
+{
+  minute_http_init (hmask, io, text, s);
+  s->flags |= hrf_zerocopy;
+}
+
 void
 minute_http_init_trailers(unsigned          hmask,
                           iobuf            *io,
@@ -349,7 +584,10 @@ minute_http_init_trailers(unsigned          hmask,
                           minute_http_rqs  *s)
 {
   minute_http_rqs_init (hmask, io, text, s);
-  s->st = h_header;
+  // the trailers start right after the line ending the last chunk, so an
+  // empty line straight away ends them.
+  s->st = h_nl;
+  s->nl = 1;
 }
 
 #ifdef DEBUG_MINUTE_HTTP_READ
@@ -376,15 +614,45 @@ minute_http_read (minute_http_rq   *rq,
   const patricia *patinitial_flag = NULL;
   triestate tstate = {s.tries[0], s.tries[1]};
 
+  rq->in = buf;
+
 # define H_EOF (-1)
 # define shift(x) do{D("shift("#x")");s.st=(x);}while(0)
 # define reset(x) do{D("reset("#x")");s.st=(x);goto top;}while(0)
   D("start");
   while (1) {
+    if ((s.st == h_value || s.st == h_skipline) && s.m != e) {
+      // Values and skipped lines make up most of the request, and we only
+      // care about where they end; find the next delimiter in the contiguous
+      // part of the buffer and consume the run in one go.
+      unsigned bi = s.m&mask;
+      unsigned run = e - s.m;
+      unsigned l;
+      if (run > mask+1-bi)
+        run = mask+1-bi;
+      if (s.st == h_value) {
+        l = minute_scan_lws (buf+bi, run);
+        if (l && 0 > value_write (&s, buf+bi, l))
+          return 413;
+      } else {
+        l = minute_scan_eol (buf+bi, run);
+      }
+      if (l) {
+        s.m += l;
+        b = s.m;
+        continue;
+      }
+    }
     if (s.m == e) {
       if (ioflags & IOBUF_EOF) {
         c = H_EOF;
       } else {
+        // we'll be giving up the input, so anything referenced has to be
+        // copied before the buffer is refilled.
+        if (s.flags & hrf_zerocopy) {
+          if (minute_http_detach (rq, s.text) || value_copy (&s))
+            return 413;
+        }
         s.tries[0] = tstate.poff;
         s.tries[1] = tstate.slot;
         io->read = b;
@@ -431,7 +699,7 @@ minute_http_read (minute_http_rq   *rq,
       case h_method_sp:
         if (c != ' ') {
           b = s.m;
-          rq->path = s.text->text;
+          value_open (&s, hv_path, s.m);
           reset (h_path);
         }
         break; // consume all spaces.
@@ -441,7 +709,7 @@ minute_http_read (minute_http_rq   *rq,
           ||(c == ';'))
         {
           /* RFC 2396, Appendix A */
-          if (1 != minute_textint_putc(c, s.text))
+          if (value_putc (&s, c))
             return 414;
           b = s.m;
         } else if (c == '%') {
@@ -449,13 +717,13 @@ minute_http_read (minute_http_rq   *rq,
           shift (h_escaped_1);
           b = s.m;
         } else if (c == '?') {
-          if (1 != minute_textint_putc(0, s.text))
+          if (value_close (rq, &s))
             return 414;
           b = s.m;
-          rq->query = s.text->text;
+          value_open (&s, hv_query, s.m+1);
           shift (h_query);
         } else if (c == ' ') {
-          if (1 != minute_textint_putc(0, s.text))
+          if (value_close (rq, &s))
             return 414;
           b = s.m;
           shift (h_path_sp);
@@ -472,7 +740,7 @@ minute_http_read (minute_http_rq   *rq,
         if (! uri_hex(c))
           reset (h_error_bad_request);
         escaped = (s.esc << 4) | uri_hex_conv(c);
-        if (1 != minute_textint_putc(escaped, s.text))
+        if (value_putc (&s, escaped))
           return 414;
         s.esc = 0;
         shift (s.est);
@@ -480,7 +748,7 @@ minute_http_read (minute_http_rq   *rq,
       case h_query:
         if (uri_uric(c)) {
           /* RFC 2396, Appendix A */
-          if (1 != minute_textint_putc(c, s.text))
+          if (value_putc (&s, c))
             return 414;
           b = s.m;
         } else if (c == '%') {
@@ -488,7 +756,7 @@ minute_http_read (minute_http_rq   *rq,
           shift (h_escaped_1);
           b = s.m;
         } else if (c == ' ') {
-          if (1 != minute_textint_putc(0, s.text))
+          if (value_close (rq, &s))
             return 414;
           b = s.m;
           shift (h_path_sp);
@@ -577,30 +845,61 @@ minute_http_read (minute_http_rq   *rq,
         } else {
           s.nl = 0;
           b = s.m;
-          tstate.poff = 0;
-          tstate.slot = 0;
+          s.hash = 0;
+          s.ns = s.m;
           reset (h_header);
         }
 
         break;
       case h_header: {
-        int r;
-        if (c >= 'A' && c <= 'Z')
-          c = c-'A'+'a'; // convert these to lower case
-        r = walk_trie (c == ':' ? 0 : c, header_trie_map(c),
-                           headers, &patinitial_headers, &tstate);
-        if (r < 0) {
-          // TODO unknown header
-          /*
-          if (!(s.hmask & 1)) {
-            //TODO write iobuf -> text
-            reset (h_header_unknown)
-          } else
-          */
+        int r = 0;
+        if (c == ':') {
+          r = header_lookup (s.hash, s.ns, s.m - s.ns, io);
+        } else if (c == '\r' || c == '\n' || c == H_EOF) {
+          // malformed, no colon.
+          r = -1;
+        } else if (s.m - s.ns >= HEADER_HASH_MAXLEN && !(s.hmask & 1)) {
+          // longer than any header we know of, and we're not collecting
+          // unknown headers.
+          r = -1;
+        } else {
+          if (c >= 'A' && c <= 'Z')
+            c = c-'A'+'a'; // convert these to lower case
+          s.hash = HEADER_HASH_STEP (s.hash, c);
+        }
+        if (r < 0 && c == ':' && (s.hmask & 1)) {
+          // unknown header; record the name, followed by a record for the
+          // value.
+          unsigned len = s.m - s.ns;
+          unsigned ref = MINUTE_HTTP_REF_IN | (s.ns&mask);
+          if (!(s.flags & hrf_zerocopy) || (s.ns&mask) + len > mask+1) {
+            unsigned i;
+            ref = s.text->text;
+            for (i = s.ns; i != s.m; ++i)
+              if (1 != minute_textint_putc (buf[i&mask], s.text))
+                return 413;
+            if (1 != minute_textint_putc (0, s.text))
+              return 413;
+          }
+          if (index_record (rq, http_rq_unknown_header, s.text)
+              || 1 != minute_textint_puti (http_rq_unknown_header, s.text)
+              || 1 != minute_textint_puti (ref, s.text)
+              || 1 != minute_textint_puti (len, s.text)
+              || 1 != minute_textint_puti (http_rq_unknown_header, s.text)
+              || 1 != minute_textint_puti (0, s.text)
+              || 1 != minute_textint_puti (0, s.text))
+            return 413;
+          value_open (&s, hv_header, s.m+1);
+          s.flags |= hrf_collect_header;
+          s.est = h_value;
+          shift (h_value_lead);
+        } else if (r < 0) {
+          s.flags &= ~hrf_collect_header;
           reset (h_skipline);
         } else if (r > 0) {
           tstate.poff = 0;
           tstate.slot = 0;
+          s.flags &= ~hrf_collect_header;
           switch (r) {
             case http_rq_connection:
               s.est = h_head_connection;
@@ -622,25 +921,24 @@ minute_http_read (minute_http_rq   *rq,
             default: {
               unsigned mask = 1u<<r;
               if (s.hmask & mask) {
-                if (1 != minute_textint_puti (r, s.text))
-                  return 413;
-                if (1 != minute_textint_puti (s.text->text, s.text))
+                if (index_record (rq, r, s.text)
+                    || 1 != minute_textint_puti (r, s.text)
+                    || 1 != minute_textint_puti (0, s.text)
+                    || 1 != minute_textint_puti (0, s.text))
                   return 413;
+                value_open (&s, hv_header, s.m+1);
                 s.flags |= hrf_collect_header;
                 s.est = h_value;
                 shift (h_value_lead);
               } else {
-                s.flags &= ~hrf_collect_header;
                 s.est = h_skipline;
                 shift (h_skipline);
               }
             } break;
           }
         }
-        // else keep going.
-        // header name string is only needed if we're collecting unknown headers
-        if (!(s.hmask & 1))
-          b = s.m;
+        // else keep going. The name is left in the input buffer (i.e. b is
+        // not advanced) until it has been verified.
       } break;
       case h_head_connection:
         patinitial_flag = &patinitial_connection;
@@ -687,7 +985,8 @@ minute_http_read (minute_http_rq   *rq,
         // replace previous null-termination
         // with a single space and continue.
         if (s.flags & hrf_collect_header) {
-          minute_textint_replacec(-1, ' ', s.text);
+          if (value_reopen (&s) || value_putc (&s, ' '))
+            return 413;
           reset (h_value_lead);
         } else
           reset (h_skipline);
@@ -705,7 +1004,7 @@ minute_http_read (minute_http_rq   *rq,
         else if (c == H_EOF) { s.nl = 99; }
         else if (c == ' ' || c == '\t') {
           // turn all whitespace into a single space
-          if (1 != minute_textint_putc(' ', s.text))
+          if (value_putc (&s, ' '))
             return 413;
           // consume any following whitespace using the
           // value_lead state..
@@ -713,13 +1012,13 @@ minute_http_read (minute_http_rq   *rq,
           shift (h_value_lead);
           break;
         } else {
-          if (1 != minute_textint_putc(c, s.text))
+          if (value_putc (&s, c))
             return 413;
           break;
         }
         // only reached if the last two elses didn't execute
         // (i.e. we get her on \r, \n, or eof.)
-        if (1 != minute_textint_putc(0, s.text))
+        if (value_close (rq, &s))
           return 413;
         break;
       case h_skipline:
@@ -742,6 +1041,7 @@ minute_http_read (minute_http_rq   *rq,
     if (s.nl > 1) {
       // we're done, we don't need to backtrack anymore.
       io->read = s.m;
+      rq->records = minute_textint_intsize (s.text) / MINUTE_HTTP_RECORD;
       *rqs = s;
       return 0;
     }
@@ -754,3 +1054,72 @@ minute_http_read (minute_http_rq   *rq,
   return 500;
 }
 
+
+/* Check whether the buffer holds a complete request head, i.e. up to and
+   including the empty line, so that parsing it can't run out of input. */
+static int
+head_complete (const iobuf *io)
+{
+  unsigned i = io->read, e = io->write, mask = io->mask;
+  const char *buf = io->data;
+  int nl = 0;
+  // leading empty lines are skipped by the parser.
+  while (i != e && (buf[i&mask] == '\r' || buf[i&mask] == '\n'))
+    ++i;
+  for (; i != e; ++i) {
+    char c = buf[i&mask];
+    if (c == '\n') {
+      if (nl)
+        return 1;
+      nl = 1;
+    } else if (c != '\r') {
+      nl = 0;
+    }
+  }
+  return (io->flags & IOBUF_EOF) != 0;
+}
+
+unsigned
+minute_http_read_many (minute_http_rq   *rq,
+                       unsigned          max,
+                       unsigned         *count,
+                       minute_http_rqs  *rqs)
+{
+  unsigned status, n;
+
+  *count = 0;
+  if ((status = minute_http_read (rq, rqs)))
+    return status;
+
+  for (n = 1; n < max; ++n) {
+    const minute_http_rq *prev = &rq[n-1];
+    iobuf *io = rqs->io;
+    textint *text = rqs->text;
+    unsigned read = io->read, ints = text->ints;
+    unsigned flags = rqs->flags & hrf_zerocopy;
+
+    // a payload has to be read before the next request, and there won't be
+    // a next request on a closing connection.
+    if ((prev->flags & http_transfer_chunked)
+        || ((prev->flags & http_content_length) && prev->content_length)
+        || (prev->flags & http_connection_close)
+        || (prev->server_protocol < http_1_1
+            && !(prev->flags & http_connection_keep))
+        || io->read == io->write || !head_complete (io))
+      break;
+
+    minute_http_rqs_init (rqs->hmask, io, text, rqs);
+    rqs->flags |= flags;
+    memset (&rq[n], 0, sizeof(rq[n]));
+    if (minute_http_read (&rq[n], rqs)) {
+      // leave it to be parsed again, and reported, by itself. Any text
+      // written stays, as records of the previous requests may have been
+      // detached into it.
+      io->read = read;
+      text->ints = ints;
+      break;
+    }
+  }
+  *count = n;
+  return 0;
+}
@@ -90,15 +90,35 @@ http_header_flags
   http_content_length   = 0x10
 };
 
+/** \brief Reference flag for values kept in the input buffer.
+
+  References with this bit set are offsets into the data of the input IO
+  buffer rather than into the text buffer, and are not null-terminated; use
+  the accompanying length. They are only produced by parsers initialized
+  using minute_http_init_zerocopy.
+
+  \see minute_http_text */
+#define MINUTE_HTTP_REF_IN 0x80000000u
+
+/** \brief Number of integers per header record in the text buffer. */
+#define MINUTE_HTTP_RECORD 3
+
+/** \brief Number of slots in the header index of the parsed request, must
+    be greater than the largest http_request_header. */
+#define MINUTE_HTTP_HEADER_SLOTS 64
+
 /** \brief Structure for the parsed request.
 
-  Unsigned integers, except flags, are references into the supplied text
-  IO buffer supplied to minute_http_init.
+  Path and query are references to the collected text, either offsets into
+  the supplied text IO buffer supplied to minute_http_init, or into the input
+  buffer if MINUTE_HTTP_REF_IN is set. Use minute_http_text to resolve them.
+
+  Collected headers are indexed as they are parsed, use minute_http_header to
+  look them up. The structure must be zeroed before parsing a request.
 */
 typedef struct
 minute_http_rq
 {
-  //TODO how to query collected headers?
   unsigned      flags;
 
   enum
@@ -107,9 +127,22 @@ minute_http_rq
   http_method   request_method;
 
   unsigned      path;
+  unsigned      path_length;
   unsigned      query;
+  unsigned      query_length;
 
   unsigned      content_length;
+
+  /** Input buffer data referenced by MINUTE_HTTP_REF_IN references. */
+  const char   *in;
+
+  /** Bit n is set if header n (an http_request_header) has been collected,
+      bit zero if any unknown header has. */
+  unsigned long long headers;
+  /** Record number of the first occurrence of each collected header. */
+  unsigned short     header_record[MINUTE_HTTP_HEADER_SLOTS];
+  /** Record number following the last record of the request. */
+  unsigned           records;
 }
 minute_http_rq;
 
@@ -133,6 +166,12 @@ minute_http_rqs
   unsigned        est;
   unsigned        nl;
   unsigned        hmask;
+  unsigned        vk;
+  unsigned        vs;
+  unsigned        ve;
+  unsigned        vt;
+  unsigned        hash;
+  unsigned        ns;
   struct iobuf   *io;
   struct textint *text;
 }
@@ -143,8 +182,12 @@ minute_http_rqs;
   The text part of the textint buffer stores all collected text data and is
   referenced using simple offsets. The first character in the buffer will be
   a null character, and any zero offset should be treated as unset. The int
-  part of the buffer stores header name/value pairs, where the name is an
-  http_request_header enum, and the value is an offset into the text buffer.
+  part of the buffer stores header records of MINUTE_HTTP_RECORD integers
+  each: the name as an http_request_header enum, a reference to the value,
+  and the length of the value. Unknown headers, collected if bit zero
+  (http_rq_unknown_header) is set, are stored as two consecutive
+  http_rq_unknown_header records, the first referencing the header name and
+  the second the value.
 
   \param  heads   Mask describing which headers to collect, zero to ignore all
                   headers, and all bits set to collect all headers. OR the
@@ -164,6 +207,25 @@ void      minute_http_init (unsigned          heads,
                             struct textint   *text,
                             minute_http_rqs  *state);
 
+/** \brief Initialize request parser state for zero-copy parsing.
+
+    Parameters are the same as for minute_http_init, but path, query and
+    header values are recorded as references into the input buffer
+    (MINUTE_HTTP_REF_IN) instead of being copied to the text buffer. Values
+    are only copied if they wrap around the end of the input buffer, need
+    unescaping or white space folding, or if the request could not be parsed
+    in a single call to minute_http_read.
+
+    The references are only valid as long as the parsed data is left in the
+    input buffer, i.e. until the buffer is written to again; call
+    minute_http_detach before that if they are still needed.
+
+    \see minute_http_init */
+void      minute_http_init_zerocopy (unsigned          heads,
+                                     struct iobuf     *in,
+                                     struct textint   *text,
+                                     minute_http_rqs  *state);
+
 /** \brief Initialize request parser state for parsing trailers (i.e. jump
     straight to parsing headers).
 
@@ -184,4 +246,269 @@ void      minute_http_init_trailers (unsigned          heads,
 unsigned  minute_http_read (minute_http_rq   *rq,
                             minute_http_rqs  *state);
 
+/** \brief Resolve a text reference of a parsed request.
+
+  \param  ref     The reference, e.g. the path of the request or the value of
+                  a header record.
+  \param  rq      The parsed request.
+  \param  text    The text buffer supplied to the parser.
+  \returns        A pointer to the referenced text. Only text buffer
+                  references are null-terminated.
+*/
+const char* minute_http_text (unsigned              ref,
+                              const minute_http_rq *rq,
+                              struct textint       *text);
+
+/** \brief Look up the value of a collected header.
+
+  Constant time, using the header index of the request. Only the first
+  occurrence of a header is returned; the interpreted headers Connection,
+  Content-Length, Expect and Transfer-Encoding are not collected, see the
+  request flags instead.
+
+  \param  header  The header, an http_request_header other than
+                  http_rq_unknown_header.
+  \param  length  Set to the length of the value, if found. May be NULL.
+  \param  rq      The parsed request.
+  \param  text    The text buffer supplied to the parser.
+  \returns        The value, or NULL if the header wasn't collected.
+*/
+const char* minute_http_header (unsigned              header,
+                                unsigned             *length,
+                                const minute_http_rq *rq,
+                                struct textint       *text);
+
+/** \brief Recognize a request header name, like the parser does.
+
+  \param  name    The header name, matched case insensitively.
+  \returns        The http_request_header of the name, http_rq_unknown_header
+                  if it isn't one recognized.
+*/
+int         minute_http_header_id (const char *name);
+
+/** \brief Look up the value of an unknown header by name.
+
+  \param  name    The header name, matched case insensitively.
+  \param  length  Set to the length of the value, if found. May be NULL.
+  \param  rq      The parsed request.
+  \param  text    The text buffer supplied to the parser.
+  \returns        The value of the first header of that name, or NULL if
+                  there is no such header (or unknown headers weren't
+                  collected.)
+*/
+const char* minute_http_unknown_header (const char           *name,
+                                        unsigned             *length,
+                                        const minute_http_rq *rq,
+                                        struct textint       *text);
+
+/** \brief Parse a batch of pipelined HTTP requests.
+
+  Parses the first request like minute_http_read, and then every following
+  request whose head is complete in the input buffer, up to max requests, so
+  that requests pipelined by the client are all picked up in one go. The
+  batch ends at a request with a payload, as the payload has to be read
+  before the next request, or one closing the connection. A request which
+  fails to parse is left in the input buffer, to be parsed again and have
+  its status reported by the next call.
+
+  All requests share the text buffer, and should be handled in order; the
+  text buffer must not be cleared until all of them have been handled.
+
+  \param rq       Array of max requests; the first must be zeroed before the
+                  first call, the others are zeroed as they are parsed.
+  \param max      Number of requests in the array.
+  \param count    Set to the number of requests parsed.
+  \param rqs      The parser state, see minute_http_read.
+  \returns        Zero if at least one request was parsed, otherwise as
+                  minute_http_read for the first request.
+*/
+unsigned  minute_http_read_many (minute_http_rq   *rq,
+                                 unsigned          max,
+                                 unsigned         *count,
+                                 minute_http_rqs  *rqs);
+
+/** \brief Copy any values referencing the input buffer to the text buffer.
+
+  Must be called before the input buffer is overwritten if the references
+  of a request parsed in zero-copy mode are to be used afterwards.
+
+  \param  rq      The parsed request.
+  \param  text    The text buffer supplied to the parser.
+  \returns        Zero on success, or 413 if the text buffer is full.
+*/
+unsigned  minute_http_detach (minute_http_rq   *rq,
+                              struct textint   *text);
+
+/** \brief Marks an unspecified end of a byte range.
+
+  A range with an open first position is a suffix range, its last position
+  being the length of the suffix, e.g. "bytes=-500". A range with an open
+  last position extends to the end of the entity, e.g. "bytes=500-".
+*/
+#define MINUTE_HTTP_RANGE_OPEN (~0ull)
+
+/** \brief A byte range, first and last positions inclusive. */
+typedef struct
+minute_http_range
+{
+  unsigned long long first;
+  unsigned long long last;
+}
+minute_http_range;
+
+/** \brief Parse the value of a Range header.
+
+  Only the bytes unit is supported. Positions are stored as given, see
+  MINUTE_HTTP_RANGE_OPEN, use minute_http_ranges_resolve to turn them into
+  positions within the entity once its size is known.
+
+  \param  value   The header value, see minute_http_header.
+  \param  length  The length of the value.
+  \param  ranges  The ranges to fill in.
+  \param  max     The number of ranges available.
+  \returns        The number of ranges parsed, or a negative value if the
+                  value is malformed, uses another unit, or holds more than
+                  max ranges. The header should be ignored in that case,
+                  i.e. the full entity sent.
+*/
+int       minute_http_ranges (const char         *value,
+                              unsigned            length,
+                              minute_http_range  *ranges,
+                              unsigned            max);
+
+/** \brief Resolve parsed ranges against the size of the entity.
+
+  Suffix and open ended ranges are turned into absolute positions, ranges
+  beyond the end of the entity are removed, and ranges overlapping or
+  adjacent to the range preceding them are merged with it.
+
+  \param  ranges  The ranges from minute_http_ranges, updated in place.
+  \param  count   The number of ranges.
+  \param  size    The size of the entity.
+  \returns        The number of ranges remaining; zero means none of them
+                  are satisfiable, and a 416 should be returned.
+*/
+unsigned  minute_http_ranges_resolve (minute_http_range  *ranges,
+                                      unsigned            count,
+                                      unsigned long long  size);
+
+/** \brief Parse an HTTP date.
+
+  Accepts the preferred IMF-fixdate format, e.g. "Sun, 06 Nov 1994 08:49:37
+  GMT", as well as the obsolete RFC 850 and asctime formats.
+
+  \param  value   The header value, e.g. of If-Modified-Since.
+  \param  length  The length of the value.
+  \param  epoch   Set to the time in seconds since the epoch.
+  \returns        Zero on success, or negative if the value is malformed or
+                  out of range, in which case the header should be ignored.
+*/
+int       minute_http_date   (const char         *value,
+                              unsigned            length,
+                              unsigned           *epoch);
+
+/** \brief An entity tag in a list of tags.
+
+  The tag references the header value it was parsed from, and includes the
+  surrounding quotes but not the weak indicator. A lone "*" matches any
+  entity tag.
+*/
+typedef struct
+minute_http_etag
+{
+  const char *tag;
+  unsigned    length;
+  int         weak;
+}
+minute_http_etag;
+
+/** \brief Parse the value of an If-Match or If-None-Match header.
+
+  \param  value   The header value.
+  \param  length  The length of the value.
+  \param  tags    The entity tags to fill in.
+  \param  max     The number of tags available.
+  \returns        The number of tags parsed, or negative if the value is
+                  malformed or holds more than max tags.
+*/
+int       minute_http_etags  (const char         *value,
+                              unsigned            length,
+                              minute_http_etag   *tags,
+                              unsigned            max);
+
+/** \brief Match an entity tag against a parsed list of tags.
+
+  \param  tags    The tags from minute_http_etags.
+  \param  count   The number of tags.
+  \param  etag    The entity tag of the representation, quotes included and
+                  optionally prefixed by W/ for a weak tag.
+  \param  length  The length of etag.
+  \param  weak    Non-zero for the weak comparison (used by If-None-Match),
+                  zero for the strong comparison (used by If-Match), where
+                  weak tags never match.
+  \returns        Non-zero if the tag matches.
+*/
+int       minute_http_etags_match (const minute_http_etag *tags,
+                                   unsigned                count,
+                                   const char             *etag,
+                                   unsigned                length,
+                                   int                     weak);
+
+enum
+http_content_coding
+{
+  http_coding_identity = 0,
+  http_coding_gzip,
+  http_coding_br,
+  http_coding_zstd,
+  http_coding_deflate,
+  http_coding_count
+};
+
+/** \brief Bit representing a content coding in a mask of codings. */
+#define MINUTE_HTTP_CODING(c) (1u<<(c))
+
+/** \brief The content codings accepted by the client. */
+typedef struct
+minute_http_codings
+{
+  /** Mask of acceptable codings, i.e. those with a non-zero q-value. */
+  unsigned        accept;
+  /** The q-value of each coding, in thousandths. */
+  unsigned short  q[http_coding_count];
+}
+minute_http_codings;
+
+/** \brief Parse the value of an Accept-Encoding header.
+
+  Codings other than the ones in http_content_coding are ignored. Identity
+  is acceptable unless explicitly excluded, but ranked below any other
+  acceptable coding. If the client sent no Accept-Encoding header, only
+  identity is considered acceptable.
+
+  \param  value    The header value, or NULL if there was no such header.
+  \param  length   The length of the value.
+  \param  codings  The accepted codings to fill in.
+  \returns         Zero on success, or negative if some part of the value was
+                   malformed and ignored; codings is filled in regardless.
+*/
+int       minute_http_accept_encoding (const char           *value,
+                                       unsigned              length,
+                                       minute_http_codings  *codings);
+
+/** \brief Rank the acceptable codings by preference.
+
+  Codings are ranked by q-value, and among equal q-values by how well they
+  compress, identity last.
+
+  \param  codings  The accepted codings.
+  \param  mask     The codings to consider, e.g. the ones available.
+  \param  ranked   Filled in with the acceptable codings in mask, most
+                   preferred first; room for http_coding_count entries.
+  \returns         The number of codings ranked.
+*/
+unsigned  minute_http_codings_rank (const minute_http_codings  *codings,
+                                    unsigned                    mask,
+                                    enum http_content_coding   *ranked);
+
 #endif /* idempotent include guard */
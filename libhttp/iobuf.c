@@ -14,6 +14,22 @@ minute_iobuf_clear   (iobuf *io)
   io->read = io->write = 0;
 }
 
+int
+minute_iobuf_resize  (iobuf    *io,
+                      char     *data,
+                      unsigned  size)
+{
+  unsigned i;
+  if (minute_iobuf_used(*io) > size)
+    return -1;
+
+  for (i = io->read; i != io->write; ++i)
+    data[i&(size-1)] = io->data[i&io->mask];
+  io->data = data;
+  io->mask = size-1;
+  return 0;
+}
+
 int
 minute_iobuf_put     (const char  c,
                       iobuf      *io)
@@ -76,14 +92,14 @@ minute_iobuf_read  (char     *data,
 {
   unsigned b = io->read;
   unsigned e = io->write;
-  unsigned l, ei, bi = b&io->mask;
+  unsigned l, bi = b&io->mask;
 
   if (e-b > sz) e = b + sz;
 
   l = e-b;
-  ei = e&io->mask;
 
-  if (ei < bi) {
+  // a full buffer wraps too, unless read from the start.
+  if (bi + l > io->mask + 1) {
     int tail = io->mask + 1 - bi;
     memcpy (data, io->data + bi, tail);
     memcpy (data+tail, io->data, l-tail);
@@ -35,6 +35,22 @@ iobuf minute_iobuf_init    (unsigned size,
 /** \brief Clear I/O buffer */
 void  minute_iobuf_clear   (iobuf   *io);
 
+/** \brief Move the buffer contents to another block of memory.
+
+  The read and write offsets are kept, thus any offsets into the buffer
+  remain valid when masked with the new mask, while pointers into the old
+  block do not.
+
+  \param io    the io buffer.
+  \param data  the new block.
+  \param size  the size of the new block, a power of two.
+  \returns     zero on success, or -1 if the data in the buffer does not fit,
+                in which case the buffer is left unchanged.
+*/
+int   minute_iobuf_resize  (iobuf    *io,
+                            char     *data,
+                            unsigned  size);
+
 /** \brief Append a character to the end of the buffer.
 
   \param c    the character to append.
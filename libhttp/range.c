@@ -0,0 +1,124 @@
+#include "http.h"
+
+/* RFC: 7233 */
+
+static int
+range_pos (const char        **p,
+           const char         *e,
+           unsigned long long *pos)
+{
+  const char *q = *p;
+  unsigned long long v = 0;
+  if (q == e || *q < '0' || *q > '9')
+    return -1;
+  for (; q != e && *q >= '0' && *q <= '9'; ++q) {
+    if (v > (MINUTE_HTTP_RANGE_OPEN - 1 - 9) / 10)
+      return -1; // too big for anything we could serve anyway.
+    v = v * 10 + (*q - '0');
+  }
+  *p = q;
+  *pos = v;
+  return 0;
+}
+
+static const char*
+range_ows (const char *p,
+           const char *e)
+{
+  while (p != e && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+int
+minute_http_ranges (const char         *value,
+                    unsigned            length,
+                    minute_http_range  *ranges,
+                    unsigned            max)
+{
+  static const char unit[] = "bytes=";
+  const char *p = value, *e = value + length;
+  unsigned i, n = 0;
+
+  if (length < sizeof(unit)-1)
+    return -1;
+  for (i = 0; i < sizeof(unit)-1; ++i, ++p) {
+    char c = *p;
+    if (c >= 'A' && c <= 'Z')
+      c = c-'A'+'a';
+    if (c != unit[i])
+      return -1;
+  }
+
+  while (1) {
+    unsigned long long first = MINUTE_HTTP_RANGE_OPEN;
+    unsigned long long last  = MINUTE_HTTP_RANGE_OPEN;
+
+    p = range_ows (p, e);
+    if (p == e)
+      break;
+    if (*p == ',') { // empty list elements are allowed.
+      ++p;
+      continue;
+    }
+    if (*p != '-' && range_pos (&p, e, &first))
+      return -1;
+    if (p == e || *p++ != '-')
+      return -1;
+    if (p != e && *p >= '0' && *p <= '9') {
+      if (range_pos (&p, e, &last))
+        return -1;
+    } else if (first == MINUTE_HTTP_RANGE_OPEN) {
+      return -1; // a lone dash.
+    }
+    if (first != MINUTE_HTTP_RANGE_OPEN && last != MINUTE_HTTP_RANGE_OPEN
+        && last < first)
+      return -1;
+    if (n == max)
+      return -1;
+    ranges[n].first = first;
+    ranges[n].last = last;
+    ++n;
+
+    p = range_ows (p, e);
+    if (p == e)
+      break;
+    if (*p++ != ',')
+      return -1;
+  }
+  return n ? (int) n : -1;
+}
+
+unsigned
+minute_http_ranges_resolve (minute_http_range  *ranges,
+                            unsigned            count,
+                            unsigned long long  size)
+{
+  unsigned i, n = 0;
+  for (i = 0; i < count; ++i) {
+    unsigned long long first = ranges[i].first, last = ranges[i].last;
+    if (first == MINUTE_HTTP_RANGE_OPEN) {
+      if (last == 0 || size == 0)
+        continue;
+      first = last < size ? size - last : 0;
+      last = size - 1;
+    } else if (first >= size) {
+      continue;
+    } else if (last >= size) {
+      last = size - 1;
+    }
+
+    if (n && first <= ranges[n-1].last + 1 && last + 1 >= ranges[n-1].first) {
+      // overlapping or adjacent; merge with the previous one.
+      if (first < ranges[n-1].first)
+        ranges[n-1].first = first;
+      if (last > ranges[n-1].last)
+        ranges[n-1].last = last;
+    } else {
+      ranges[n].first = first;
+      ranges[n].last = last;
+      ++n;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,116 @@
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+/* The scanners are used on runs of header data between delimiters, i.e.
+   most of every request, so the per-byte cost matters. Each scanner first
+   consumes as many full vectors (or words) as possible, and only resolves
+   the exact offset once a block containing a delimiter has been found. */
+
+static inline unsigned
+scan_tail (const char *data, unsigned i, unsigned size, int lws)
+{
+  for (; i < size; ++i) {
+    char c = data[i];
+    if (c == '\r' || c == '\n')
+      return i;
+    if (lws && (c == ' ' || c == '\t'))
+      return i;
+  }
+  return size;
+}
+
+#if defined(__AVX2__)
+static inline unsigned
+scan_vector (const char *data, unsigned size, int lws)
+{
+  const __m256i cr = _mm256_set1_epi8 ('\r');
+  const __m256i nl = _mm256_set1_epi8 ('\n');
+  const __m256i sp = _mm256_set1_epi8 (' ');
+  const __m256i ht = _mm256_set1_epi8 ('\t');
+  unsigned i = 0;
+
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i*) (data + i));
+    __m256i m = _mm256_or_si256 (_mm256_cmpeq_epi8 (v, cr),
+                                 _mm256_cmpeq_epi8 (v, nl));
+    if (lws)
+      m = _mm256_or_si256 (m, _mm256_or_si256 (_mm256_cmpeq_epi8 (v, sp),
+                                               _mm256_cmpeq_epi8 (v, ht)));
+    unsigned bits = (unsigned) _mm256_movemask_epi8 (m);
+    if (bits)
+      return i + __builtin_ctz (bits);
+  }
+  return scan_tail (data, i, size, lws);
+}
+#elif defined(__SSE2__)
+static inline unsigned
+scan_vector (const char *data, unsigned size, int lws)
+{
+  const __m128i cr = _mm_set1_epi8 ('\r');
+  const __m128i nl = _mm_set1_epi8 ('\n');
+  const __m128i sp = _mm_set1_epi8 (' ');
+  const __m128i ht = _mm_set1_epi8 ('\t');
+  unsigned i = 0;
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i*) (data + i));
+    __m128i m = _mm_or_si128 (_mm_cmpeq_epi8 (v, cr),
+                              _mm_cmpeq_epi8 (v, nl));
+    if (lws)
+      m = _mm_or_si128 (m, _mm_or_si128 (_mm_cmpeq_epi8 (v, sp),
+                                         _mm_cmpeq_epi8 (v, ht)));
+    unsigned bits = (unsigned) _mm_movemask_epi8 (m);
+    if (bits)
+      return i + __builtin_ctz (bits);
+  }
+  return scan_tail (data, i, size, lws);
+}
+#else
+/* Portable SWAR fallback; a word is flagged if any of its bytes equals the
+   searched character. The flag is exact for the lowest matching byte, but
+   to stay endian-agnostic the exact offset is resolved bytewise. */
+typedef unsigned long long scan_word;
+#define SCAN_ONES  0x0101010101010101ull
+#define SCAN_HIGHS 0x8080808080808080ull
+#define scan_has(w,c) ((((w)^(SCAN_ONES*(c)))-SCAN_ONES)\
+                       & ~((w)^(SCAN_ONES*(c))) & SCAN_HIGHS)
+
+static inline unsigned
+scan_vector (const char *data, unsigned size, int lws)
+{
+  unsigned i = 0;
+
+  for (; i + sizeof(scan_word) <= size; i += sizeof(scan_word)) {
+    scan_word w, m;
+    memcpy (&w, data + i, sizeof(w));
+    m = scan_has (w, '\r') | scan_has (w, '\n');
+    if (lws)
+      m |= scan_has (w, ' ') | scan_has (w, '\t');
+    if (m)
+      return scan_tail (data, i, i + sizeof(scan_word), lws);
+  }
+  return scan_tail (data, i, size, lws);
+}
+#undef scan_has
+#endif
+
+unsigned
+minute_scan_eol  (const char *data,
+                  unsigned    size)
+{
+  return scan_vector (data, size, 0);
+}
+
+unsigned
+minute_scan_lws  (const char *data,
+                  unsigned    size)
+{
+  return scan_vector (data, size, 1);
+}
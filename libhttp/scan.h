@@ -0,0 +1,31 @@
+#ifndef __MINUTE_SCAN_H__
+#define __MINUTE_SCAN_H__
+
+/** \brief Find the first line delimiter in a block of data.
+
+  Scans the block for a carriage return or a line feed, using vector
+  instructions where available (AVX2, SSE2) and a portable word-at-a-time
+  fallback otherwise.
+
+  \param data   the data to scan, no alignment required.
+  \param size   the number of bytes to scan.
+  \returns      the offset of the first '\\r' or '\\n', or size if there is
+                none.
+*/
+unsigned  minute_scan_eol  (const char *data,
+                            unsigned    size);
+
+/** \brief Find the first line delimiter or linear white space in a block of
+    data.
+
+  Same as minute_scan_eol, but also stops at spaces and horizontal tabs.
+
+  \param data   the data to scan, no alignment required.
+  \param size   the number of bytes to scan.
+  \returns      the offset of the first '\\r', '\\n', ' ' or '\\t', or size if
+                there is none.
+*/
+unsigned  minute_scan_lws  (const char *data,
+                            unsigned    size);
+
+#endif /* idempotent include guard */
@@ -2,7 +2,10 @@
 #include "textint.h"
 #include "http.h"
 #include "http-headers.h"
+#include "http-text.h"
+#include "scan.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,13 +15,14 @@
 
 #define BIT(x) (1ul<<(x))
 
-int
-main (void)
-{
-  char message[] =
+static const char message[] =
     "GET /test/uri?with&query-string HTTP/1.1\r\n"
     "Host: minute.example.org\r\n"
     "Connection: close\r\n"
+    "X-Skipped: a somewhat longer value which should be skipped in bulk\r\n"
+    "X-Ignored-Header-With-A-Long-Name: ignored\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64;  rv:115.0)\t"
+      "Gecko/20100101 Firefox/115.0\r\n"
     "Expect: 100-continue\r\n"
     "Transfer-Encoding: chunked\r\n"
     "Content-Length: 27\r\n"
@@ -27,20 +31,50 @@ main (void)
     "This data shouldn't be read\r\n"
     "0\r\n"
     "\r\n";
+
+static int
+text_equals (unsigned ref, unsigned len, minute_http_rq *rq, textint *text,
+             const char *expected)
+{
+  return len == strlen(expected)
+    && 0 == memcmp(minute_http_text(ref, rq, text), expected, len);
+}
+
+/* Parse the message, feeding the parser at most step bytes at a time,
+   starting at offset start of the input buffer. */
+static void
+test_parse (unsigned step, int zerocopy, unsigned start)
+{
+  char buffer[0x200];
   unsigned payloadOffset = strstr(message,"\r\n\r\n")-message+4;
-  char textbuf[0x40];
+  char textbuf[0x200];
 
-  iobuf   input = {0, sizeof(message)-1, 0xff, IOBUF_EOF, message};
-  textint text = {0, 0x40, 0x40, textbuf};
+  iobuf   input = {start, start, sizeof(buffer)-1, 0, buffer};
+  textint text = {0, sizeof(textbuf), sizeof(textbuf), textbuf};
 
   minute_http_rqs rqs;
   minute_http_rq  request = {};
 
+  unsigned        fed = 0;
   int             result;
 
-  minute_http_init(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  if (zerocopy)
+    minute_http_init_zerocopy(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  else
+    minute_http_init(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+
+  do {
+    unsigned n = sizeof(message)-1-fed;
+    if (n > step)
+      n = step;
+    if (n > minute_iobuf_free(input))
+      n = minute_iobuf_free(input);
+    minute_iobuf_write(message+fed, n, &input);
+    fed += n;
+    if (fed == sizeof(message)-1)
+      input.flags |= IOBUF_EOF;
+  } while ((result = minute_http_read (&request, &rqs)) == EAGAIN);
 
-  result = minute_http_read (&request, &rqs);
   if (result) {
     fprintf (stderr, "minute_http_read: %d\n", result);
     exit (1);
@@ -53,13 +87,461 @@ main (void)
   assert(request.flags & http_transfer_chunked);
   assert(request.flags & http_content_length);
   assert(27 == request.content_length);
-  assert(0 == strcmp(&textbuf[request.path], "/test/uri"));
-  assert(0 == strcmp(&textbuf[request.query], "with&query-string"));
-  assert(input.read == payloadOffset);
-  assert(minute_textint_intsize(&text) == 2);
+  assert(text_equals(request.path, request.path_length, &request, &text,
+                     "/test/uri"));
+  assert(text_equals(request.query, request.query_length, &request, &text,
+                     "with&query-string"));
+  assert(input.read == start + payloadOffset);
+  assert(minute_textint_intsize(&text) == 6*MINUTE_HTTP_RECORD);
   assert(minute_textint_geti(0, &text) == http_rq_host);
-  int hosti = minute_textint_geti(1, &text);
-  assert(0 == strcmp(&textbuf[hosti], "minute.example.org"));
+  assert(text_equals(minute_textint_geti(1, &text),
+                     minute_textint_geti(2, &text), &request, &text,
+                     "minute.example.org"));
+  assert(minute_textint_geti(3, &text) == http_rq_unknown_header);
+  assert(text_equals(minute_textint_geti(4, &text),
+                     minute_textint_geti(5, &text), &request, &text,
+                     "X-Skipped"));
+  assert(minute_textint_geti(6, &text) == http_rq_unknown_header);
+  assert(minute_textint_geti(15, &text) == http_rq_user_agent);
+  assert(text_equals(minute_textint_geti(16, &text),
+                     minute_textint_geti(17, &text), &request, &text,
+                     "Mozilla/5.0 (X11; Linux x86_64; rv:115.0) "
+                     "Gecko/20100101 Firefox/115.0"));
+
+  unsigned len;
+  const char *v = minute_http_unknown_header("x-skipped", &len, &request,
+                                             &text);
+  assert(v && text_equals(minute_textint_geti(7, &text), len, &request, &text,
+             "a somewhat longer value which should be skipped in bulk"));
+  assert(!minute_http_unknown_header("x-skip", 0, &request, &text));
+  v = minute_http_unknown_header("X-IGNORED-HEADER-WITH-A-LONG-NAME", &len,
+                                 &request, &text);
+  assert(v && len == 7 && !memcmp(v, "ignored", 7));
+
+  v = minute_http_header(http_rq_host, &len, &request, &text);
+  assert(v && len == 18 && !memcmp(v, "minute.example.org", len));
+  assert(minute_http_header(http_rq_user_agent, 0, &request, &text)
+         == minute_http_text(minute_textint_geti(16, &text), &request, &text));
+  assert(!minute_http_header(http_rq_cookie, 0, &request, &text));
+  assert(!minute_http_header(http_rq_connection, 0, &request, &text));
+  assert(!minute_http_header(http_rq_unknown_header, 0, &request, &text));
+
+  // parsed in one go, the path and host should be left in the input buffer
+  // while the user agent needed white space folding.
+  if (zerocopy && step == sizeof(message) && !start) {
+    assert(request.path & MINUTE_HTTP_REF_IN);
+    assert(minute_textint_geti(1, &text) & MINUTE_HTTP_REF_IN);
+    assert(minute_textint_geti(4, &text) & MINUTE_HTTP_REF_IN);
+    assert(!(minute_textint_geti(16, &text) & MINUTE_HTTP_REF_IN));
+  }
+
+  // and with the references detached, everything is in the text buffer.
+  assert(0 == minute_http_detach(&request, &text));
+  memset(buffer, 0, sizeof(buffer));
+  assert(0 == strcmp(&textbuf[request.path], "/test/uri"));
+  assert(0 == strcmp(&textbuf[minute_textint_geti(1, &text)],
+                     "minute.example.org"));
+}
+
+static void
+test_scan (void)
+{
+  char block[100];
+  unsigned i;
+
+  memset(block, 'x', sizeof(block));
+  assert(minute_scan_eol(block, sizeof(block)) == sizeof(block));
+  assert(minute_scan_lws(block, sizeof(block)) == sizeof(block));
+  for (i = 0; i < sizeof(block); ++i) {
+    block[i] = '\n';
+    assert(minute_scan_eol(block, sizeof(block)) == i);
+    block[i] = '\t';
+    assert(minute_scan_eol(block, sizeof(block)) == sizeof(block));
+    assert(minute_scan_lws(block, sizeof(block)) == i);
+    assert(minute_scan_lws(block, i) == i);
+    block[i] = 'x';
+  }
+}
+
+/* Every known header should be recognized, regardless of case. */
+static void
+test_headers (void)
+{
+  char message[0x1000] = "GET / HTTP/1.1\r\n";
+  char textbuf[0x800];
+  int  h, n = 0;
+
+  for (h = 1; h < http_request_header_names_count; ++h) {
+    char *p = message + strlen(message);
+    switch (h) {
+      case http_rq_connection:
+      case http_rq_content_length:
+      case http_rq_expect:
+      case http_rq_transfer_encoding:
+        continue; // interpreted, not collected.
+    }
+    sprintf(p, "%s: %d\r\n", http_request_header_names[h], h);
+    if (h & 1)
+      for (; *p != ':'; ++p)
+        if (*p >= 'a' && *p <= 'z')
+          *p += 'A'-'a';
+    n++;
+  }
+  strcat(message, "\r\n");
+
+  iobuf   input = {0, strlen(message), sizeof(message)-1, IOBUF_EOF, message};
+  textint text = {0, sizeof(textbuf), sizeof(textbuf), textbuf};
+  minute_http_rqs rqs;
+  minute_http_rq  request = {};
+
+  minute_http_init(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(0 == minute_http_read(&request, &rqs));
+  assert(minute_textint_intsize(&text) == n*MINUTE_HTTP_RECORD);
+  for (h = 0; h < n*MINUTE_HTTP_RECORD; h += MINUTE_HTTP_RECORD) {
+    int header = minute_textint_geti(h, &text);
+    assert(header == atoi(&textbuf[minute_textint_geti(h+1, &text)]));
+  }
+
+  // and looked up by name, whatever the order of the list.
+  for (h = 1; h < http_request_header_names_count; ++h)
+    assert(minute_http_header_id(http_request_header_names[h]) == h);
+  assert(minute_http_header_id("content-md5") == http_rq_content_md5);
+  assert(minute_http_header_id("USER-AGENT") == http_rq_user_agent);
+  assert(minute_http_header_id("user-agen") == http_rq_unknown_header);
+  assert(minute_http_header_id("user-agents") == http_rq_unknown_header);
+  assert(minute_http_header_id("") == http_rq_unknown_header);
+  assert(minute_http_header_id("x-a-header-name-longer-than-any-known-one")
+         == http_rq_unknown_header);
+}
+
+/* Pipelined requests should be parsed in one go, up to one with a payload
+   or one that isn't complete. */
+static void
+test_pipeline (void)
+{
+  static const char pipeline[] =
+    "GET /a HTTP/1.1\r\nHost: a\r\nX-A: a\r\n\r\n"
+    "GET /b HTTP/1.1\r\nHost: b\r\nX-A: b\r\n\r\n"
+    "POST /c HTTP/1.1\r\nContent-Length: 2\r\n\r\nxx"
+    "GET /d HTTP/1.1\r\nHost: d\r\n\r\n"
+    "GET /e HTTP/1.1\r\nHo";
+  char buffer[0x200];
+  char textbuf[0x200];
+  iobuf   input = {0, 0, sizeof(buffer)-1, 0, buffer};
+  textint text = {0, sizeof(textbuf), sizeof(textbuf), textbuf};
+  minute_http_rqs rqs;
+  minute_http_rq  rq[4] = {};
+  unsigned n, len;
+  const char *v;
+
+  minute_iobuf_write(pipeline, sizeof(pipeline)-1, &input);
+  minute_http_init_zerocopy(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(0 == minute_http_read_many(rq, 4, &n, &rqs) && n == 3);
+  assert(text_equals(rq[0].path, rq[0].path_length, &rq[0], &text, "/a"));
+  assert(text_equals(rq[1].path, rq[1].path_length, &rq[1], &text, "/b"));
+  assert(text_equals(rq[2].path, rq[2].path_length, &rq[2], &text, "/c"));
+  assert(rq[2].content_length == 2);
+  v = minute_http_header(http_rq_host, &len, &rq[1], &text);
+  assert(v && len == 1 && *v == 'b');
+  // unknown headers are looked up among the request's own records only.
+  v = minute_http_unknown_header("x-a", &len, &rq[0], &text);
+  assert(v && len == 1 && *v == 'a');
+  v = minute_http_unknown_header("x-a", &len, &rq[1], &text);
+  assert(v && len == 1 && *v == 'b');
+  assert(!minute_http_unknown_header("x-a", &len, &rq[2], &text));
+  assert(0 == memcmp(buffer + input.read, "xx", 2));
+
+  // skip the payload, the incomplete request is left in the buffer.
+  input.read += 2;
+  memset(rq, 0, sizeof(rq));
+  minute_textint_clear(&text);
+  minute_http_init_zerocopy(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(0 == minute_http_read_many(rq, 4, &n, &rqs) && n == 1);
+  assert(text_equals(rq[0].path, rq[0].path_length, &rq[0], &text, "/d"));
+  assert(0 == memcmp(buffer + input.read, "GET /e", 6));
+}
+
+/* The trailers of a chunked payload end at the first empty line, which may
+   follow the last chunk straight away. */
+static void
+test_trailers (void)
+{
+  static const char trailers[] =
+    "\r\n"
+    "GET /a HTTP/1.1\r\n\r\n"
+    "X-A: a\r\n"
+    "\r\n";
+  char buffer[0x100];
+  char textbuf[0x100];
+  iobuf   input = {0, 0, sizeof(buffer)-1, 0, buffer};
+  textint text = {0, sizeof(textbuf), sizeof(textbuf), textbuf};
+  minute_http_rqs rqs;
+  minute_http_rq  rq = {};
+  unsigned len;
+  const char *v;
+
+  minute_iobuf_write(trailers, sizeof(trailers)-1, &input);
+  minute_http_init_trailers(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(0 == minute_http_read(&rq, &rqs) && input.read == 2);
+  assert(!minute_http_unknown_header("x-a", &len, &rq, &text));
+
+  // the next request isn't taken for trailers.
+  input.read += strlen("GET /a HTTP/1.1\r\n\r\n");
+  minute_http_init_trailers(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(0 == minute_http_read(&rq, &rqs) && input.read == input.write);
+  v = minute_http_unknown_header("x-a", &len, &rq, &text);
+  assert(v && len == 1 && *v == 'a');
+}
+
+/* Reading wraps around the end of the buffer, even when it's full. */
+static void
+test_iobuf (void)
+{
+  char buffer[0x10];
+  char out[0x10];
+  iobuf io = minute_iobuf_init(sizeof(buffer), buffer);
+
+  minute_iobuf_write("0123", 4, &io);
+  assert(4 == minute_iobuf_read(out, 4, &io));
+  assert(16 == minute_iobuf_write("456789abcdefghij", 16, &io));
+  assert(16 == minute_iobuf_read(out, sizeof(out), &io));
+  assert(0 == memcmp(out, "456789abcdefghij", 16));
+  assert(0 == minute_iobuf_read(out, sizeof(out), &io));
+}
+
+static char grown[0x400];
+
+static int
+grow (textint *text, unsigned need)
+{
+  if (text->data == grown)
+    return -1;
+  return minute_textint_resize (text, grown, sizeof(grown));
+}
+
+/* Buffers should move to larger blocks with their contents intact, and the
+   text buffer do so on its own when given a grow hook. */
+static void
+test_grow (void)
+{
+  static const char request[] =
+    "GET /grow HTTP/1.1\r\n"
+    "Host: grow.example.org\r\n"
+    "Cookie: a-cookie-value-which-does-not-fit-the-small-text-buffer\r\n"
+    "\r\n";
+  char small[0x10], large[0x20], buffer[0x100], out[0x10];
+  int textbuf[0x10];
+  iobuf   input = {0, 0, sizeof(small)-1, 0, small};
+  textint text = {0, sizeof(textbuf), sizeof(textbuf), textbuf};
+  minute_http_rqs rqs;
+  minute_http_rq  rq = {};
+  unsigned len;
+  const char *v;
+
+  // wrap the end of the small buffer, and keep the offsets when moving.
+  input.read = input.write = 0xc;
+  minute_iobuf_write("0123456789", 10, &input);
+  assert(-1 == minute_iobuf_resize(&input, large, 8));
+  assert(0 == minute_iobuf_resize(&input, large, sizeof(large)));
+  assert(input.read == 0xc && input.mask == sizeof(large)-1);
+  assert(10 == minute_iobuf_read(out, sizeof(out), &input)
+         && 0 == memcmp(out, "0123456789", 10));
+
+  input = minute_iobuf_init(sizeof(buffer), buffer);
+  minute_iobuf_write(request, sizeof(request)-1, &input);
+  minute_http_init(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(413 == minute_http_read(&rq, &rqs));
+
+  minute_textint_clear(&text);
+  text.grow = grow;
+  input.read = 0;
+  memset(&rq, 0, sizeof(rq));
+  minute_http_init(MINUTE_ALL_HEADERS, &input, &text, &rqs);
+  assert(0 == minute_http_read(&rq, &rqs) && text.data == grown);
+  assert(text_equals(rq.path, rq.path_length, &rq, &text, "/grow"));
+  v = minute_http_header(http_rq_host, &len, &rq, &text);
+  assert(v && len == 16 && 0 == memcmp(v, "grow.example.org", len));
+  v = minute_http_header(http_rq_cookie, &len, &rq, &text);
+  assert(v && 0 == memcmp(v, "a-cookie-value-which", 20));
+}
+
+static int
+ranges (const char *value, minute_http_range *r, unsigned max)
+{
+  return minute_http_ranges (value, strlen(value), r, max);
+}
+
+static void
+test_ranges (void)
+{
+  minute_http_range r[4];
+
+  assert(1 == ranges("bytes=0-499", r, 4));
+  assert(r[0].first == 0 && r[0].last == 499);
+  assert(3 == ranges("Bytes=500-, -200 ,,9-9", r, 4));
+  assert(r[0].first == 500 && r[0].last == MINUTE_HTTP_RANGE_OPEN);
+  assert(r[1].first == MINUTE_HTTP_RANGE_OPEN && r[1].last == 200);
+  assert(r[2].first == 9 && r[2].last == 9);
+
+  assert(0 > ranges("bytes=", r, 4));
+  assert(0 > ranges("bytes=-", r, 4));
+  assert(0 > ranges("bytes=5-4", r, 4));
+  assert(0 > ranges("bytes=1-2;", r, 4));
+  assert(0 > ranges("items=0-1", r, 4));
+  assert(0 > ranges("bytes=0-1,2-3,4-5", r, 2));
+  assert(0 > ranges("bytes=99999999999999999999-", r, 4));
+
+  // suffix, clamped end, and a range beyond the end.
+  assert(4 == ranges("bytes=-100,0-49,500-2000,1000-", r, 4));
+  assert(3 == minute_http_ranges_resolve(r, 4, 1000));
+  assert(r[0].first == 900 && r[0].last == 999);
+  assert(r[1].first == 0 && r[1].last == 49);
+  assert(r[2].first == 500 && r[2].last == 999);
+
+  // overlapping and adjacent ranges are merged.
+  assert(4 == ranges("bytes=0-9,5-19,20-29,40-", r, 4));
+  assert(2 == minute_http_ranges_resolve(r, 4, 100));
+  assert(r[0].first == 0 && r[0].last == 29);
+  assert(r[1].first == 40 && r[1].last == 99);
+
+  assert(2 == ranges("bytes=-0,10-", r, 4));
+  assert(0 == minute_http_ranges_resolve(r, 2, 10));
+  assert(1 == ranges("bytes=-10", r, 4));
+  assert(0 == minute_http_ranges_resolve(r, 1, 0));
+}
+
+static void
+test_conditional (void)
+{
+  const char *v;
+  unsigned t;
+  minute_http_etag tags[3];
+
+  v = "Sun, 06 Nov 1994 08:49:37 GMT";
+  assert(0 == minute_http_date(v, strlen(v), &t) && t == 784111777);
+  v = "Sunday, 06-Nov-94 08:49:37 GMT";
+  assert(0 == minute_http_date(v, strlen(v), &t) && t == 784111777);
+  v = "Sun Nov  6 08:49:37 1994";
+  assert(0 == minute_http_date(v, strlen(v), &t) && t == 784111777);
+  v = "Thu, 01 Jan 1970 00:00:00 GMT";
+  assert(0 == minute_http_date(v, strlen(v), &t) && t == 0);
+  v = "Tue, 29 Feb 2028 23:59:59 GMT";
+  assert(0 == minute_http_date(v, strlen(v), &t) && t == 1835481599);
+  v = "Sun, 06 Nov 1994 08:49:37 CET";
+  assert(0 > minute_http_date(v, strlen(v), &t));
+  v = "Sun, 06 Nov 1994";
+  assert(0 > minute_http_date(v, strlen(v), &t));
+  v = "yesterday";
+  assert(0 > minute_http_date(v, strlen(v), &t));
+
+  v = "\"xyzzy\", W/\"r2d2xxxx\",\"c3piozzzz\"";
+  assert(3 == minute_http_etags(v, strlen(v), tags, 3));
+  assert(tags[0].length == 7 && !tags[0].weak);
+  assert(tags[1].length == 10 && tags[1].weak);
+  assert(minute_http_etags_match(tags, 3, "\"xyzzy\"", 7, 0));
+  assert(minute_http_etags_match(tags, 3, "W/\"xyzzy\"", 9, 1));
+  assert(!minute_http_etags_match(tags, 3, "W/\"xyzzy\"", 9, 0));
+  assert(!minute_http_etags_match(tags, 3, "\"r2d2xxxx\"", 10, 0));
+  assert(minute_http_etags_match(tags, 3, "\"r2d2xxxx\"", 10, 1));
+  assert(!minute_http_etags_match(tags, 3, "\"xyz\"", 5, 1));
+  assert(0 > minute_http_etags(v, strlen(v), tags, 2));
+
+  v = " * ";
+  assert(1 == minute_http_etags(v, strlen(v), tags, 3));
+  assert(minute_http_etags_match(tags, 1, "\"anything\"", 10, 0));
+  v = "xyzzy";
+  assert(0 > minute_http_etags(v, strlen(v), tags, 3));
+  v = "\"xyzzy";
+  assert(0 > minute_http_etags(v, strlen(v), tags, 3));
+}
+
+static unsigned
+rank (const char *value, unsigned mask, enum http_content_coding *ranked)
+{
+  minute_http_codings c;
+  minute_http_accept_encoding (value, value ? strlen(value) : 0, &c);
+  return minute_http_codings_rank (&c, mask, ranked);
+}
+
+static void
+test_codings (void)
+{
+  enum http_content_coding r[http_coding_count];
+  minute_http_codings c;
+  const char *v;
+
+  assert(1 == rank(NULL, ~0u, r) && r[0] == http_coding_identity);
+  assert(1 == rank("", ~0u, r) && r[0] == http_coding_identity);
+
+  assert(5 == rank("gzip, deflate, br, zstd", ~0u, r));
+  assert(r[0] == http_coding_br && r[1] == http_coding_zstd
+         && r[2] == http_coding_gzip && r[3] == http_coding_deflate
+         && r[4] == http_coding_identity);
+
+  assert(3 == rank("GZIP;q=1.0, br;q=0.5, zstd;q=0", ~0u, r));
+  assert(r[0] == http_coding_gzip && r[1] == http_coding_br
+         && r[2] == http_coding_identity);
+
+  assert(4 == rank("br;q=0.5, *;q=0.8, identity;q=0", ~0u, r));
+  assert(r[0] == http_coding_zstd && r[1] == http_coding_gzip
+         && r[2] == http_coding_deflate && r[3] == http_coding_br);
+
+  // a q-value below identity's keeps the body as is.
+  assert(2 == rank("gzip;q=0.1, identity", MINUTE_HTTP_CODING(http_coding_gzip)
+                   | MINUTE_HTTP_CODING(http_coding_identity), r));
+  assert(r[0] == http_coding_identity && r[1] == http_coding_gzip);
+  assert(1 == rank("*;q=0.8, identity;q=0", MINUTE_HTTP_CODING(http_coding_br)
+                   | MINUTE_HTTP_CODING(http_coding_identity), r));
+  assert(r[0] == http_coding_br);
+  assert(0 == rank("*;q=0", ~0u, r));
+
+  v = "x-gzip;foo=bar;q=0.123, br;q=2, ;;, zstd";
+  assert(0 > minute_http_accept_encoding(v, strlen(v), &c));
+  assert(c.q[http_coding_gzip] == 123 && c.q[http_coding_zstd] == 1000);
+  assert(!(c.accept & MINUTE_HTTP_CODING(http_coding_br)));
+}
+
+static void
+test_status_lines (void)
+{
+  unsigned length;
+  const char *line;
+
+  line = minute_http_status_line (http_1_1, 200, &length);
+  assert(line && length == 17 && 0 == strcmp("HTTP/1.1 200 OK\r\n", line));
+  line = minute_http_status_line (http_1_0, 505, &length);
+  assert(line && 0 == strcmp("HTTP/1.0 505 HTTP Version Not Supported\r\n",
+                             line) && length == strlen(line));
+  line = minute_http_status_line (http_1_1, 100, &length);
+  assert(line && 0 == strcmp("HTTP/1.1 100 Continue\r\n", line));
+  assert(!minute_http_status_line (http_1_1, 299, &length));
+  assert(!minute_http_status_line (http_1_1, 999, &length));
+
+  assert(0 == strcmp("Content-Type: ",
+                     http_response_header_prefixes[http_rsp_content_type].text)
+         && http_response_header_prefixes[http_rsp_content_type].length == 14);
+}
+
+int
+main (void)
+{
+  test_scan();
+  test_headers();
+  test_iobuf();
+  test_pipeline();
+  test_trailers();
+  test_grow();
+  test_ranges();
+  test_conditional();
+  test_codings();
+  test_status_lines();
+  test_parse(sizeof(message), 0, 0);
+  test_parse(1, 0, 0);
+  test_parse(7, 0, 0);
+  test_parse(sizeof(message), 1, 0);
+  test_parse(sizeof(message), 1, 0x1f8);
+  test_parse(1, 1, 0);
+  test_parse(7, 1, 0);
   assert(0 == strcmp("Warning",http_request_header_names[http_rq_warning]));
   return 0;
 }
@@ -1,9 +1,11 @@
 #include "textint.h"
 
+#include <string.h>
+
 textint
 minute_textint_init  (unsigned size, void *data)
 {
-  textint r = {0, size, size, data};
+  textint r = {0, size, size, data, 0};
   return r;
 }
 
@@ -14,6 +16,30 @@ minute_textint_clear (textint *text)
   text->ints = text->size;
 }
 
+int
+minute_textint_resize (textint *txt, void *data, unsigned size)
+{
+  unsigned ints = txt->size - txt->ints;
+  if (txt->text + ints > size)
+    return -1;
+
+  memmove (data, txt->data, txt->text);
+  memmove ((char*)data+size-ints, (char*)txt->data+txt->ints, ints);
+  txt->data = data;
+  txt->ints = size-ints;
+  txt->size = size;
+  return 0;
+}
+
+/* Make room for sz more bytes, if the buffer can grow. */
+static int
+minute_textint_room (unsigned sz, textint *txt)
+{
+  if (txt->text <= txt->ints && txt->ints-txt->text >= sz)
+    return 0;
+  return txt->grow ? txt->grow (txt, sz) : -1;
+}
+
 unsigned
 minute_textint_textsize (textint *txt)
 {
@@ -30,27 +56,37 @@ int
 minute_textint_putc  (const char  c,
                       textint    *txt)
 {
-  unsigned lo = txt->text;
-  unsigned hi = txt->ints;
-
-  if(lo >= hi)
+  if (minute_textint_room (1, txt))
     return 0;
 
-  ((char*)txt->data)[lo] = c;
+  ((char*)txt->data)[txt->text] = c;
   txt->text++;
   return 1;
 }
 
+int
+minute_textint_write (const char *data,
+                      unsigned    sz,
+                      textint    *txt)
+{
+  if (minute_textint_room (sz, txt))
+    return -1;
+
+  memcpy((char*)txt->data+txt->text, data, sz);
+  txt->text += sz;
+  return sz;
+}
+
 int
 minute_textint_puti  (const int   i,
                       textint    *txt)
 {
-  unsigned lo = txt->text;
-  unsigned hi = txt->ints-sizeof(i);
+  unsigned hi;
 
-  if(lo >= hi)
+  if (minute_textint_room (sizeof(i)+1, txt))
     return 0;
 
+  hi = txt->ints-sizeof(i);
   ((int*)txt->data)[hi/sizeof(i)] = i;
   txt->ints -= sizeof(i);
   return 1;
@@ -6,6 +6,8 @@
     Text grows up and integers grow down. It is up to the client
     to ensure that the buffer is properly aligned.
 
+    The buffer may optionally grow when full, see grow below.
+
     //TODO switch text/ints around, thus making the buffer int aligned
     //not the end of the buffer.
 */
@@ -16,6 +18,15 @@ textint
   unsigned ints;
   unsigned size;
   void *data;
+  /** \brief Called when an append does not fit, may be NULL.
+
+      Expected to move the buffer to a larger block using
+      minute_textint_resize, making room for at least need more bytes.
+      Pointers previously returned by minute_textint_gets are invalidated.
+
+      \return Zero if the buffer grew, non-zero otherwise. */
+  int (*grow) (struct textint *text,
+               unsigned        need);
 }
 textint;
 
@@ -25,6 +36,22 @@ textint   minute_textint_init      (unsigned size,
 /** \brief Clear I/O buffer */
 void      minute_textint_clear     (textint *text);
 
+/** \brief Move the buffer contents to another block of memory.
+
+  The text is placed at the start of the new block and the integers at the
+  end, thus offsets given to minute_textint_gets and minute_textint_geti are
+  still valid afterwards.
+
+  \param text  the textint buffer.
+  \param data  the new block, suitably aligned.
+  \param size  the size of the new block.
+  \returns     zero on success, or -1 if the contents do not fit, in which
+                case the buffer is left unchanged.
+*/
+int       minute_textint_resize    (textint  *text,
+                                    void     *data,
+                                    unsigned  size);
+
 /** \brief Query the number of characters stored in the buffer */
 unsigned  minute_textint_textsize  (textint *text);
 
@@ -41,6 +68,18 @@ unsigned  minute_textint_intsize   (textint *text);
 int   minute_textint_putc  (char        c,
                             textint    *text);
 
+/** \brief Append a block of characters to the text buffer.
+
+  \param data   the characters to append.
+  \param nelem  the number of characters to append.
+  \param text   the text buffer.
+  \returns      the number of characters written, or -1 if the data did not
+                fit in the buffer, in which case nothing is written.
+*/
+int   minute_textint_write (const char *data,
+                            unsigned    nelem,
+                            textint    *text);
+
 /** \brief Get a pointer to a string in the buffer.
 
   The offset is a positive number from the start of the buffer, 0 being the
@@ -0,0 +1,422 @@
+/* Response path benchmark; serves a corpus of request streams using
+   minute_httpd_handle and reports the time and the number of system calls
+   taken per request.
+
+   usage: bench-httpd [-s] [-t seconds] [-r file ...] [case ...]
+
+   -s     serve over a socket pair rather than from memory.
+   -t s   minimum run time per case, in seconds (default 0.25).
+   -r f   also replay the request stream captured in file f, as a case named
+          after the file; may be given more than once.
+
+   Each run of a case is a connection of its own. The application answers
+   every request with a short text/plain body, except for /large, answered
+   with a body too large for the output buffer, and reads request payloads
+   in full, in place, except for the ones put under /files/, read into a
+   buffer of its own. From memory, the system calls counted are the ones the
+   transport would have made. */
+
+#include "libhttp/iobuf.h"
+#include "libhttp/textint.h"
+#include "libhttp/http.h"
+#include "libhttp/http-headers.h"
+#include "httpd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BROWSER_UA \
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) " \
+    "Gecko/20100101 Firefox/128.0\r\n"
+
+#define ASSET(path, accept) \
+  "GET " path " HTTP/1.1\r\nHost: www.example.org\r\n" \
+    BROWSER_UA "Accept: " accept "\r\n\r\n"
+
+#define FORM_64 \
+  "field_0123456789=abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRST&"
+
+#define FORM_1K \
+  FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 \
+  FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 FORM_64 FORM_64
+
+#define FORM_16K \
+  FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K \
+  FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K FORM_1K
+
+typedef struct
+bench_case
+{
+  const char *name;
+  const char *data;
+  unsigned    length;
+  unsigned    requests;
+}
+bench_case;
+
+static bench_case corpus[] =
+{
+  { "get",
+    "GET /articles/2024/06/parsing-http-fast.html HTTP/1.1\r\n"
+    "Host: www.example.org\r\n"
+    BROWSER_UA
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: close\r\n"
+    "\r\n", 0, 1 },
+  { "http10",
+    "GET /index.html HTTP/1.0\r\n"
+    "User-Agent: ApacheBench/2.3\r\n"
+    "Accept: */*\r\n"
+    "\r\n", 0, 1 },
+  { "pipelined",
+    ASSET("/static/app.css", "text/css")
+    ASSET("/static/app.js", "*/*")
+    ASSET("/static/logo.svg", "image/svg+xml")
+    ASSET("/static/font.woff2", "font/woff2")
+    ASSET("/static/banner.webp", "image/webp")
+    ASSET("/static/icons.svg", "image/svg+xml")
+    ASSET("/static/vendor.js", "*/*")
+    ASSET("/favicon.ico", "image/*"), 0, 8 },
+  { "post",
+    "POST /api/v2/forms?validate=true HTTP/1.1\r\n"
+    "Host: api.example.org\r\n"
+    "User-Agent: example-client/3.1.4 (linux; amd64)\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 2048\r\n"
+    "Expect: 100-continue\r\n"
+    "\r\n"
+    FORM_1K FORM_1K, 0, 1 },
+  { "chunked-upload",
+    "POST /upload HTTP/1.1\r\n"
+    "Host: api.example.org\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "400\r\n" FORM_1K "\r\n"
+    "400\r\n" FORM_1K "\r\n"
+    "0\r\n"
+    "\r\n", 0, 1 },
+  { "upload",
+    "PUT /files/report.csv HTTP/1.1\r\n"
+    "Host: api.example.org\r\n"
+    "Content-Type: text/csv\r\n"
+    "Content-Length: 16384\r\n"
+    "Expect: 100-continue\r\n"
+    "\r\n"
+    FORM_16K, 0, 1 },
+  { "large",
+    "GET /large HTTP/1.1\r\n"
+    "Host: www.example.org\r\n"
+    BROWSER_UA
+    "Accept: */*\r\n"
+    "\r\n", 0, 1 },
+};
+
+static const char body[] =
+  "<!DOCTYPE html>\n<title>minute</title>\n<p>Served by the benchmark.</p>\n";
+
+#define LARGE_SIZE 0x4000
+
+typedef struct
+bench_conn
+{
+  unsigned requests;
+  char     scratch[0x400];
+  char     payload[0x4000];
+}
+bench_conn;
+
+static unsigned
+bench_head (minute_http_rq     *rq,
+            minute_httpd_head  *head,
+            textint            *text,
+            void               *user)
+{
+  bench_conn *c = user;
+  c->requests++;
+  head->string (http_rsp_content_type, "text/plain", head);
+  return 100;
+}
+
+static unsigned
+bench_payload (minute_http_rq    *rq,
+               minute_httpd_head *head,
+               minute_httpd_in   *in,
+               textint           *text,
+               void              *user)
+{
+  bench_conn *c = user;
+  const char *data;
+  int r;
+  if (rq->path_length > 7
+      && !memcmp (minute_http_text (rq->path, rq, text), "/files/", 7))
+    while (0 < (r = in->read (c->payload, sizeof(c->payload), in)))
+      ;
+  else
+    while (0 < (r = in->view (&data, in)))
+      ;
+  return r ? 400 : 200;
+}
+
+static unsigned
+bench_response (minute_http_rq   *rq,
+                minute_httpd_out *out,
+                minute_httpd_in  *in,
+                textint          *text,
+                unsigned          status,
+                void             *user)
+{
+  bench_conn *c = user;
+  unsigned n;
+  if (rq->path_length != 6
+      || memcmp (minute_http_text (rq->path, rq, text), "/large", 6))
+    return out->write (body, sizeof(body)-1, out) != sizeof(body)-1;
+  memset (c->scratch, 'x', sizeof(c->scratch));
+  for (n = 0; n < LARGE_SIZE; n += sizeof(c->scratch))
+    if (out->write (c->scratch, sizeof(c->scratch), out) != sizeof(c->scratch))
+      return 1;
+  return 0;
+}
+
+static void
+bench_error (minute_http_rq *rq,
+             unsigned        status,
+             void           *user)
+{
+}
+
+static void*
+bench_pool_get (unsigned size, minute_httpd_pool *pool)
+{
+  return size > 0x10000 ? NULL : malloc (size);
+}
+
+static void
+bench_pool_put (void *block, unsigned size, minute_httpd_pool *pool)
+{
+  free (block);
+}
+
+static minute_httpd_pool bench_pool = {
+  bench_pool_get,
+  bench_pool_put
+};
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Serve one connection, from memory or from a socket pair writing to out.
+   Returns the number of requests served, or -1. */
+static int
+serve (const bench_case                    *bc,
+       int                                  out,
+       minute_httpd_instrumented_transport *counted)
+{
+  static minute_httpd_app app = {
+    bench_head,
+    bench_payload,
+    bench_response,
+    bench_error
+  };
+  minute_httpd_memory_transport memory;
+  minute_httpd_state state;
+  bench_conn conn;
+  // the memory transport ignores the descriptors, which need only be valid.
+  int in[2] = {0, -1};
+  int status;
+
+  char inbuf[0x100];
+  char outbuf[0x400];
+  char textbuf[0x400];
+
+  if (out < 0) {
+    minute_httpd_memory_transport_init (bc->data, bc->length, NULL, 0,
+                                        &memory);
+    minute_httpd_instrumented_transport_init (&memory.base, counted);
+  } else {
+    // the whole stream is written up front, followed by the end of it.
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, in)
+        || fcntl (in[1], F_SETFL, O_NONBLOCK)
+        || write (in[1], bc->data, bc->length) != bc->length
+        || shutdown (in[1], SHUT_WR)) {
+      fprintf (stderr, "%s: can't write the requests: %s\n", bc->name,
+               strerror (errno));
+      exit (1);
+    }
+    minute_httpd_instrumented_transport_init (&minute_httpd_fd_transport,
+                                              counted);
+  }
+
+  minute_httpd_init (in[0], out < 0 ? 1 : out,
+    minute_iobuf_init(sizeof(inbuf), inbuf),
+    minute_iobuf_init(sizeof(outbuf), outbuf),
+    minute_textint_init(sizeof(textbuf), textbuf),
+    &state);
+  minute_httpd_set_pool (&bench_pool, &state);
+  minute_httpd_set_transport (&counted->base, &state);
+
+  conn.requests = 0;
+  while (httpd_client_ok_open
+         == (status = minute_httpd_handle (&app, &state, &conn)))
+    ;
+  minute_httpd_release (&state);
+
+  if (in[1] >= 0) {
+    close (in[0]);
+    close (in[1]);
+  }
+  if (status != httpd_client_ok_close && status != httpd_client_no_request) {
+    fprintf (stderr, "%s: connection ended with %d\n", bc->name, status);
+    return -1;
+  }
+  return conn.requests;
+}
+
+static int
+load (const char *path, bench_case *bc)
+{
+  FILE *f = fopen (path, "rb");
+  char *data = NULL;
+  size_t size = 0, length = 0, r;
+  const char *slash = strrchr (path, '/');
+
+  if (!f) {
+    fprintf (stderr, "%s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  do {
+    if (length == size && !(data = realloc (data, size = size*2 + 0x1000))) {
+      fprintf (stderr, "%s: out of memory\n", path);
+      fclose (f);
+      return -1;
+    }
+    length += r = fread (data + length, 1, size - length, f);
+  } while (r);
+  fclose (f);
+
+  bc->name = slash ? slash+1 : path;
+  bc->data = data;
+  bc->length = length;
+  // counted by the first run.
+  bc->requests = 0;
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  bench_case cases[sizeof(corpus)/sizeof(corpus[0]) + 16];
+  unsigned ncases = sizeof(corpus)/sizeof(corpus[0]), c, i;
+  int sockets = 0, out = -1;
+  pid_t drain = 0;
+  double mintime = 0.25;
+
+  memcpy (cases, corpus, sizeof(corpus));
+  for (i = 1; i < (unsigned) argc && argv[i][0] == '-'; ++i) {
+    if (!strcmp (argv[i], "-t") && i+1 < (unsigned) argc)
+      mintime = atof (argv[++i]);
+    else if (!strcmp (argv[i], "-s"))
+      sockets = 1;
+    else if (!strcmp (argv[i], "-r") && i+1 < (unsigned) argc
+             && ncases < sizeof(cases)/sizeof(cases[0])) {
+      if (load (argv[++i], &cases[ncases++]))
+        return 1;
+    } else {
+      fprintf (stderr,
+               "usage: %s [-s] [-t seconds] [-r file ...] [case ...]\n",
+               argv[0]);
+      return 1;
+    }
+  }
+
+  if (sockets) {
+    // responses are read and thrown away by a child process.
+    int sv[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) || 0 > (drain = fork ())) {
+      perror ("bench-httpd");
+      return 1;
+    }
+    if (!drain) {
+      char buffer[0x10000];
+      close (sv[0]);
+      while (0 < read (sv[1], buffer, sizeof(buffer)))
+        ;
+      _exit (0);
+    }
+    close (sv[1]);
+    out = sv[0];
+  }
+
+  printf ("%-16s %8s %6s %10s %10s %10s %10s   (%s)\n",
+          "case", "bytes", "reqs", "ns/req", "req/s", "calls/req",
+          "out B/req", sockets ? "socket pair" : "memory");
+
+  for (c = 0; c < ncases; ++c) {
+    bench_case *bc = &cases[c];
+    minute_httpd_instrumented_transport counted;
+    unsigned long long runs = 0, requests = 0, calls = 0, written = 0;
+    double t0, t1;
+    unsigned j;
+    int n;
+
+    if (i < (unsigned) argc) {
+      for (j = i; j < (unsigned) argc && strcmp (argv[j], bc->name); ++j)
+        ;
+      if (j == (unsigned) argc)
+        continue;
+    }
+    if (!bc->length)
+      bc->length = strlen (bc->data);
+
+    // warm up, and count the requests of a replayed stream.
+    if (0 > (n = serve (bc, out, &counted)))
+      return 1;
+    if (!bc->requests)
+      bc->requests = n;
+
+    t0 = now ();
+    do {
+      for (j = 0; j < 100; ++j) {
+        if (0 > (n = serve (bc, out, &counted)))
+          return 1;
+        requests += n;
+        calls += counted.reads + counted.writes + counted.sendfiles
+                 + counted.waits;
+        written += counted.written_bytes;
+      }
+      runs += 100;
+      t1 = now ();
+    } while (t1 - t0 < mintime);
+
+    if (!bc->requests || requests != runs * bc->requests) {
+      fprintf (stderr, "%s: served %llu requests, expected %llu\n",
+               bc->name, requests, runs * bc->requests);
+      return 1;
+    }
+    printf ("%-16s %8u %6u %10.1f %10.0f %10.2f %10.1f\n", bc->name,
+            bc->length, bc->requests, (t1 - t0) * 1e9 / requests,
+            requests / (t1 - t0), (double) calls / requests,
+            (double) written / requests);
+  }
+
+  if (drain) {
+    close (out);
+    waitpid (drain, NULL, 0);
+  }
+  return 0;
+}
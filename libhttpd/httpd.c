@@ -3,6 +3,7 @@
 #include "libhttp/http.h"
 #include "libhttp/http-headers.h"
 #include "libhttp/http-text.h"
+#include "libhttp/scan.h"
 #include "iobuf-util.h"
 #include "httpd.h"
 
@@ -17,11 +18,17 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 #include <time.h>
 
+#ifdef MINUTE_HTTPD_ZLIB
+# include <zlib.h>
+#endif
+
 #define BIT(x) (1ul<<(x))
 
 #define SERVER_NAME "minuted"
@@ -29,202 +36,356 @@
 
 #define NL "\r\n"
 
+// the number of entity tags considered in If-Match and If-None-Match.
+#define MAX_ETAGS 16
+
 typedef enum
 httpd_header_flags
 {
   httpd_te_chunked       = 0x01,
-  // always use chunked on keep-alive
-  httpd_connection_keep  = 0x02|httpd_te_chunked
+  httpd_connection_keep  = 0x02,
+  httpd_validators       = 0x04,
+  // the status was replaced evaluating the validators.
+  httpd_conditional      = 0x08,
+  // the response ends with the headers, e.g. a 304 or the response to HEAD.
+  httpd_no_body          = 0x10,
+  // the head lacks the headers framing the body, see minute_httpd_end_head.
+  httpd_head_open        = 0x20,
+  // the application declared the length of the body.
+  httpd_content_length   = 0x40,
+  // the body is to be compressed, once it's known to be large enough.
+  httpd_encode           = 0x80,
+  // the body is being compressed.
+  httpd_encoding         = 0x100
 }
 httpd_header_flags;
 
+typedef struct minute_httpd_response_head httpd_head;
+typedef minute_httpd_response httpd_response;
+
+/* Output queued until the descriptor is ready, see minute_httpd_drain:
+   data in a block from the pool, or the part of a file left to be sent. */
 typedef struct
-httpd_head
+minute_httpd_backlog
 {
-  minute_httpd_head base;
-  unsigned          flags;
+  struct minute_httpd_backlog *next;
+  unsigned            size;
+  unsigned            read;
+  unsigned            write;
+  int                 file;
+  unsigned long long  offset;
+  unsigned long long  length;
+  char                data[];
 }
-httpd_head;
+httpd_backlog;
 
-typedef struct
-httpd_in
+// the block queuing data, and the one queuing a file, which has no data.
+#define BACKLOG_BLOCK 0x1000
+#define BACKLOG_FILE 64
+
+#ifndef offsetof
+# define offsetof(type,memb) ((char*)&(((type*)0)->memb)-((char*)0))
+#endif
+#define downcast(type,memb,var) ((type*)(((char*)var)-offsetof(type,memb)))
+
+#define PENDING_INIT -1
+#define PENDING_TRAILERS -2
+#define PENDING_EOF -3
+#define PENDING_ERROR -4
+
+/* Move the input buffer to a block twice the size, the parser only keeps
+   offsets into it. */
+static int
+minute_httpd_grow_in(minute_httpd_state *state)
 {
-  minute_httpd_in base;
-  int             pending;
+  iobuf *in = &state->in;
+  unsigned old = in->mask+1, size = old*2;
+  char *data = in->data, *block;
+
+  if (!state->pool || !size || !(block = state->pool->get (size, state->pool)))
+    return -1;
+  minute_iobuf_resize (in, block, size);
+  if (data != state->in_fixed)
+    state->pool->put (data, old, state->pool);
+  return 0;
 }
-httpd_in;
 
-typedef struct
-httpd_out
+static int
+minute_httpd_grow_text(textint *text, unsigned need)
 {
-  minute_httpd_out  base;
+  minute_httpd_state *state = downcast(minute_httpd_state, text, text);
+  unsigned size = text->size*2;
+  void *data = text->data, *block;
+  unsigned old = text->size;
+
+  while (size && size - (text->size - text->ints) - text->text < need)
+    size *= 2;
+  if (!state->pool || !size || !(block = state->pool->get (size, state->pool)))
+    return -1;
+  minute_textint_resize (text, block, size);
+  if (data != state->text_fixed)
+    state->pool->put (data, old, state->pool);
+  return 0;
 }
-httpd_out;
 
-//TODO rename?
-typedef struct
-httpd_response
+/* Go back to the buffers given to minute_httpd_init once the text buffer has
+   been cleared, unless the input buffer still holds more than fits. */
+static void
+minute_httpd_shrink(minute_httpd_state *state)
 {
-  minute_httpd_state *state;
-  minute_http_rq  rq;
-  httpd_head      head;
-  httpd_in        in;
-  httpd_out       out;
+  iobuf *in = &state->in;
+  if (state->text.data != state->text_fixed) {
+    void *block = state->text.data;
+    unsigned size = state->text.size;
+    minute_textint_resize (&state->text, state->text_fixed,
+                           state->text_fixed_size);
+    state->pool->put (block, size, state->pool);
+  }
+  if (in->data != state->in_fixed) {
+    char *block = in->data;
+    unsigned size = in->mask+1;
+    if (!minute_iobuf_resize (in, state->in_fixed, state->in_fixed_size))
+      state->pool->put (block, size, state->pool);
+  }
 }
-httpd_response;
 
-#ifndef offsetof
-# define offsetof(type,memb) ((char*)&(((type*)0)->memb)-((char*)0))
-#endif
-#define downcast(type,memb,var) ((type*)(((char*)var)-offsetof(type,memb)))
+typedef enum
+{
+  // between requests, or taking the next one of a batch.
+  httpd_phase_idle,
+  // waiting for more of the request heads.
+  httpd_phase_head,
+  // waiting for the payload of the request to be handled, to read ahead.
+  httpd_phase_body,
+  // waiting to send 100 Continue.
+  httpd_phase_continue,
+  // waiting for more of the payload the payload function is reading.
+  httpd_phase_payload,
+  // waiting to read past what's left of the payload.
+  httpd_phase_discard,
+  // waiting to flush the end of the response.
+  httpd_phase_flush
+}
+httpd_phase;
 
-#define PENDING_INIT -1
-#define PENDING_EOF -2
-#define PENDING_ERROR -3
+/* Wait for a non-blocking descriptor to become ready. */
+static int
+minute_httpd_wait(minute_httpd_state *state, int fd, short events)
+{
+  return state->transport->wait (fd, events, state->transport);
+}
 
-typedef enum
+/* Put back the first block of the backlog. */
+static void
+minute_httpd_backlog_pop(minute_httpd_state *state)
 {
-  chunk_previous,
-  chunk_previous_cr,
-  chunk_size,
-  chunk_extension,
-  chunk_cr,
-  chunk_error
+  httpd_backlog *b = state->backlog;
+  if (!(state->backlog = b->next))
+    state->backlog_last = NULL;
+  state->pool->put (b, b->size + sizeof(*b), state->pool);
 }
-chunk_state;
 
+/* Close the connection on failure to write to it. */
+static void
+minute_httpd_close(minute_httpd_state *state)
+{
+  state->transport->close (state->outfd, state->transport);
+  state->outfd = -1;
+  while (state->backlog)
+    minute_httpd_backlog_pop (state);
+}
+
+/* Read as much as fits in the input buffer, see minute_iobuf_readfd. */
 static int
-minute_httpd_read_request(httpd_response   *resp,
-                          minute_http_rqs  *rqs)
+minute_httpd_readfd(minute_httpd_state *state)
+{
+  struct iovec iov[2];
+  int r;
+  if (0 > minute_iobuf_scatter (&iov[0], &iov[1], &state->in))
+    return -1;
+  r = state->transport->readv (state->infd, iov, 2, state->transport);
+  if (r > 0)
+    state->in.write += r;
+  else if (!r)
+    state->in.flags |= IOBUF_EOF;
+  return r;
+}
+
+/* Write the prefix on its own, ahead of the head being buffered, as an
+   interim response; non-zero if the descriptor would block. */
+static int
+minute_httpd_interim(minute_httpd_state *state)
+{
+  while (state->prefix_length && state->outfd >= 0) {
+    struct iovec iov = {state->prefix, state->prefix_length};
+    int r = state->transport->writev (state->outfd, &iov, 1,
+                                      state->transport);
+    if (r > 0) {
+      state->prefix_length -= r;
+      memmove (state->prefix, state->prefix + r, state->prefix_length);
+    } else if (r < 0 && errno == EAGAIN) {
+      return 1;
+    } else if (!r || errno != EINTR) {
+      minute_httpd_close (state);
+    }
+  }
+  state->prefix_length = 0;
+  return 0;
+}
+
+/* Read a batch of pipelined requests into the state. Returns EAGAIN if
+   the descriptor would block, and negative if the client has gone. */
+static int
+minute_httpd_read_request(minute_httpd_state *state,
+                          minute_http_rqs    *rqs)
 {
-  minute_httpd_state *state = resp->state;
   iobuf *in = &state->in;
   int status;
-  if(minute_iobuf_used(*in) > 0)
+  // resuming, the parser has already seen what's in the buffer.
+  if(minute_iobuf_used(*in) > 0 && state->phase != httpd_phase_head)
     goto prefilled; //yes, gotos do have proper uses.
   do {
     {
-      //TODO connection timeout on keep-alive.
-      //TODO serve multiple connections in same process?
-      int r = minute_iobuf_readfd(state->infd, in);
-      if(r < 0) {
-        status = http_request_uri_too_long;
-        break;
-      } else if (!r && in->flags & IOBUF_EOF) {
+      // how long to wait for the next request is up to the caller.
+      int r = minute_httpd_readfd(state);
+      if(r < 0 && errno == ENOBUFS && !minute_httpd_grow_in(state))
+        r = minute_httpd_readfd(state);
+      if(r < 0 && errno == ENOBUFS) {
+        return http_request_uri_too_long;
+      } else if (r < 0 && errno == EAGAIN) {
+        return EAGAIN;
+      } else if (r < 0 && errno == EINTR) {
+        continue;
+      } else if (r < 0 || (!r && in->flags & IOBUF_EOF)) {
         return -1;
       }
     }
     prefilled: ;
-  } while((status = minute_http_read (&resp->rq, rqs)) == EAGAIN);
+  } while((status = minute_http_read_many (state->batch, MINUTE_HTTPD_BATCH,
+                                           &state->batched, rqs)) == EAGAIN);
 
   return status;
 }
 
+/* The request is parsed in zero-copy mode, thus the collected values may
+   still reference the input buffer. Copy them to the text buffer before the
+   input buffer is refilled with payload data. */
 static int
-minute_httpd_in_read(char *buf, unsigned count, minute_httpd_in* in)
+minute_httpd_in_detach(httpd_response *resp)
+{
+  if (resp->in.detached)
+    return 0;
+  resp->in.detached = 1;
+  return minute_http_detach (&resp->rq, &resp->state->text);
+}
+
+#define in_byte(in,i) ((in)->data[(i)&(in)->mask])
+
+/* Decode the line ahead of a chunk, along with the line ending the data of
+   the previous one, and set up reading the trailers after the last. The
+   size line is found by a vectorized scan, which also skips any extension
+   in one go. Returns 1 once decoded, 0 if more input is needed, and -1 on
+   error. */
+static int
+minute_httpd_in_chunk(httpd_response *resp)
 {
-  httpd_response *resp = downcast(httpd_response, in.base, in);
   minute_httpd_state *state = resp->state;
+  iobuf *in = &state->in;
+  unsigned p = in->read, e, val = 0, digits = 0;
 
-  if(resp->in.pending <= PENDING_EOF)
-    return 0;
+  if (resp->in.pending == 0) {
+    if (p != in->write && in_byte(in, p) == '\r')
+      ++p;
+    if (p == in->write)
+      return 0;
+    if (in_byte(in, p++) != '\n')
+      return -1;
+  }
+
+  for (e = p; e != in->write; ) {
+    unsigned bi = e&in->mask;
+    unsigned run = in->write - e;
+    unsigned l;
+    if (run > in->mask+1 - bi)
+      run = in->mask+1 - bi;
+    e += l = minute_scan_eol (in->data + bi, run);
+    if (l < run)
+      break;
+  }
+  if (e == in->write || (in_byte(in, e) == '\r' && e+1 == in->write)) {
+    // someone's using a big extension if the buffer is full.
+    return minute_iobuf_used(*in) > in->mask ? -1 : 0;
+  }
+
+  for (; p != e; ++p) {
+    int c = in_byte(in, p);
+    if (c >= '0' && c <= '9')
+      c -= '0';
+    else if (c >= 'a' && c <= 'f')
+      c -= 'a' - 0xa;
+    else if (c >= 'A' && c <= 'F')
+      c -= 'A' - 0xA;
+    else if (c == ';' && digits)
+      break;
+    else
+      return -1;
+    // the size has to fit the pending count.
+    if (val > 0x7ffffff)
+      return -1;
+    val = (val<<4) + c;
+    ++digits;
+  }
+  if (!digits || (in_byte(in, e) == '\r' && in_byte(in, e+1) != '\n'))
+    return -1;
+  in->read = e + 1 + (in_byte(in, e) == '\r');
+
+  if (val == 0) {
+    resp->in.pending = PENDING_TRAILERS;
+    if (minute_httpd_in_detach (resp))
+      return -1;
+    // the batch holding the request ends with it, its parser is done.
+    memset (&state->rqs, 0, sizeof(state->rqs));
+    //TODO only headers specified in the Trailers header?
+    minute_http_init_trailers(MINUTE_ALL_HEADERS,
+      &state->in, &state->text, &state->rqs);
+    return 1;
+  }
+  resp->in.pending = val;
+  return 1;
+}
+
+/* Have some of the payload in the input buffer, reading more and decoding
+   the chunk framing and trailers as needed. Returns the number of payload
+   bytes buffered, zero at the end of the payload, or negative on error,
+   errno EAGAIN if the descriptor would block. */
+static int
+minute_httpd_in_fill(httpd_response *resp)
+{
+  minute_httpd_state *state = resp->state;
 
   while(1) {
-    if (resp->in.pending > 0) {
-      if(state->in.read < state->in.write) {
-        int r, toread = resp->in.pending > count ? count : resp->in.pending;
-        if (buf) {
-          r = minute_iobuf_read (buf, toread, &state->in);
-        } else {
-          if (state->in.read + toread > state->in.write)
-            toread = state->in.write - state->in.read;
-          state->in.read += toread;
-          r = toread;
-        }
-        resp->in.pending -= r;
-        return r;
+    if(resp->in.pending <= PENDING_EOF)
+      return 0;
+    if (resp->in.pending == PENDING_TRAILERS) {
+      //any non-zero status means failure.
+      int r = minute_http_read (&resp->rq, &state->rqs);
+      if (r != EAGAIN) {
+        resp->in.pending = r ? PENDING_ERROR : PENDING_EOF;
+        return r ? -1 : 0;
       }
       // read more.
+    } else if (resp->in.pending > 0) {
+      unsigned used = minute_iobuf_used(state->in);
+      if (used)
+        return used < (unsigned) resp->in.pending ? used : resp->in.pending;
+      // read more.
     } else if (resp->rq.flags & http_transfer_chunked) {
-      iobuf i = state->in;
-
-      unsigned val = 0;
-      chunk_state cs = resp->in.pending == 0 ? chunk_previous : chunk_size;
-#define reset(c) do{cs=c;goto top;}while(0)
-#define shift(c) do{cs=c;}while(0)
-      for(unsigned bi = i.read&i.mask; i.read < i.write; bi=++i.read&i.mask) {
-        int c = i.data[bi];
-        top: switch(cs)
-        {
-          case chunk_previous:
-            if (c == 13)
-              shift(chunk_previous_cr);
-            else if (c == 10)
-              reset(chunk_previous_cr);
-            else
-              reset(chunk_error);
-            break;
-          case chunk_previous_cr:
-            if (c == 10)
-              shift(chunk_size);
-            else
-              reset(chunk_error);
-            break;
-          case chunk_size:
-            if (c >= '0' && c <= '9')
-              val = (val<<4) + (c-'0');
-            else if (c >= 'a' && c <= 'f')
-              val = (val<<4) + (c-'a') + 0xa;
-            else if (c >= 'A' && c <= 'F')
-              val = (val<<4) + (c-'A') + 0xA;
-            else if (c == ';')
-              shift(chunk_extension);
-            else if (c == 13)
-              shift(chunk_cr);
-            else if (c == 10)
-              reset(chunk_cr);
-            else
-              reset(chunk_error);
-            break;
-          case chunk_extension:
-            if (c == 13)
-              shift(chunk_cr);
-            else if (c == 10)
-              reset(chunk_cr);
-            break;
-          case chunk_cr:
-            if (c == 10) {
-              ++i.read;
-              state->in = i;
-              if (val == 0) {
-                int status;
-                resp->in.pending = PENDING_EOF;
-                minute_http_rqs rqs = {};
-                //TODO only headers specified in the Trailers header?
-                minute_http_init_trailers(MINUTE_ALL_HEADERS,
-                  &state->in, &state->text, &rqs);
-                status = minute_httpd_read_request (resp, &rqs);
-                //any non-zero status means failure.
-                return status ? -1 : 0;
-              } else {
-                resp->in.pending = val;
-                return minute_httpd_in_read (buf, count, in); //tail recursion
-              }
-            } else {
-              reset(chunk_error);
-            }
-            break;
-          case chunk_error:
-            resp->in.pending = PENDING_ERROR;
-            return -1;
-        }
-#undef shift
-#undef reset
-        if (i.read == i.write) {
-            // buffer is full; someone's using a big extension.
-            resp->in.pending = PENDING_ERROR;
-            return -1;
-        }
+      int r = minute_httpd_in_chunk(resp);
+      if (r < 0) {
+        resp->in.pending = PENDING_ERROR;
+        return -1;
+      } else if (r) {
+        continue;
       }
       // read more.
     } else {
@@ -236,121 +397,813 @@ minute_httpd_in_read(char *buf, unsigned count, minute_httpd_in* in)
       return 0;
     }
 
-    int rfd = minute_iobuf_readfd (state->infd, &state->in);
+    if (minute_httpd_in_detach (resp)) {
+      resp->in.pending = PENDING_ERROR;
+      return -1;
+    }
+    int rfd = minute_httpd_readfd (state);
     if(!rfd && state->in.flags & IOBUF_EOF) {
         resp->in.pending = PENDING_EOF;
         return 0;
+    } else if (rfd < 0 && errno == EAGAIN) {
+      resp->in.blocked = 1;
+      return -1;
+    } else if (rfd < 0 && errno != EINTR) {
+      resp->in.pending = PENDING_ERROR;
+      return -1;
     }
   }
 
   /* unreachable */
 }
 
-static void
+/* Read payload from the connection straight into buf, or to the descriptor
+   to if buf is NULL, bypassing the input buffer, which has to be empty. Up
+   to the end of the payload, or of the chunk, is read. Returns as read,
+   or -1 with errno EINVAL if the transport can't splice, EAGAIN if the
+   descriptor would block. */
+static int
+minute_httpd_in_direct(httpd_response *resp, char *buf, int to,
+                       unsigned count)
+{
+  minute_httpd_state *state = resp->state;
+  minute_httpd_transport *t = state->transport;
+
+  if (count > (unsigned) resp->in.pending)
+    count = resp->in.pending;
+  while(1) {
+    int r;
+    if (buf) {
+      struct iovec iov = {buf, count};
+      r = t->readv (state->infd, &iov, 1, t);
+    } else if (t->splice) {
+      r = t->splice (state->infd, to, count, state->pipe, t);
+    } else {
+      errno = EINVAL;
+      return -1;
+    }
+    if (r > 0) {
+      resp->in.pending -= r;
+      return r;
+    } else if (!r) {
+      state->in.flags |= IOBUF_EOF;
+      resp->in.pending = PENDING_EOF;
+      return 0;
+    } else if (errno == EAGAIN) {
+      resp->in.blocked = 1;
+      return -1;
+    } else if (errno == EINVAL && !buf) {
+      return -1;
+    } else if (errno != EINTR) {
+      resp->in.pending = PENDING_ERROR;
+      return -1;
+    }
+  }
+}
+
+static int
+minute_httpd_in_read(char *buf, unsigned count, minute_httpd_in* in)
+{
+  httpd_response *resp = downcast(httpd_response, in.base, in);
+  minute_httpd_state *state = resp->state;
+  int r;
+
+  // large reads needn't go through the input buffer once it's empty.
+  if (buf && count > state->in.mask && resp->in.pending > 0
+      && state->in.read == state->in.write)
+    return minute_httpd_in_direct(resp, buf, -1, count);
+
+  r = minute_httpd_in_fill(resp);
+
+  if (r <= 0)
+    return r;
+  if ((unsigned) r > count)
+    r = count;
+  if (buf)
+    minute_iobuf_read (buf, r, &state->in);
+  else
+    state->in.read += r;
+  resp->in.pending -= r;
+  return r;
+}
+
+static int
+minute_httpd_in_view(const char **data, minute_httpd_in* in)
+{
+  httpd_response *resp = downcast(httpd_response, in.base, in);
+  iobuf *i = &resp->state->in;
+  int r = minute_httpd_in_fill(resp);
+  unsigned bi = i->read&i->mask;
+
+  if (r <= 0)
+    return r;
+  // up to where the buffer wraps around.
+  if ((unsigned) r > i->mask+1 - bi)
+    r = i->mask+1 - bi;
+  *data = i->data + bi;
+  i->read += r;
+  resp->in.pending -= r;
+  return r;
+}
+
+static int
+minute_httpd_in_splice(int fd, unsigned count, minute_httpd_in* in)
+{
+  httpd_response *resp = downcast(httpd_response, in.base, in);
+  minute_httpd_state *state = resp->state;
+  const char *data;
+  int r, w, n;
+
+  if (resp->in.pending > 0 && state->in.read == state->in.write
+      && (0 <= (r = minute_httpd_in_direct(resp, NULL, fd, count))
+          || errno != EINVAL))
+    return r;
+
+  // what's buffered, or all of it if the transport can't splice.
+  if (0 >= (r = minute_httpd_in_view(&data, in)))
+    return r;
+  if ((unsigned) r > count) {
+    state->in.read -= r - count;
+    resp->in.pending += r - count;
+    r = count;
+  }
+  for (w = 0; w < r; w += n) {
+    // writing nothing would never get done, thus fails like an error.
+    if ((0 > (n = write (fd, data + w, r - w)) && errno != EINTR)
+        || (!n && (errno = EIO))) {
+      resp->in.pending = PENDING_ERROR;
+      return -1;
+    } else if (n < 0) {
+      n = 0;
+    }
+  }
+  return r;
+}
+
+/* Whether some of the payload has yet to be read. */
+static int
+minute_httpd_unread(httpd_response *resp)
+{
+  return resp->in.pending > 0 || (resp->in.pending > PENDING_EOF
+                                  && resp->rq.flags & http_transfer_chunked);
+}
+
+/* Read past what's left of the payload; non-zero if the descriptor would
+   block. */
+static int
 minute_httpd_in_discard(httpd_response *resp)
 {
   minute_httpd_state *state = resp->state;
+  resp->in.blocked = 0;
   while(0<minute_httpd_in_read(NULL, state->in.mask+1, &resp->in.base))
     ;
+  return resp->in.blocked;
+}
+
+/* The number of bytes of body in the output buffer, following the head. */
+static unsigned
+minute_httpd_buffered_body(minute_httpd_state *state)
+{
+  unsigned used = minute_iobuf_used(state->out);
+  int head = state->body_mark - state->out.read;
+  return head <= 0 ? used : head < used ? used - head : 0;
+}
+
+/* Gather the pending output followed by count bytes of data: the prefix,
+   the head in the output buffer, and the body buffered after it and the
+   data, framed by flush_head and flush_tail. */
+static void
+minute_httpd_gather(minute_httpd_state *state,
+                    const char         *data,
+                    unsigned            count,
+                    struct iovec        iov[8])
+{
+  iobuf head = state->out, body = state->out;
+  memset (iov, 0, 8 * sizeof(*iov));
+  // the chunk size goes between the head and the body.
+  if (state->flush_head_length)
+    head.write = body.read = state->out.write
+                           - minute_httpd_buffered_body(state);
+  else
+    body.read = body.write;
+  iov[0].iov_base = state->prefix;
+  iov[0].iov_len = state->prefix_length;
+  minute_iobuf_gather (&iov[1], &iov[2], &head);
+  iov[3].iov_base = state->flush_head;
+  iov[3].iov_len = state->flush_head_length;
+  minute_iobuf_gather (&iov[4], &iov[5], &body);
+  iov[6].iov_base = (void*) data;
+  iov[6].iov_len = count;
+  iov[7].iov_base = (void*) state->flush_tail;
+  iov[7].iov_len = state->flush_tail_length;
+}
+
+/* Add a block of size bytes from the pool to the end of the backlog, NULL
+   if there is none to be had. */
+static httpd_backlog*
+minute_httpd_backlog_block(minute_httpd_state *state, unsigned size)
+{
+  httpd_backlog *b;
+  if (!state->pool || !(b = state->pool->get (size, state->pool)))
+    return NULL;
+  b->next = NULL;
+  b->size = size - sizeof(*b);
+  b->read = b->write = 0;
+  b->file = -1;
+  b->offset = b->length = 0;
+  if (state->backlog_last)
+    state->backlog_last->next = b;
+  else
+    state->backlog = b;
+  state->backlog_last = b;
+  return b;
 }
 
+/* Queue count bytes of data at the end of the backlog; non-zero if the
+   pool is out of blocks. */
 static int
-minute_httpd_chunk_end(httpd_response *resp)
+minute_httpd_backlog(minute_httpd_state *state,
+                     const char         *data,
+                     unsigned            count)
 {
-  minute_httpd_state *state = resp->state;
-  if (resp->head.flags & httpd_te_chunked) {
-    if(write (state->outfd, "0" NL NL, 5) < 0) {
-      close(state->outfd);
-      state->outfd = -1;
+  httpd_backlog *b = state->backlog_last;
+  while (count) {
+    unsigned n;
+    if ((!b || b->file >= 0 || b->write == b->size)
+        && !(b = minute_httpd_backlog_block (state, BACKLOG_BLOCK)))
+      return -1;
+    n = b->size - b->write < count ? b->size - b->write : count;
+    memcpy (b->data + b->write, data, n);
+    b->write += n;
+    data += n;
+    count -= n;
+  }
+  return 0;
+}
+
+/* Send up to length bytes of the file from offset, through the transport's
+   sendfile, or else by reading and writing some of it. Returns as
+   sendfile. */
+static int
+minute_httpd_send_file(minute_httpd_state *state,
+                       int                 fd,
+                       unsigned long long *offset,
+                       unsigned long long  length)
+{
+  minute_httpd_transport *t = state->transport;
+  char buf[0x1000];
+  struct iovec iov = {buf, 0};
+  int r = t->sendfile ? t->sendfile (state->outfd, fd, offset,
+                              length > 0x7ffff000 ? 0x7ffff000 : length, t)
+                      : (errno = EINVAL, -1);
+  if (r >= 0 || (errno != EINVAL && errno != ENOSYS))
+    return r;
+  // the file can't be sent by the kernel, copy it; what isn't written is
+  // read again the next time.
+  r = pread (fd, buf, length > sizeof(buf) ? sizeof(buf) : length, *offset);
+  if (r <= 0)
+    return r;
+  iov.iov_len = r;
+  if (0 < (r = t->writev (state->outfd, &iov, 1, t)))
+    *offset += r;
+  return r;
+}
+
+/* Write out the backlog; non-zero if the descriptor would block. */
+static int
+minute_httpd_drain(minute_httpd_state *state)
+{
+  minute_httpd_transport *t = state->transport;
+  httpd_backlog *b;
+  while ((b = state->backlog) && state->outfd >= 0) {
+    int r;
+    if (b->file < 0) {
+      struct iovec iov = {b->data + b->read, b->write - b->read};
+      if (0 < (r = t->writev (state->outfd, &iov, 1, t)))
+        b->read += r;
+    } else if (0 < (r = minute_httpd_send_file (state, b->file, &b->offset,
+                                                b->length))) {
+      b->length -= r;
+    }
+    if (r < 0 && errno == EAGAIN)
+      return 1;
+    if (r < 0 && errno == EINTR)
+      continue;
+    // writing nothing, or the file being shorter than said, is an error.
+    if (r <= 0) {
+      minute_httpd_close (state);
+      break;
     }
+    if (b->file < 0 ? b->read < b->write : b->length > 0)
+      continue;
+    // the file is done with, let what was held back along with it go.
+    if (b->file >= 0 && state->tcp && t->cork)
+      t->cork (state->outfd, 0, t);
+    minute_httpd_backlog_pop (state);
   }
   return 0;
 }
 
+/* Write the backlog, then the pending output followed by count bytes of
+   data in a single writev, see minute_httpd_gather. Should the descriptor
+   block, non-zero is returned, unless defer is set, in which case what's
+   left is moved to the backlog to be written once the descriptor is ready.
+   The connection is closed on failure, including running out of blocks
+   for the backlog. */
+static int
+minute_httpd_writev(minute_httpd_state *state,
+                    const char         *data,
+                    unsigned            count,
+                    int                 defer)
+{
+  struct iovec iov[8];
+  unsigned i, n;
+  int r;
+
+  while (state->outfd >= 0 && (state->backlog || state->prefix_length
+         || minute_iobuf_used(state->out) || state->flush_head_length
+         || count || state->flush_tail_length)) {
+    if (state->backlog) {
+      if (minute_httpd_drain (state))
+        goto blocked;
+      continue;
+    }
+    minute_httpd_gather (state, data, count, iov);
+    if (0 > (r = state->transport->writev (state->outfd, iov, 8,
+                                           state->transport))) {
+      if (errno == EAGAIN)
+        goto blocked;
+      if (errno == EINTR)
+        continue;
+      minute_httpd_close (state);
+      break;
+    }
+    for (i = 0; i < 8 && r; i++) {
+      n = (unsigned) r < iov[i].iov_len ? (unsigned) r : iov[i].iov_len;
+      r -= n;
+      switch (i) {
+        case 0:
+          state->prefix_length -= n;
+          memmove (state->prefix, state->prefix + n, state->prefix_length);
+          break;
+        case 3:
+          state->flush_head_length -= n;
+          memmove (state->flush_head, state->flush_head + n,
+                   state->flush_head_length);
+          break;
+        case 6:
+          data += n;
+          count -= n;
+          break;
+        case 7:
+          state->flush_tail += n;
+          state->flush_tail_length -= n;
+          break;
+        default:
+          state->out.read += n;
+      }
+    }
+  }
+  return 0;
+
+blocked:
+  if (!defer)
+    return 1;
+  minute_httpd_gather (state, data, count, iov);
+  for (i = 0; i < 8; i++)
+    if (minute_httpd_backlog (state, iov[i].iov_base, iov[i].iov_len)) {
+      minute_httpd_close (state);
+      return 0;
+    }
+  state->prefix_length = 0;
+  state->out.read = state->out.write;
+  state->flush_head_length = 0;
+  state->flush_tail_length = 0;
+  return 0;
+}
+
+/* End the head, now that the length of the body is known or has to be
+   decided, count bytes more are to follow the body in the output buffer, and
+   last is set if that's all of it. The body is then sent with a
+   Content-Length if it's been declared or is all there, chunked if HTTP/1.1
+   allows, or else delimited by closing the connection. */
+static void
+minute_httpd_end_head(httpd_response *resp,
+                      unsigned        count,
+                      int             last)
+{
+  minute_httpd_state *state = resp->state;
+  httpd_head *head = &resp->head;
+  unsigned long long length = minute_httpd_buffered_body(state) + count;
+  int n = 0, size = sizeof(state->flush_head);
+
+  head->flags &= ~httpd_head_open;
+  if (head->flags & httpd_no_body) {
+    // a response to HEAD tells the length of the body it would have had.
+    if (!(head->flags & httpd_content_length)
+        || resp->rq.request_method != http_head)
+      length = ~0ull;
+    else
+      length = head->length;
+  } else if (head->flags & httpd_content_length) {
+    length = head->length;
+  } else if (!last) {
+    length = ~0ull;
+    if (resp->rq.server_protocol >= http_1_1)
+      head->flags |= httpd_te_chunked;
+    else
+      head->flags &= ~httpd_connection_keep;
+  }
+
+  if ((head->flags & httpd_connection_keep) == httpd_connection_keep) {
+    if (resp->rq.server_protocol < http_1_1)
+      n += snprintf (state->flush_head+n, size-n, "%skeep-alive" NL,
+                     http_response_header_prefixes[http_rsp_connection].text);
+  } else if (resp->rq.server_protocol == http_1_1) {
+    n += snprintf (state->flush_head+n, size-n, "%sclose" NL,
+                   http_response_header_prefixes[http_rsp_connection].text);
+  }
+  if (head->flags & httpd_encoding)
+    n += snprintf (state->flush_head+n, size-n, "%s%s" NL,
+              http_response_header_prefixes[http_rsp_content_encoding].text,
+              minute_http_coding_text (head->coding));
+  if (head->flags & httpd_te_chunked)
+    n += snprintf (state->flush_head+n, size-n, "%schunked" NL,
+              http_response_header_prefixes[http_rsp_transfer_encoding].text);
+  else if (length != ~0ull)
+    n += snprintf (state->flush_head+n, size-n, "%s%llu" NL,
+                   http_response_header_prefixes[http_rsp_content_length].text,
+                   length);
+  n += snprintf (state->flush_head+n, size-n, NL);
+  state->flush_head_length = n;
+}
+
+/* Frame the body in the output buffer and count bytes to follow it, ending
+   the head if it's still open, and the transfer if last is set. */
+static void
+minute_httpd_frame(httpd_response *resp,
+                   unsigned        count,
+                   int             last)
+{
+  static const char end[] = NL "0" NL NL;
+  minute_httpd_state *state = resp->state;
+  unsigned total = minute_httpd_buffered_body(state) + count;
+
+  state->flush_head_length = 0;
+  state->flush_tail = end;
+  state->flush_tail_length = 0;
+  if (resp->head.flags & httpd_head_open)
+    minute_httpd_end_head (resp, count, last);
+  if (!(resp->head.flags & httpd_te_chunked))
+    return;
+  if (total) {
+    state->flush_head_length += snprintf (state->flush_head
+                                          + state->flush_head_length,
+                                          sizeof(state->flush_head)
+                                          - state->flush_head_length,
+                                          "%x" NL, total);
+    state->flush_tail_length = 2;
+  }
+  if (last) {
+    if (!state->flush_tail_length)
+      state->flush_tail += 2;
+    state->flush_tail_length += 5;
+  }
+}
+
+/* Flush the framed output; non-zero if the descriptor would block. */
+static int
+minute_httpd_flush_step(minute_httpd_state *state)
+{
+  if (minute_httpd_writev (state, NULL, 0, 0))
+    return 1;
+  minute_iobuf_clear (&state->out);
+  state->body_mark = 0;
+  return 0;
+}
+
 static int
 minute_httpd_chunk(const char      *buf,
                    unsigned         count,
-                   int              chunked,
-                   httpd_response  *resp)
+                   int              body,
+                   httpd_response  *resp);
+static int
+minute_httpd_write   (const char       *buf,
+                      unsigned          count,
+                      minute_httpd_out *o);
+
+#ifdef MINUTE_HTTPD_ZLIB
+/* The compressor of a response body, and the blocks it got from the pool,
+   along with their sizes, which zlib doesn't give back. */
+typedef struct
+httpd_encoder
 {
-  char chunksz[8];
-  struct iovec iov[5] = {};
-  int r, c = 0;
-  minute_httpd_state *state = resp->state;
-  unsigned used  = minute_iobuf_used(state->out);
-  unsigned total = used + count;
-  if (total == 0)
-    return 0; // don't output a zero chunk, as it would terminate the transfer
-  else if (chunked) {
-      iov[0].iov_len = snprintf (chunksz, sizeof(chunksz), "%x" NL, total);
-      iov[0].iov_base = chunksz;
-      iov[4].iov_len = 2;
-      iov[4].iov_base = NL;
-      c = 5;
-  } else {
-      iov[0].iov_len = 0;
-      iov[4].iov_len = 0;
-      c = 4;
-  }
-  minute_iobuf_gather (&iov[1], &iov[2], &state->out);
-  iov[3].iov_base = (void*) buf;
-  iov[3].iov_len = count;
-  // TODO perhaps use function pointers instead of writev directly,
-  // to simplify testing?
-  r = writev (state->outfd, iov, c);
-  if (r > 0) {
-    unsigned prefix = iov[0].iov_len;
-    if (r < prefix) // we weren't even able to print the chunk size?
-      return -1;
+  z_stream  z;
+  struct {
+    void     *block;
+    unsigned  size;
+  }         blocks[8];
+}
+httpd_encoder;
 
-    int cwritten;
-    if (r < prefix + used) {
-      state->out.read += r - prefix;
-      cwritten = 0;
-    } else {
-      state->out.read += used;
-      cwritten = r - prefix - used;
+#define ENCODER_SIZE 512
+
+static voidpf
+minute_httpd_zalloc(voidpf opaque, uInt items, uInt size)
+{
+  minute_httpd_state *state = opaque;
+  httpd_encoder *e = state->encoder;
+  unsigned n = 1, i;
+  while (n < items * size)
+    n <<= 1;
+  for (i = 0; i < sizeof(e->blocks)/sizeof(e->blocks[0]); ++i)
+    if (!e->blocks[i].block) {
+      e->blocks[i].block = state->pool->get (n, state->pool);
+      e->blocks[i].size = n;
+      return e->blocks[i].block;
     }
+  return Z_NULL;
+}
 
-    if (r < total) {
-      // Unable to write the entire chunk. Try again, block if we have to.
-      int rr = minute_httpd_chunk (buf + cwritten, count - cwritten, 0, resp);
-      if(rr < 1)
-        return rr;
-      r += rr;
+static void
+minute_httpd_zfree(voidpf opaque, voidpf block)
+{
+  minute_httpd_state *state = opaque;
+  httpd_encoder *e = state->encoder;
+  unsigned i;
+  for (i = 0; i < sizeof(e->blocks)/sizeof(e->blocks[0]); ++i)
+    if (e->blocks[i].block == block) {
+      state->pool->put (block, e->blocks[i].size, state->pool);
+      e->blocks[i].block = NULL;
     }
+}
+
+/* Compress count bytes of data into the output buffer, writing it out
+   whenever it fills. */
+static void
+minute_httpd_deflate(httpd_response *resp,
+                     const char     *data,
+                     unsigned        count,
+                     int             flush)
+{
+  minute_httpd_state *state = resp->state;
+  httpd_encoder *e = state->encoder;
+  int r, more = 1;
+
+  e->z.next_in = (Bytef*) data;
+  e->z.avail_in = count;
+  while (more && state->outfd >= 0) {
+    unsigned w = state->out.write & state->out.mask;
+    unsigned space = minute_iobuf_free(state->out);
+    if (!space) {
+      minute_httpd_chunk (0, 0, 1, resp);
+      continue;
+    }
+    if (space > state->out.mask+1 - w)
+      space = state->out.mask+1 - w;
+    e->z.next_out = (Bytef*) state->out.data + w;
+    e->z.avail_out = space;
+    r = deflate (&e->z, flush);
+    state->out.write += space - e->z.avail_out;
+    if (r != Z_OK && r != Z_STREAM_END)
+      break;
+    // flushing is done once deflate leaves room to spare.
+    more = e->z.avail_in
+        || (flush == Z_FINISH ? r != Z_STREAM_END
+                              : flush == Z_SYNC_FLUSH && !e->z.avail_out);
+  }
+}
+
+/* Start compressing the body, passing what's been buffered of it through
+   the compressor; non-zero if it can't be. */
+static int
+minute_httpd_encode_start(httpd_response *resp)
+{
+  minute_httpd_state *state = resp->state;
+  unsigned size = state->out.mask+1, used = minute_httpd_buffered_body(state);
+  httpd_encoder *e;
+  iobuf body = state->out;
+  char *raw = NULL;
+
+  if (!(e = state->pool->get (ENCODER_SIZE, state->pool)))
+    return -1;
+  if (used && !(raw = state->pool->get (size, state->pool))) {
+    state->pool->put (e, ENCODER_SIZE, state->pool);
+    return -1;
+  }
+  memset (e, 0, sizeof(*e));
+  e->z.zalloc = minute_httpd_zalloc;
+  e->z.zfree = minute_httpd_zfree;
+  e->z.opaque = state;
+  state->encoder = e;
+  // deflate is the zlib format, gzip adds its own header and trailer.
+  if (deflateInit2 (&e->z, resp->head.level, Z_DEFLATED,
+                    resp->head.coding == http_coding_gzip ? 15 + 16 : 15, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK) {
+    if (raw)
+      state->pool->put (raw, size, state->pool);
+    state->pool->put (e, ENCODER_SIZE, state->pool);
+    state->encoder = NULL;
+    return -1;
+  }
+
+  resp->head.flags |= httpd_encoding;
+  if (raw) {
+    body.read = body.write - used;
+    minute_iobuf_read (raw, used, &body);
+    state->out.write -= used;
+    minute_httpd_deflate (resp, raw, used, Z_NO_FLUSH);
+    state->pool->put (raw, size, state->pool);
+  }
+  return 0;
+}
+
+/* Finish compressing the body, putting back the compressor. */
+static void
+minute_httpd_encode_end(httpd_response *resp)
+{
+  minute_httpd_state *state = resp->state;
+  httpd_encoder *e = state->encoder;
+  minute_httpd_deflate (resp, 0, 0, Z_FINISH);
+  deflateEnd (&e->z);
+  state->pool->put (e, ENCODER_SIZE, state->pool);
+  state->encoder = NULL;
+}
+#else
+# define Z_NO_FLUSH 0
+# define Z_SYNC_FLUSH 2
+static void minute_httpd_deflate(httpd_response *resp, const char *data,
+                                 unsigned count, int flush) {}
+static int minute_httpd_encode_start(httpd_response *resp) { return -1; }
+static void minute_httpd_encode_end(httpd_response *resp) {}
+#endif
+
+/* Decide whether to compress the body requested to be, once count bytes
+   more are to follow the buffered part of it, and last is set if that's
+   all of it. Non-zero if the body is being compressed from now on. */
+static int
+minute_httpd_encode_decide(httpd_response *resp,
+                           unsigned        count,
+                           int             last)
+{
+  httpd_head *head = &resp->head;
+  if (!(head->flags & httpd_encode))
+    return 0;
+  head->flags &= ~httpd_encode;
+  if (head->flags & (httpd_no_body|httpd_content_length)
+      || (last && minute_httpd_buffered_body(resp->state) + count
+                  < head->min_size))
+    return 0;
+  return !minute_httpd_encode_start (resp);
+}
+
+/* Frame what's left in the output buffer as the last of the body, for
+   minute_httpd_step to flush. The connection is kept open unless the
+   response failed with result, or the framing of the body or the request
+   rules it out. */
+static void
+minute_httpd_finish(int result, httpd_response *resp)
+{
+  minute_httpd_state *state = resp->state;
+  if (minute_httpd_encode_decide (resp, 0, 1)
+      || resp->head.flags & httpd_encoding)
+    minute_httpd_encode_end (resp);
+  minute_httpd_frame (resp, 0, 1);
+  if (result)
+    state->result = result;
+  else if ((resp->head.flags & httpd_connection_keep) == httpd_connection_keep)
+    state->result = httpd_client_ok_open;
+  else
+    state->result = httpd_client_ok_close;
+}
+
+/* Write the pending output and count bytes of buf, framed if part of the
+   body, queuing what would block in the backlog. */
+static int
+minute_httpd_chunk(const char      *buf,
+                   unsigned         count,
+                   int              body,
+                   httpd_response  *resp)
+{
+  minute_httpd_state *state = resp->state;
+  if (body && minute_httpd_encode_decide (resp, count, 0)) {
+    minute_httpd_deflate (resp, buf, count, Z_NO_FLUSH);
+    return state->outfd < 0 ? -1 : (int) count;
+  } else if (body) {
+    minute_httpd_frame (resp, count, 0);
   } else {
-    close(state->outfd);
-    state->outfd = -1;
+    state->flush_head_length = 0;
+    state->flush_tail_length = 0;
   }
-  return r;
+  minute_httpd_writev (state, buf, count, 1);
+  return state->outfd < 0 ? -1 : (int) count;
 }
+
 static int
 minute_httpd_flush   (minute_httpd_out *o)
 {
   httpd_response *resp = downcast(httpd_response, out.base, o);
-  minute_httpd_chunk (0, 0, (resp->head.flags & httpd_te_chunked), resp);
+  if (resp->head.flags & httpd_encoding)
+    minute_httpd_deflate (resp, 0, 0, Z_SYNC_FLUSH);
+  minute_httpd_chunk (0, 0, 1, resp);
   return 0;
 }
 
+static int
+minute_httpd_sendfile (int                 fd,
+                       unsigned long long  offset,
+                       unsigned long long  length,
+                       minute_httpd_out   *o)
+{
+  httpd_response *resp = downcast(httpd_response, out.base, o);
+  minute_httpd_state *state = resp->state;
+  minute_httpd_transport *t = state->transport;
+  int chunked;
+  unsigned long long off = offset;
+  char size[24];
+
+  if (!length)
+    return 0; // a zero chunk would terminate the transfer.
+
+  // a body being compressed has to pass through the compressor.
+  if (resp->head.flags & (httpd_encode|httpd_encoding)) {
+    char buf[0x1000];
+    ssize_t r;
+    while (length && state->outfd >= 0
+           && 0 < (r = pread (fd, buf, length > sizeof(buf) ? sizeof(buf)
+                                                            : length, off))) {
+      minute_httpd_write (buf, r, o);
+      off += r;
+      length -= r;
+    }
+    if (length && state->outfd >= 0)
+      minute_httpd_close (state);
+    return state->outfd < 0;
+  }
+
+  // whatever's been written so far goes first, cork the socket to have it
+  // go out together with the file rather than in segments of its own.
+  if (state->tcp && t->cork)
+    t->cork (state->outfd, 1, t);
+  minute_httpd_flush (o);
+  chunked = resp->head.flags & httpd_te_chunked;
+  if (chunked)
+    minute_httpd_chunk (size, snprintf (size, sizeof(size), "%llx" NL, length),
+                        0, resp);
+  while (length && state->outfd >= 0) {
+    // the file goes after what's queued.
+    int r = state->backlog ? (errno = EAGAIN, -1)
+                           : minute_httpd_send_file (state, fd, &off, length);
+    if (r > 0) {
+      length -= r;
+    } else if (r < 0 && errno == EAGAIN) {
+      // the rest is sent once the descriptor is ready, uncorking it then.
+      httpd_backlog *b = minute_httpd_backlog_block (state, BACKLOG_FILE);
+      if (!b)
+        break;
+      b->file = fd;
+      b->offset = off;
+      b->length = length;
+      length = 0;
+    } else if (r < 0 && errno == EINTR) {
+      continue;
+    } else {
+      break; // error, or the file is shorter than said.
+    }
+  }
+
+  if (length && state->outfd >= 0)
+    minute_httpd_close (state);
+  if (state->tcp && t->cork && state->outfd >= 0 && !state->backlog)
+    t->cork (state->outfd, 0, t);
+  // the end of the chunk goes with whatever follows.
+  if (chunked && state->outfd >= 0) {
+    memcpy (state->prefix + state->prefix_length, NL, 2);
+    state->prefix_length += 2;
+  }
+  return state->outfd < 0;
+}
+
 static int
 minute_httpd_output (const char      *append,
                      unsigned         count,
-                     int              chunked,
+                     int              body,
                      httpd_response  *resp)
 {
   minute_httpd_state *state = resp->state;
-  if (minute_iobuf_free(state->out) < count)
-    minute_httpd_chunk(append, count, chunked, resp);
+  if (body && resp->head.flags & httpd_encoding)
+    minute_httpd_deflate(resp, append, count, Z_NO_FLUSH);
+  else if (minute_iobuf_free(state->out) < count)
+    minute_httpd_chunk(append, count, body, resp);
   else
     minute_iobuf_write(append, count, &state->out);
   return count;
 }
 static inline int
 minute_httpd_print  (const char *append,
-                     int chunked,
+                     int body,
                      httpd_response *resp)
-{ return minute_httpd_output(append, strlen(append), chunked, resp); }
+{ return minute_httpd_output(append, strlen(append), body, resp); }
 
 static int
 minute_httpd_write   (const char       *buf,
@@ -358,8 +1211,7 @@ minute_httpd_write   (const char       *buf,
                       minute_httpd_out *o)
 {
   httpd_response *resp = downcast(httpd_response, out.base, o);
-  return minute_httpd_output(buf, count,
-              (resp->head.flags & httpd_te_chunked), resp);
+  return minute_httpd_output(buf, count, 1, resp);
 }
 
 static int
@@ -370,14 +1222,76 @@ minute_httpd_header (enum http_response_header  header,
   // TODO if the output buffer is too small, we will erroneously flush it
   // before writing the status, i.e. TODO suppress flushing the output buffer
   httpd_response *resp = downcast(httpd_response, head, head);
+  const minute_http_header_prefix *prefix =
+    &http_response_header_prefixes[header];
+  if (header == http_rsp_content_length) {
+    // written along with the rest of the framing once the head ends.
+    char *end;
+    if (*value < '0' || *value > '9')
+      return -1;
+    resp->head.length = strtoull (value, &end, 10);
+    if (*end)
+      return -1;
+    resp->head.flags |= httpd_content_length;
+    return 0;
+  }
   // TODO check header? Multiline header?
-  minute_httpd_print (http_response_header_names[header], 0, resp);
-  minute_httpd_output (": ", 2, 0, resp);
+  minute_httpd_output (prefix->text, prefix->length, 0, resp);
   minute_httpd_print (value, 0, resp);
   minute_httpd_output (NL, 2, 0, resp);
   return 0;
 }
 
+static int
+minute_httpd_raw    (const char                *headers,
+                     unsigned                   length,
+                     minute_httpd_head         *head)
+{
+  httpd_response *resp = downcast(httpd_response, head, head);
+  minute_httpd_output (headers, length, 0, resp);
+  return 0;
+}
+
+static int
+minute_httpd_encode (enum http_content_coding  coding,
+                     int                       level,
+                     unsigned                  min_size,
+                     minute_httpd_head        *head)
+{
+#ifdef MINUTE_HTTPD_ZLIB
+  httpd_response *resp = downcast(httpd_response, head, head);
+  if ((coding != http_coding_gzip && coding != http_coding_deflate)
+      || !resp->state->pool)
+    return -1;
+  resp->head.flags |= httpd_encode;
+  resp->head.coding = coding;
+  resp->head.level = level;
+  resp->head.min_size = min_size;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* Render the status line of a response into buf, returning its length. */
+static unsigned
+minute_httpd_status_line (unsigned           status,
+                          enum http_version  version,
+                          char              *buf,
+                          unsigned           size)
+{
+  unsigned length;
+  const char *line = minute_http_status_line (version, status, &length);
+  if (line && length < size) {
+    memcpy (buf, line, length);
+    return length;
+  }
+  length = snprintf (buf, size, "%s %d %s" NL,
+                     minute_http_version_text(version),
+                     status, minute_http_response_text(status));
+  return length < size ? length : size-1;
+}
+
 int
 minute_httpd_start (httpd_response  *resp)
 {
@@ -440,12 +1354,128 @@ minute_httpd_header_timestamp  (enum http_response_header type,
   return minute_httpd_header(type, minute_rfc_date (epochtime, &rfc), head);
 }
 
+/* Write the Server and Date headers, set on every response. The Date line
+   is rendered at most once a second, and shared by all connections of the
+   process. */
+static void
+minute_httpd_common_headers (httpd_response *resp)
+{
+  // TODO parameterize the Server: header.
+  static const char server[] = "Server: " SERVER_NAME "/" SERVER_VERSION NL;
+  static struct {
+    time_t    when;
+    unsigned  length;
+    char      line[48];
+  } date;
+  time_t now = time(0);
+
+  if (now != date.when) {
+    struct minute_rfc_datetime rfc;
+    date.length = snprintf (date.line, sizeof(date.line), "%s%s" NL,
+                            http_response_header_prefixes[http_rsp_date].text,
+                            minute_rfc_date (now, &rfc));
+    date.when = now;
+  }
+  minute_httpd_output (server, sizeof(server)-1, 0, resp);
+  minute_httpd_output (date.line, date.length, 0, resp);
+}
+
+static int
+minute_httpd_validators (const char         *etag,
+                         unsigned            last_modified,
+                         minute_httpd_head  *head)
+{
+  httpd_head *h = downcast(httpd_head, base, head);
+  unsigned length = etag ? strlen (etag) : 0;
+  h->flags |= httpd_validators;
+  h->last_modified = last_modified;
+  h->etag_length = 0;
+  if (length && length <= MINUTE_HTTPD_MAX_ETAG) {
+    memcpy (h->etag, etag, length);
+    h->etag_length = length;
+  }
+  if (length)
+    minute_httpd_header (http_rsp_etag, etag, head);
+  if (last_modified)
+    minute_httpd_header_timestamp (http_rsp_last_modified, last_modified,
+                                   head);
+  return 0;
+}
+
+/* Match the entity tag of the response against a list of tags in a request
+   header; -1 if the header is absent or can't be used. */
+static int
+minute_httpd_match (enum http_request_header  header,
+                    int                       weak,
+                    httpd_response           *resp)
+{
+  minute_http_etag tags[MAX_ETAGS];
+  unsigned length;
+  int n;
+  const char *value = minute_http_header (header, &length, &resp->rq,
+                                          &resp->state->text);
+  if (!value || 0 > (n = minute_http_etags (value, length, tags, MAX_ETAGS)))
+    return -1;
+  return minute_http_etags_match (tags, n, resp->head.etag,
+                                  resp->head.etag_length, weak);
+}
+
+/* Compare the last modification time of the response to a date in a request
+   header; -1 if the header is absent or can't be used, otherwise non-zero if
+   the response has been modified since. */
+static int
+minute_httpd_modified (enum http_request_header  header,
+                       httpd_response           *resp)
+{
+  unsigned length, date;
+  const char *value = minute_http_header (header, &length, &resp->rq,
+                                          &resp->state->text);
+  if (!resp->head.last_modified || !value
+      || minute_http_date (value, length, &date))
+    return -1;
+  return resp->head.last_modified > date;
+}
+
+/* Evaluate the preconditions of the request (RFC 7232 section 6) against the
+   validators declared by the application. */
+static unsigned
+minute_httpd_conditional (unsigned        status,
+                          httpd_response *resp)
+{
+  int r, safe = resp->rq.request_method == http_get
+             || resp->rq.request_method == http_head;
+  if (!(resp->head.flags & httpd_validators) || status < 200 || status > 299)
+    return status;
+
+  if (0 > (r = minute_httpd_match (http_rq_if_match, 0, resp))) {
+    if (minute_httpd_modified (http_rq_if_unmodified_since, resp) == 1)
+      return http_precondition_failed;
+  } else if (!r) {
+    return http_precondition_failed;
+  }
+
+  if (0 > (r = minute_httpd_match (http_rq_if_none_match, 1, resp))) {
+    if (safe && minute_httpd_modified (http_rq_if_modified_since, resp) == 0)
+      return http_not_modified;
+  } else if (r) {
+    return safe ? http_not_modified : http_precondition_failed;
+  }
+  return status;
+}
+
 void
 minute_httpd_standard_body (unsigned        status,
                             httpd_response *resp)
 {
   const char *msg = minute_http_response_text(status);
   minute_httpd_state *state = resp->state;
+  // the body replaces the application's, so the length it declared doesn't
+  // apply; if that's already been sent, there's no telling where this ends.
+  if (!(resp->head.flags & httpd_head_open)
+      && resp->head.flags & httpd_content_length)
+    resp->head.flags &= ~httpd_connection_keep;
+  resp->head.flags &= ~httpd_content_length;
+  resp->head.length = 0;
   minute_iobuf_printf (&state->out,
     "<html><head>"
       "<title>%d %s</title>"
@@ -464,6 +1494,7 @@ minute_httpd_init    (int       readfd,
                       textint   text,
                       minute_httpd_state *state)
 {
+  int one = 1;
   memset (state, 0, sizeof(*state));
 
   state->in = in;
@@ -472,169 +1503,368 @@ minute_httpd_init    (int       readfd,
 
   state->infd = readfd;
   state->outfd = writefd;
+  state->transport = &minute_httpd_fd_transport;
+  state->pipe[0] = state->pipe[1] = -1;
+  // responses are written whole, there's nothing to gain from delaying them.
+  state->tcp = !setsockopt (writefd, IPPROTO_TCP, TCP_NODELAY, &one,
+                            sizeof(one));
+
+  state->in_fixed = in.data;
+  state->in_fixed_size = in.mask+1;
+  state->text_fixed = text.data;
+  state->text_fixed_size = text.size;
+  state->text.grow = minute_httpd_grow_text;
 }
 
-int
-minute_httpd_handle  (minute_httpd_app *app,
-                      minute_httpd_state *state,
-                      void *user)
+void
+minute_httpd_set_pool (minute_httpd_pool  *pool,
+                       minute_httpd_state *state)
+{
+  state->pool = pool;
+}
+
+void
+minute_httpd_set_transport (minute_httpd_transport *transport,
+                            minute_httpd_state     *state)
+{
+  state->transport = transport;
+}
+
+void
+minute_httpd_release (minute_httpd_state *state)
+{
+  if (state->pipe[0] >= 0) {
+    close (state->pipe[0]);
+    close (state->pipe[1]);
+    state->pipe[0] = state->pipe[1] = -1;
+  }
+  if (!state->pool)
+    return;
+  while (state->backlog)
+    minute_httpd_backlog_pop (state);
+  if (state->text.data != state->text_fixed) {
+    state->pool->put (state->text.data, state->text.size, state->pool);
+    state->text = minute_textint_init (state->text_fixed_size,
+                                       state->text_fixed);
+    state->text.grow = minute_httpd_grow_text;
+  }
+  if (state->in.data != state->in_fixed) {
+    state->pool->put (state->in.data, state->in.mask+1, state->pool);
+    state->in = minute_iobuf_init (state->in_fixed_size, state->in_fixed);
+  }
+}
+
+/* Start serving the request parsed into rq, answering the parse failure of
+   status if there is one, in which case the response is left to be
+   flushed, or otherwise returning what the header function made of it. */
+static unsigned
+minute_httpd_begin (minute_httpd_app   *app,
+                    minute_httpd_state *state,
+                    minute_http_rq     *rq,
+                    int                 status,
+                    void               *user)
 {
   // requests may be pipelined, do not reset the iobuffer each iteration.
-  httpd_response  resp = {
-    state,
+  static const httpd_response init = {
+    NULL, /* state */
     {}, /* rq */
     { /* httpd_head */
       { /* minute_http_head */
         minute_httpd_header,
-        minute_httpd_header_timestamp
+        minute_httpd_header_timestamp,
+        minute_httpd_validators,
+        minute_httpd_raw,
+        minute_httpd_encode
       },
-      0 /* flags */
+      0, /* flags */
+      0, /* length */
+      http_coding_identity, 0, 0, /* encoding */
+      0, 0, {} /* validators */
     },
     { /* httpd_in */
       {
-        minute_httpd_in_read
+        minute_httpd_in_read,
+        minute_httpd_in_view,
+        minute_httpd_in_splice
       },
-      0
+      0, 0, 0, 0
     },
     { /* httpd_out */
       {
         minute_httpd_write,
-        minute_httpd_flush
+        minute_httpd_flush,
+        minute_httpd_sendfile
       }
     }
   };
+  httpd_response *resp = &state->response;
 
-  char head[64];
-  int nhead;
-  int status = 0;
-  memset (&resp.rq, 0, sizeof(resp.rq));
+  *resp = init;
+  resp->state = state;
+  resp->rq = *rq;
+  state->body_mark = state->out.write;
+  if (status) {
+    state->prefix_length = minute_httpd_status_line (status,
+                             resp->rq.server_protocol, state->prefix,
+                             sizeof(state->prefix));
 
-  minute_iobuf_clear(&state->out);
-  minute_textint_clear(&state->text);
+    resp->head.flags = 0;
 
-  //TODO parameterized header mask, remember to use for trailers too.
-  minute_http_rqs rqs = {};
-  minute_http_init(MINUTE_ALL_HEADERS, &state->in, &state->text, &rqs);
+    minute_httpd_common_headers (resp);
 
-  status = minute_httpd_read_request(&resp, &rqs);
+    resp->head.flags |= httpd_head_open;
+    state->body_mark = state->out.write;
+    minute_httpd_standard_body(status, resp);
+    app->error (&resp->rq, status, user);
+    minute_httpd_finish (-status, resp);
+    return status;
+  }
 
-  if (status < 0) {
-    // client closed connection.
-    return httpd_client_no_request;
-  } else if (status) {
-    nhead = snprintf (head, sizeof(head), "%s %d %s" NL,
-                      minute_http_version_text(resp.rq.server_protocol),
-                      status, minute_http_response_text(status));
+  minute_httpd_start (resp);
 
-    // TODO don't write() directly
-    if(0 >= write (state->outfd, head, nhead)) {
-      close(state->outfd);
-      state->outfd = -1;
-    }
+  minute_httpd_common_headers (resp);
 
-    resp.head.flags = 0;
+  status = app->header (&resp->rq, &resp->head.base, &state->text, user);
+  if (100 == status && resp->rq.flags & http_expect_continue) {
+    // the status line goes in the prefix as for the final response, the
+    // client is waiting for it before sending the payload though, so it
+    // can't wait for the rest of the head.
+    state->prefix_length = minute_httpd_status_line (status,
+                             resp->rq.server_protocol, state->prefix,
+                             sizeof(state->prefix) - 2);
+    memcpy (state->prefix + state->prefix_length, NL, 2);
+    state->prefix_length += 2;
+    resp->in.continued = 1;
+  }
+  return status;
+}
 
-    // TODO parameterize the Server: header.
-    minute_httpd_header (http_rsp_server, SERVER_NAME "/" SERVER_VERSION,
-                        &resp.head.base);
-    minute_httpd_header_timestamp (http_rsp_date, time(0), &resp.head.base);
+/* Answer the request with status, once the payload function, if any, is
+   done with the payload. */
+static void
+minute_httpd_respond (minute_httpd_app   *app,
+                      minute_httpd_state *state,
+                      unsigned            status,
+                      void               *user)
+{
+  httpd_response *resp = &state->response;
+  unsigned headermark;
 
-    if (resp.rq.server_protocol == http_1_1)
-      minute_httpd_header (http_rsp_connection, "close", &resp.head.base);
+  unsigned conditional = minute_httpd_conditional (status, resp);
+  if (conditional != status) {
+    resp->head.flags |= httpd_conditional;
+    status = conditional;
+  }
 
-    minute_httpd_chunk (NL, 2, 0, &resp);
-    minute_httpd_standard_body(status, &resp);
-    minute_httpd_flush (&resp.out.base);
-    minute_httpd_chunk_end (&resp);
-    app->error (&resp.rq, status, user);
-    return -status;
-  } else {
-    unsigned headermark, nproto;
-    minute_httpd_start (&resp);
-
-    minute_httpd_header (http_rsp_server, SERVER_NAME "/" SERVER_VERSION,
-                        &resp.head.base);
-    minute_httpd_header_timestamp (http_rsp_date, time(0), &resp.head.base);
-
-    nproto = snprintf (head, sizeof(head), "%s ",
-                       minute_http_version_text (resp.rq.server_protocol));
-
-    status=app->header (&resp.rq, &resp.head.base, &state->text, user);
-    if (100 == status) {
-      if (resp.rq.flags & http_expect_continue) {
-        nhead = snprintf (head+nproto, sizeof(head)-nproto, "%d %s" NL,
-                          status, minute_http_response_text(status))+nproto;
-        // TODO don't write() ...
-        if(0 >= write (state->outfd, head, nhead)) {
-          close(state->outfd);
-          state->outfd = -1;
-        }
-      }
+  // a declared length is that of the entity, not of whatever body goes
+  // with an error or a redirection.
+  if (status < 200 || status > 299) {
+    resp->head.flags &= ~httpd_content_length;
+    resp->head.length = 0;
+  }
 
-      status = app->payload (&resp.rq, &resp.head.base, &resp.in.base,
-                             &state->text, user);
-    }
+  // ranges are of the body as is.
+  if (status == http_partial_content)
+    resp->head.flags &= ~httpd_encode;
 
-    nhead = snprintf (head+nproto, sizeof(head)-nproto, "%d %s" NL,
-                      status, minute_http_response_text(status))+nproto;
+  // the rest of a payload refused as too large isn't read only to be thrown
+  // away; the connection is closed instead, see minute_httpd_discard.
+  if (status == http_request_entity_too_large && minute_httpd_unread (resp))
+    resp->in.pending = PENDING_ERROR;
 
-    // TODO don't write() directly, use some chunk/iobuf function instead to
-    // prepend the status. That way we have a single point of contact to
-    // the file descriptors.
-    if(0 >= write (state->outfd, head, nhead)) {
-      close(state->outfd);
-      state->outfd = -1;
-    }
+  // the headers set so far are buffered, the status line goes before
+  // them when the response is written.
+  state->prefix_length = minute_httpd_status_line (status,
+                           resp->rq.server_protocol, state->prefix,
+                           sizeof(state->prefix));
 
-    if ((resp.head.flags&httpd_connection_keep) == httpd_connection_keep)
-    {
-      if (resp.rq.server_protocol < http_1_1)
-        minute_httpd_header (http_rsp_connection, "keep-alive",
-          &resp.head.base);
-    }
-    else
-    {
-      if (resp.rq.server_protocol == http_1_1)
-        minute_httpd_header (http_rsp_connection, "close", &resp.head.base);
-    }
+  // these never have a body, so there's nothing to frame; a terminating
+  // chunk would be taken for the start of the next response.
+  if (resp->rq.request_method == http_head
+      || status == http_no_content || status == http_not_modified)
+    resp->head.flags |= httpd_no_body;
 
-    // Chunked is always accepted in 1.1
-    // TODO check TE if accepted when using 1.0; if not return error?
-    if (resp.head.flags & httpd_te_chunked)
-      minute_httpd_header (http_rsp_transfer_encoding, "chunked",
-        &resp.head.base);
-
-    minute_httpd_chunk (NL, 2, 0, &resp);
-    // do not call response on HEAD request, or if we return a code implying
-    // that there is nothing to be sent (e.g. no content or not modified)
-    if (resp.rq.request_method != http_head) switch(status) {
-      case http_no_content:
-      case http_reset_content:
-      case http_not_modified:
+  // the Connection header and the framing of the body end the head once
+  // the body is complete or has to be written, whichever comes first.
+  resp->head.flags |= httpd_head_open;
+  state->body_mark = state->out.write;
+  // do not call response on HEAD request, or if we return a code implying
+  // that there is nothing to be sent (e.g. no content or not modified)
+  if (resp->rq.request_method != http_head) switch(status) {
+    case http_no_content:
+    case http_reset_content:
+    case http_not_modified:
+      break;
+    case http_precondition_failed:
+      if (resp->head.flags & httpd_conditional) {
+        minute_httpd_standard_body(status, resp);
         break;
-      default: {
-        unsigned response =
-          app->response(&resp.rq,
-                        &resp.out.base,
-                        &resp.in.base,
-                        &state->text,
-                        status,
-                        user);
-        headermark = state->out.write; // end of the headers.
-        if (response && state->out.write == headermark)
-        {
-          // only send if the app payload returned non-zero, and it hasn't
-          // written anything beyond the headers.
-          minute_httpd_standard_body(status, &resp);
-        }
+      }
+      // fall through
+    default: {
+      unsigned response =
+        app->response(&resp->rq,
+                      &resp->out.base,
+                      &resp->in.base,
+                      &state->text,
+                      status,
+                      user);
+      headermark = state->out.write; // end of the headers.
+      if (response && state->out.write == headermark)
+      {
+        // only send if the app payload returned non-zero, and it hasn't
+        // written anything beyond the headers.
+        minute_httpd_standard_body(status, resp);
       }
     }
   }
+}
 
-  minute_httpd_flush (&resp.out.base);
-  minute_httpd_chunk_end (&resp);
-  minute_httpd_in_discard (&resp);
-  if ((resp.head.flags & httpd_connection_keep) == httpd_connection_keep)
-    return httpd_client_ok_open;
-  return httpd_client_ok_close;
+/* Read past what the application left of the payload, before the response
+   is finished; non-zero if the descriptor would block. */
+static int
+minute_httpd_discard (httpd_response *resp)
+{
+  // a client expecting 100 Continue that wasn't sent may never send the
+  // payload, close the connection rather than waiting for it.
+  if (minute_httpd_unread (resp)
+      && resp->rq.flags & http_expect_continue && !resp->in.continued)
+    resp->head.flags &= ~httpd_connection_keep;
+  else if (minute_httpd_in_discard (resp))
+    return 1;
+  // nor is there telling where the next request starts after a payload that
+  // couldn't be read.
+  if (resp->in.pending == PENDING_ERROR)
+    resp->head.flags &= ~httpd_connection_keep;
+  return 0;
+}
+
+/* Read ahead the payload of the request about to be handled, if it has a
+   Content-Length, into what room is left in the input buffer; non-zero if
+   the descriptor would block. The buffer isn't grown for it, the header
+   function has yet to accept the payload, which the rest is read along
+   with. */
+static int
+minute_httpd_read_body (minute_httpd_state *state, minute_http_rq *rq)
+{
+  iobuf *in = &state->in;
+  if (!(rq->flags & http_content_length) || rq->flags & (http_transfer_chunked
+      | http_expect_continue))
+    return 0;
+  // make room for the payload, the values may reference the input buffer.
+  if (minute_iobuf_used(*in) < rq->content_length
+      && minute_iobuf_free(*in) && minute_http_detach (rq, &state->text))
+    return 0;
+  while (minute_iobuf_used(*in) < rq->content_length
+         && minute_iobuf_free(*in)) {
+    int r = minute_httpd_readfd(state);
+    if (r < 0 && errno == EAGAIN)
+      return 1;
+    if (r == 0 || (r < 0 && errno != EINTR))
+      break; // let the application see the error, or end of file.
+  }
+  return 0;
+}
+
+int
+minute_httpd_step    (minute_httpd_app *app,
+                      minute_httpd_state *state,
+                      void *user)
+{
+  httpd_response *resp = &state->response;
+  int status = 0;
+  switch (state->phase) {
+    case httpd_phase_idle:
+      minute_iobuf_clear(&state->out);
+      if (state->next < state->batched)
+        goto body;
+      // all requests parsed so far have been handled, read some more.
+      state->next = state->batched = 0;
+      minute_textint_clear(&state->text);
+      minute_httpd_shrink(state);
+      memset (&state->batch[0], 0, sizeof(state->batch[0]));
+
+      //TODO parameterized header mask, remember to use for trailers too.
+      memset (&state->rqs, 0, sizeof(state->rqs));
+      minute_http_init_zerocopy(MINUTE_ALL_HEADERS, &state->in, &state->text,
+                                &state->rqs);
+      // fall through
+    case httpd_phase_head:
+      status = minute_httpd_read_request(state, &state->rqs);
+      if (status == EAGAIN) {
+        state->phase = httpd_phase_head;
+        return httpd_client_want_read;
+      }
+      state->phase = httpd_phase_idle;
+      if (status < 0) {
+        // client closed connection.
+        return httpd_client_no_request;
+      } else if (status) {
+        minute_httpd_begin (app, state, &state->batch[0], status, user);
+        goto flush;
+      }
+      // fall through
+    case httpd_phase_body:
+    body:
+      if (minute_httpd_read_body (state, &state->batch[state->next])) {
+        state->phase = httpd_phase_body;
+        return httpd_client_want_read;
+      }
+      status = minute_httpd_begin (app, state, &state->batch[state->next++],
+                                   0, user);
+      if (status != 100)
+        goto respond;
+      // fall through
+    case httpd_phase_continue:
+      if (minute_httpd_interim (state)) {
+        state->phase = httpd_phase_continue;
+        return httpd_client_want_write;
+      }
+      // fall through
+    case httpd_phase_payload:
+      resp->in.blocked = 0;
+      status = app->payload (&resp->rq, &resp->head.base, &resp->in.base,
+                             &state->text, user);
+      // the payload function wants to read more once it's arrived.
+      if (status == 100 && resp->in.blocked) {
+        state->phase = httpd_phase_payload;
+        return httpd_client_want_read;
+      }
+    respond:
+      minute_httpd_respond (app, state, status, user);
+      // fall through
+    case httpd_phase_discard:
+      if (minute_httpd_discard (resp)) {
+        state->phase = httpd_phase_discard;
+        return httpd_client_want_read;
+      }
+      minute_httpd_finish (0, resp);
+      // fall through
+    case httpd_phase_flush:
+    flush:
+      if (minute_httpd_flush_step (state)) {
+        state->phase = httpd_phase_flush;
+        return httpd_client_want_write;
+      }
+  }
+  state->phase = httpd_phase_idle;
+  return state->result;
+}
+
+int
+minute_httpd_handle  (minute_httpd_app *app,
+                      minute_httpd_state *state,
+                      void *user)
+{
+  while (1) {
+    int r = minute_httpd_step (app, state, user);
+    if (r == httpd_client_want_read)
+      r = minute_httpd_wait (state, state->infd, POLLIN);
+    else if (r == httpd_client_want_write)
+      r = minute_httpd_wait (state, state->outfd, POLLOUT);
+    else
+      return r;
+    if (r)
+      return httpd_client_no_request;
+  }
 }
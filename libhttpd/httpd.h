@@ -6,27 +6,175 @@
 #include "libhttp/textint.h"
 
 enum http_response_header;
+struct iovec;
 
-/** \brief HTTPd connection state, keeps track of everything needed for serving
-           all requests (including pipelined ones) on a single connection.
+/** \brief Number of pipelined requests parsed in one go. */
+#define MINUTE_HTTPD_BATCH 8
 
-    Although the input buffer is only used while parsing the request, we cant
-    reuse it for output buffering during processing as requests may be
-    pipelined in which case there'd still be data to be read in the buffer for
-    the next request. The text buffer is filled on parsing and read while
-    processing, and will be cleared between requests.
- */
+/** \brief Pool of memory blocks lent to connections.
+
+    The buffers given to minute_httpd_init are sized for the common case.
+    Should a request head not fit, the input and text buffers are moved to
+    larger blocks gotten from the pool, doubling in size as needed, and the
+    blocks are put back once the requests have been handled. The pool decides
+    how large a request head it's willing to accept, by refusing to hand out
+    larger blocks. Output that would block is queued in blocks from the pool
+    too, rather than waited for, until the descriptor is ready.
+*/
 typedef struct
-minute_httpd_state
+minute_httpd_pool
 {
-  iobuf           in;
-  iobuf           out;
-  textint         text;
+  /** \brief Get a block of memory.
 
-  int             infd;
-  int             outfd;
+      \param size the size wanted, a power of two.
+      \param ref  this structure instance.
+      \return The block, suitably aligned, or NULL if none is available.
+  */
+  void* (*get) (unsigned                  size,
+                struct minute_httpd_pool *ref);
+
+  /** \brief Put back a block gotten from get.
+
+      \param block the block.
+      \param size  the size of the block.
+      \param ref   this structure instance.
+  */
+  void  (*put) (void                     *block,
+                unsigned                  size,
+                struct minute_httpd_pool *ref);
 }
-minute_httpd_state;
+minute_httpd_pool;
+
+/** \brief The I/O underlying a connection.
+
+    The connection reads and writes using these rather than system calls on
+    the descriptors given to minute_httpd_init, which are passed on as is.
+    Each function behaves like the system call of the same name, returning
+    -1 with errno set on failure, EAGAIN if it would block. The default,
+    minute_httpd_fd_transport, makes the system calls; other transports may
+    ignore the descriptors, which still need to be non-negative, as the
+    write descriptor is set to -1 once the connection is closed.
+*/
+typedef struct
+minute_httpd_transport
+{
+  /** \brief Read into count buffers, like readv. */
+  int (*readv)    (int                            fd,
+                   const struct iovec            *iov,
+                   int                            count,
+                   struct minute_httpd_transport *ref);
+
+  /** \brief Write count buffers, like writev. */
+  int (*writev)   (int                            fd,
+                   const struct iovec            *iov,
+                   int                            count,
+                   struct minute_httpd_transport *ref);
+
+  /** \brief Write count bytes of the file from offset, like sendfile,
+             advancing offset by the number of bytes written.
+
+      May be NULL, or fail with EINVAL, to have the file read and written
+      instead. */
+  int (*sendfile) (int                            fd,
+                   int                            file,
+                   unsigned long long            *offset,
+                   unsigned                       count,
+                   struct minute_httpd_transport *ref);
+
+  /** \brief Move up to count bytes read from fd to the descriptor to,
+             without copying them through user space, like splice.
+
+      The pipe, which splice needs between the two, is the connection's;
+      both ends are -1 until the transport makes one, and it's kept empty
+      between calls, or closed and set back to -1. Returns the number of
+      bytes moved, zero at the end of the file. May be NULL, or fail with
+      EINVAL, to have the data read and written instead.
+  */
+  int (*splice)   (int                            fd,
+                   int                            to,
+                   unsigned                       count,
+                   int                            pipe[2],
+                   struct minute_httpd_transport *ref);
+
+  /** \brief Hold back partial writes while on is set, or send what's been
+             held back once it's cleared. May be NULL. */
+  void (*cork)    (int                            fd,
+                   int                            on,
+                   struct minute_httpd_transport *ref);
+
+  /** \brief Wait for the descriptor to become ready for events, POLLIN or
+             POLLOUT, like poll; non-zero on failure. */
+  int (*wait)     (int                            fd,
+                   short                          events,
+                   struct minute_httpd_transport *ref);
+
+  /** \brief Close the connection, on failure to write to it. */
+  int (*close)    (int                            fd,
+                   struct minute_httpd_transport *ref);
+}
+minute_httpd_transport;
+
+/** \brief The transport making system calls on the descriptors. */
+extern minute_httpd_transport minute_httpd_fd_transport;
+
+/** \brief The most milliseconds minute_httpd_fd_transport waits for a
+           descriptor, failing with ETIMEDOUT once it's up; a minute by
+           default, negative to wait indefinitely. */
+extern int minute_httpd_fd_timeout;
+
+/** \brief A transport reading and writing memory rather than descriptors.
+
+    Reads are served from the input until it runs out, which reads as the
+    end of the file. Writes are appended to the output; they fail with
+    ENOSPC once it's full, or if the output is NULL they're only counted.
+    Set up using minute_httpd_memory_transport_init, then set trickle to
+    have the data go through as it would on a slow connection.
+*/
+typedef struct
+minute_httpd_memory_transport
+{
+  minute_httpd_transport  base;
+  const char             *in;
+  unsigned                in_length;
+  char                   *out;
+  unsigned                out_size;
+  /** The number of bytes written. */
+  unsigned long long      out_length;
+  /** If non-zero, the most bytes a read or write moves, every other one
+      failing with EAGAIN instead. */
+  unsigned                trickle;
+  unsigned                calls;
+}
+minute_httpd_memory_transport;
+
+void  minute_httpd_memory_transport_init (
+        const char                    *in,
+        unsigned                       in_length,
+        char                          *out,
+        unsigned                       out_size,
+        minute_httpd_memory_transport *transport);
+
+/** \brief A transport counting the calls made to another, and the bytes
+           passed. Set up using minute_httpd_instrumented_transport_init.
+*/
+typedef struct
+minute_httpd_instrumented_transport
+{
+  minute_httpd_transport  base;
+  minute_httpd_transport *next;
+  unsigned long long      reads;
+  unsigned long long      read_bytes;
+  unsigned long long      writes;
+  unsigned long long      written_bytes;
+  unsigned long long      sendfiles;
+  unsigned long long      splices;
+  unsigned long long      waits;
+}
+minute_httpd_instrumented_transport;
+
+void  minute_httpd_instrumented_transport_init (
+        minute_httpd_transport              *next,
+        minute_httpd_instrumented_transport *transport);
 
 /** \brief Structure passed to the head processing of the application and
            allows setting headers in the response.
@@ -55,6 +203,59 @@ minute_httpd_head
   int (*timestamp) (enum http_response_header header,
                     unsigned                  epochtime,
                     struct minute_httpd_head *ref);
+
+  /** \brief Declare the validators of the selected representation.
+
+      Sets the ETag and Last-Modified headers, and has the server evaluate
+      the If-Match, If-Unmodified-Since, If-None-Match and If-Modified-Since
+      request headers against them once the status is known. A 2xx status
+      is then replaced by 304 Not Modified or 412 Precondition Failed if the
+      conditions say so, in which case the response function is not called.
+
+      \param etag           the entity tag, quotes included and optionally
+                            prefixed by W/, or NULL if there is none.
+      \param last_modified  the modification time, or zero if unknown.
+      \param ref            this structure instance.
+  */
+  int (*validators)(const char               *etag,
+                    unsigned                  last_modified,
+                    struct minute_httpd_head *ref);
+
+  /** \brief Add headers serialized in advance.
+
+      For headers that are the same on every response, rendered once as
+      "Name: value\r\n" lines rather than set one at a time.
+
+      \param headers  the header lines, each ending in CR LF.
+      \param length   the length of the header lines.
+      \param ref      this structure instance.
+  */
+  int (*raw)       (const char               *headers,
+                    unsigned                  length,
+                    struct minute_httpd_head *ref);
+
+  /** \brief Compress the body of the response.
+
+      The body is compressed as it's written, and sent with the matching
+      Content-Encoding, unless it turns out shorter than min_size or the
+      response has no body, a declared length or partial content. Choosing
+      a coding acceptable to the client, and setting Vary, is up to the
+      application.
+
+      Only gzip and deflate are supported, and only when built with ZLIB=1;
+      the memory zlib needs comes from the pool set with
+      minute_httpd_set_pool.
+
+      \param coding    the content coding.
+      \param level     the zlib compression level, 1 to 9.
+      \param min_size  the smallest body worth compressing.
+      \param ref       this structure instance.
+      \returns         zero, or -1 if the body can't be compressed.
+  */
+  int (*encode)    (enum http_content_coding  coding,
+                    int                       level,
+                    unsigned                  min_size,
+                    struct minute_httpd_head *ref);
 }
 minute_httpd_head;
 
@@ -64,10 +265,39 @@ typedef struct
 minute_httpd_in
 {
   /** \brief Read data from the input buffer
-    * \return Number of bytes read, 0 on end of input or negative on error. */
+
+      Once what's buffered has been read, reads at least the size of the
+      input buffer go straight into buf. None of the functions reading the
+      payload wait for it; if none has arrived, they fail with EAGAIN.
+
+      \return Number of bytes read, 0 on end of input or negative on error.
+  */
   int (*read) (char *buf,
                unsigned count,
                struct minute_httpd_in*);
+  /** \brief Read data in place, without copying it out of the input buffer.
+
+      Points data at the next part of the payload, as much of it as is
+      buffered and contiguous, with any chunk framing already stripped. The
+      data stays valid until the payload is read again.
+
+      \return Number of bytes read, 0 on end of input or negative on error.
+  */
+  int (*view) (const char **data,
+               struct minute_httpd_in*);
+  /** \brief Write data to a file descriptor, such as a file being uploaded.
+
+      Writes out what's buffered first, then has the rest moved straight
+      from the connection, through the transport's splice, where possible.
+
+      \param fd     the descriptor to write to.
+      \param count  the most bytes to write.
+      \return Number of bytes written, 0 on end of input or negative on error,
+              the payload then being left unread.
+  */
+  int (*splice) (int fd,
+                 unsigned count,
+                 struct minute_httpd_in*);
 }
 minute_httpd_in;
 
@@ -83,9 +313,145 @@ minute_httpd_out
                 struct minute_httpd_out*);
   /** \brief Force flushing of the output buffer. */
   int (*flush) (struct minute_httpd_out*);
+  /** \brief Send part of a file.
+
+      Flushes the output buffer, and has the kernel copy the file data
+      straight to the output descriptor, framed as a chunk of its own if the
+      response is chunked. What would block is sent once the descriptor is
+      ready, the file has to stay open until minute_httpd_step has returned
+      the outcome of the request.
+
+      \param fd     the file descriptor to read from.
+      \param offset the offset of the data within the file.
+      \param length the number of bytes to send.
+      \return Zero on success, non-zero otherwise, in which case the
+              connection is closed as the response can't be completed.
+  */
+  int (*sendfile) (int                      fd,
+                   unsigned long long       offset,
+                   unsigned long long       length,
+                   struct minute_httpd_out *out);
 }
 minute_httpd_out;
 
+/** \brief Longest entity tag compared evaluating conditional requests,
+           longer ones are sent as is. */
+#define MINUTE_HTTPD_MAX_ETAG 128
+
+/** \brief The response being served on a connection.
+
+    Kept in the connection state, as serving a request may take several
+    calls to minute_httpd_step. The members are private to the server.
+*/
+typedef struct
+minute_httpd_response
+{
+  struct minute_httpd_state  *state;
+  minute_http_rq              rq;
+  struct minute_httpd_response_head
+  {
+    minute_httpd_head         base;
+    unsigned                  flags;
+    unsigned long long        length;
+    enum http_content_coding  coding;
+    int                       level;
+    unsigned                  min_size;
+    unsigned                  last_modified;
+    unsigned                  etag_length;
+    char                      etag[MINUTE_HTTPD_MAX_ETAG];
+  }                           head;
+  struct minute_httpd_response_in
+  {
+    minute_httpd_in           base;
+    int                       pending;
+    int                       detached;
+    /** Set once reading the payload would block. */
+    int                       blocked;
+    /** Whether 100 Continue has been sent. */
+    int                       continued;
+  }                           in;
+  struct minute_httpd_response_out
+  {
+    minute_httpd_out          base;
+  }                           out;
+}
+minute_httpd_response;
+
+/** \brief HTTPd connection state, keeps track of everything needed for serving
+           all requests (including pipelined ones) on a single connection.
+
+    Although the input buffer is only used while parsing the request, we cant
+    reuse it for output buffering during processing as requests may be
+    pipelined in which case there'd still be data to be read in the buffer for
+    the next request. Pipelined requests already in the input buffer are
+    parsed together, and then handled one at a time. The text buffer is
+    filled on parsing and read while processing, and will be cleared once
+    all requests parsed together have been handled.
+ */
+typedef struct
+minute_httpd_state
+{
+  iobuf           in;
+  iobuf           out;
+  textint         text;
+
+  int             infd;
+  int             outfd;
+  /** The I/O on the descriptors, minute_httpd_fd_transport unless set
+      using minute_httpd_set_transport. */
+  minute_httpd_transport *transport;
+  /** The pipe lent to the transport's splice, closed on release. */
+  int             pipe[2];
+
+  /** Requests parsed, but not yet handled. */
+  minute_http_rq  batch[MINUTE_HTTPD_BATCH];
+  unsigned        batched;
+  unsigned        next;
+
+  /** Where minute_httpd_step resumes, and the parser state if it's in the
+      middle of reading request heads, or the trailers of a payload. */
+  unsigned        phase;
+  minute_http_rqs rqs;
+  /** The request being served. */
+  minute_httpd_response response;
+
+  /** Raw output to go before the output buffer; the status line, or the
+      end of a chunk sent from a file. */
+  char            prefix[64];
+  unsigned        prefix_length;
+  /** Where the body starts in the output buffer; the head before it is
+      never framed as a chunk. */
+  unsigned        body_mark;
+  /** Whether the output is a TCP socket, which may be corked. */
+  int             tcp;
+  /** The compressor of the response body, gotten from the pool while the
+      body is being compressed. */
+  void           *encoder;
+
+  /** Output left to be flushed; the headers framing the body and the end
+      of the head, and the size of the chunk following it in the output
+      buffer, then the end of the chunk and the transfer. */
+  char            flush_head[96];
+  unsigned        flush_head_length;
+  const char     *flush_tail;
+  unsigned        flush_tail_length;
+  /** The outcome of the request being flushed. */
+  int             result;
+  /** Output that would have blocked, queued in blocks from the pool ahead
+      of the rest until the descriptor is ready. */
+  struct minute_httpd_backlog *backlog;
+  struct minute_httpd_backlog *backlog_last;
+
+  /** Pool for growing the input and text buffers, may be NULL. */
+  minute_httpd_pool  *pool;
+  /** The buffers given to minute_httpd_init, returned to when done. */
+  char           *in_fixed;
+  unsigned        in_fixed_size;
+  void           *text_fixed;
+  unsigned        text_fixed_size;
+}
+minute_httpd_state;
+
 /** \brief The callback structure provided by the application.
 
     The structure represents the application to be called by the HTTP server.
@@ -104,7 +470,9 @@ minute_httpd_app
        *  \param request  The incoming request.
        *  \param head     API functions for writing header fields.
        *  \param text     The text buffer used to store request header values,
-       *                  if requested.
+       *                  if requested. Values may reference the input buffer
+       *                  (see minute_http_text), and are copied to the text
+       *                  buffer before the payload is read.
        *  \param user     The supplied user data pointer.
        *
        *  \return The HTTP response code to send, e.g. 200. Return 100 to visit
@@ -122,6 +490,10 @@ minute_httpd_app
        *  Expect: 100-continue header, a 100 Continue will be sent before this
        *  function is called. Response headers may still be set at this point.
        *
+       *  Reading the payload fails with EAGAIN once what's arrived has been
+       *  read. Returning 100 then has the function called again when more
+       *  of it is to be read, so that the connection needn't wait for it.
+       *
        *  NOTE: Only called if the headers function returns 100, regardless
        *        whether the Expect: 100-continue header is set or not.
        *
@@ -148,7 +520,8 @@ minute_httpd_app
        *
        *  NOTE: Not called if we're processing a HEAD request or if the head
        *        function returned a 204 No content, a 205 Reset content, or
-       *        a 304 Not modified code.
+       *        a 304 Not modified code, nor if the status was replaced
+       *        following the validators declared by the head function.
        *
        *  \param request  The incoming request.
        *  \param output   API functions for payload output. The output is
@@ -191,6 +564,93 @@ minute_httpd_app
 }
 minute_httpd_app;
 
+/** \brief Callback copying part of an entity to the response output.
+
+    \param offset   The first byte of the part within the entity.
+    \param length   The number of bytes to copy.
+    \param out      The response output.
+    \param user     The user pointer supplied along with the callback.
+    \return Zero on success, non-zero otherwise.
+*/
+typedef int (*minute_httpd_range_copy) (unsigned long long  offset,
+                                        unsigned long long  length,
+                                        minute_httpd_out   *out,
+                                        void               *user);
+
+/** \brief Set the headers of a partial response.
+
+    To be called from the application header function when responding to a
+    Range request, with the ranges resolved using minute_http_ranges_resolve.
+    A single range sets Content-Range (and Content-Type, if given); multiple
+    ranges set a multipart/byteranges Content-Type instead, with the ranges
+    described by each part. Return 206 Partial Content, or if no ranges are
+    satisfiable, call this with a zero count to set the Content-Range
+    required by 416 Requested Range Not Satisfiable.
+
+    \param ranges        The resolved ranges.
+    \param count         The number of ranges.
+    \param size          The size of the entity.
+    \param content_type  The content type of the entity, may be NULL.
+    \param head          The head passed to the header function.
+    \return Zero on success, non-zero otherwise.
+*/
+int   minute_httpd_ranges_head  (const minute_http_range  *ranges,
+                                 unsigned                  count,
+                                 unsigned long long        size,
+                                 const char               *content_type,
+                                 minute_httpd_head        *head);
+
+/** \brief Write the payload of a partial response.
+
+    To be called from the application response function with the same
+    arguments as minute_httpd_ranges_head, writing the multipart framing if
+    needed and calling copy to produce the data of each range.
+
+    \param ranges        The resolved ranges.
+    \param count         The number of ranges.
+    \param size          The size of the entity.
+    \param content_type  The content type of the entity, may be NULL.
+    \param copy          Callback writing part of the entity.
+    \param user          User pointer passed on to copy.
+    \param out           The output passed to the response function.
+    \return Zero on success, non-zero otherwise.
+*/
+int   minute_httpd_ranges_write (const minute_http_range  *ranges,
+                                 unsigned                  count,
+                                 unsigned long long        size,
+                                 const char               *content_type,
+                                 minute_httpd_range_copy   copy,
+                                 void                     *user,
+                                 minute_httpd_out         *out);
+
+struct stat;
+
+/** \brief Select a precompressed variant of a file.
+
+    Looks for siblings of the file compressed using the codings accepted by
+    the client, named by appending .gz, .br or .zst to the path, and picks the
+    most preferred one that exists, falling back to the file itself if
+    identity is acceptable. Sets Content-Encoding for a compressed variant,
+    and Vary whenever there are variants to choose from, so that caches keep
+    them apart. To be called from the application header function.
+
+    \param path      The path of the uncompressed file.
+    \param codings   The codings accepted by the client, see
+                     minute_http_accept_encoding.
+    \param variant   Buffer receiving the path of the selected file.
+    \param size      The size of the variant buffer.
+    \param st        Receives the status of the selected file, may be NULL.
+    \param head      The head passed to the header function.
+    \return The coding of the selected file, or negative if there's no
+            acceptable file.
+*/
+int   minute_httpd_variant (const char                 *path,
+                            const minute_http_codings  *codings,
+                            char                       *variant,
+                            unsigned                    size,
+                            struct stat                *st,
+                            minute_httpd_head          *head);
+
 enum httpd_client_status
 {
   /** Client made a request, connection remains open */
@@ -198,10 +658,20 @@ enum httpd_client_status
   /** Client made a request, and requested the connection be closed */
   httpd_client_ok_close,
   /** Client made no request and closed the connection. */
-  httpd_client_no_request
+  httpd_client_no_request,
+  /** Waiting for the read descriptor to become readable, see
+      minute_httpd_step. */
+  httpd_client_want_read,
+  /** Waiting for the write descriptor to become writable. */
+  httpd_client_want_write
 };
 
-/** \brief Initialize the HTTPd connection state. */
+/** \brief Initialize the HTTPd connection state.
+
+    Each response is gathered into a single write, with the status line,
+    head, body and end of the transfer together, so Nagle's algorithm is
+    disabled if write is a TCP socket.
+*/
 void  minute_httpd_init  (int                 read,
                           int                 write,
                           iobuf               in,
@@ -209,12 +679,56 @@ void  minute_httpd_init  (int                 read,
                           textint             text,
                           minute_httpd_state *state);
 
+/** \brief Set the pool used for growing the buffers of the connection.
+
+    Without a pool, request heads not fitting the buffers given to
+    minute_httpd_init are answered with 414 or 413. */
+void  minute_httpd_set_pool (minute_httpd_pool  *pool,
+                             minute_httpd_state *state);
+
+/** \brief Set the transport of the connection, see minute_httpd_transport.
+
+    The transport is then used instead of system calls on the descriptors
+    given to minute_httpd_init. */
+void  minute_httpd_set_transport (minute_httpd_transport *transport,
+                                  minute_httpd_state     *state);
+
+/** \brief Put back any blocks borrowed from the pool, and close the pipe
+           used to splice payloads.
+
+    To be called when done with the connection. */
+void  minute_httpd_release  (minute_httpd_state *state);
+
+/** \brief Make progress on a connection without blocking.
+
+    Drives the connection as far as possible with non-blocking descriptors,
+    returning httpd_client_want_read or httpd_client_want_write when it would
+    block, in which case it should be called again once the descriptor is
+    ready. Otherwise a request has been served, and the return value is that
+    of minute_httpd_handle; call again for the next request if the
+    connection remains open.
+
+    Nothing waits for the descriptors: reading request heads, including
+    waiting for the next request on a kept alive connection, sending 100
+    Continue, reading the payload and reading past what the application
+    left of it all resume where they were. The application functions are
+    not resumed, the payload function rather being called again, see
+    minute_httpd_app; a response written faster than the descriptor takes
+    it is queued in blocks from the pool and flushed along with the end of
+    the response, or the connection is closed if there is no pool.
+*/
+int   minute_httpd_step    (minute_httpd_app*,
+                            minute_httpd_state*,
+                            void*);
+
 /** \brief Handle request using file descriptors.
 
     Handle a request by reading from the read descriptor, passing control to
     the app, with output being written to the write descriptor. There's no
     requirement that the descriptors should be distinct, as is the case when
-    using sockets.
+    using sockets. Descriptors that are non-blocking are waited for using
+    the transport's wait, which for minute_httpd_fd_transport gives up after
+    minute_httpd_fd_timeout, returning httpd_client_no_request.
 
     \return Zero on success, non-zero otherwise. Positive values match
             httpd_client_status enum, negative values are the negated status
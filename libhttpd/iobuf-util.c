@@ -2,32 +2,43 @@
 #include "iobuf-util.h"
 
 #include <sys/uio.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 
 int
-minute_iobuf_readfd  (int         fd,
-                      iobuf      *io)
+minute_iobuf_scatter (struct iovec *A,
+                      struct iovec *B,
+                      iobuf        *io)
 {
-  struct iovec iov[2];
-  size_t r;
   unsigned b = io->read;
   unsigned e = io->write;
   char *buf = io->data;
   size_t bi = b&io->mask, ei = e&io->mask;
-  iov[0].iov_base = buf+ei;
-  iov[0].iov_len  = bi>ei?bi-ei:io->mask+1-ei;
-  iov[1].iov_base = buf;
-  iov[1].iov_len  = bi>ei?0:bi;
+  A->iov_base = buf+ei;
+  A->iov_len  = bi>ei?bi-ei:io->mask+1-ei;
+  B->iov_base = buf;
+  B->iov_len  = bi>ei?0:bi;
   if (b != e && ei-bi == 0) {
     // no more buffer space
-    // http 414 Request-URI Too Long ?
+    errno = ENOBUFS;
     return -1;
+  }
+  return 2;
+}
+
+int
+minute_iobuf_readfd  (int         fd,
+                      iobuf      *io)
+{
+  struct iovec iov[2];
+  ssize_t r;
+  if (0>(r = minute_iobuf_scatter (&iov[0], &iov[1], io))) {
+    // no more buffer space
   } else if (0>(r = readv (fd, iov, 2))) {
-    // error...
+    // error, errno tells.
   } else if (0<r) {
-      e += r;
-      io->write = e;
+      io->write += r;
   } else {
       // r == 0  end of file..
       io->flags |= IOBUF_EOF;
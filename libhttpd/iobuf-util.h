@@ -3,6 +3,11 @@
 
 struct iovec;
 
+/** \brief Read as much as fits in the buffer from a file descriptor.
+
+  \return The number of bytes read, zero at end of file (setting IOBUF_EOF),
+          or -1 with errno set on error; ENOBUFS if the buffer is full.
+*/
 int   minute_iobuf_readfd  (int         fd,
                             iobuf      *io);
 int   minute_iobuf_flushfd (int         fd,
@@ -10,6 +15,14 @@ int   minute_iobuf_flushfd (int         fd,
 int   minute_iobuf_gather  (struct iovec *a,
                             struct iovec *b,
                             iobuf      *io);
+/** \brief Describe the free space of the buffer, for reading into.
+
+  \return The number of iovecs, or -1 with errno set to ENOBUFS if the buffer
+          is full.
+*/
+int   minute_iobuf_scatter (struct iovec *a,
+                            struct iovec *b,
+                            iobuf      *io);
 int   minute_iobuf_printf  (iobuf      *io,
                             const char *fmt, ...);
 
@@ -0,0 +1,122 @@
+#include "httpd.h"
+#include "libhttp/http-headers.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NL "\r\n"
+
+/* Separates the parts of multipart/byteranges responses; the RFC requires
+   it not to appear in the entity, which we can't guarantee, but with some
+   randomness in it, it's not very likely to. */
+#define BOUNDARY "minute-7c2f9e41d05b38a6"
+
+static int
+range_content_range (const minute_http_range *range,
+                     unsigned long long       size,
+                     char                    *buf,
+                     unsigned                 len)
+{
+  if (range)
+    return snprintf (buf, len, "bytes %llu-%llu/%llu",
+                     range->first, range->last, size);
+  return snprintf (buf, len, "bytes */%llu", size);
+}
+
+static int
+range_print (const char       *s,
+             minute_httpd_out *out)
+{
+  unsigned len = strlen (s);
+  return out->write (s, len, out) == len ? 0 : -1;
+}
+
+/* Declare the length of the body written by minute_httpd_ranges_write, so
+   it needn't be chunked. */
+static int
+range_content_length (const minute_http_range  *ranges,
+                      unsigned                  count,
+                      unsigned long long        size,
+                      const char               *content_type,
+                      minute_httpd_head        *head)
+{
+  char cr[64], length[24];
+  unsigned long long total = 0;
+  unsigned i;
+
+  for (i = 0; i < count; ++i) {
+    total += ranges[i].last - ranges[i].first + 1;
+    if (count == 1)
+      break;
+    total += range_content_range (&ranges[i], size, cr, sizeof(cr));
+    total += strlen (i ? NL "--" BOUNDARY NL : "--" BOUNDARY NL);
+    if (content_type)
+      total += strlen ("Content-Type: " NL) + strlen (content_type);
+    total += strlen ("Content-Range: " NL NL);
+  }
+  if (count > 1)
+    total += strlen (NL "--" BOUNDARY "--" NL);
+  snprintf (length, sizeof(length), "%llu", total);
+  return head->string (http_rsp_content_length, length, head);
+}
+
+int
+minute_httpd_ranges_head  (const minute_http_range  *ranges,
+                           unsigned                  count,
+                           unsigned long long        size,
+                           const char               *content_type,
+                           minute_httpd_head        *head)
+{
+  char cr[64];
+  if (count > 1) {
+    if (head->string (http_rsp_content_type,
+                      "multipart/byteranges; boundary=" BOUNDARY, head))
+      return -1;
+    return range_content_length (ranges, count, size, content_type, head);
+  }
+
+  range_content_range (count ? ranges : NULL, size, cr, sizeof(cr));
+  if (head->string (http_rsp_content_range, cr, head))
+    return -1;
+  if (count && content_type
+      && head->string (http_rsp_content_type, content_type, head))
+    return -1;
+  return count ? range_content_length (ranges, count, size, content_type,
+                                       head) : 0;
+}
+
+int
+minute_httpd_ranges_write (const minute_http_range  *ranges,
+                           unsigned                  count,
+                           unsigned long long        size,
+                           const char               *content_type,
+                           minute_httpd_range_copy   copy,
+                           void                     *user,
+                           minute_httpd_out         *out)
+{
+  char cr[64];
+  unsigned i;
+
+  if (count == 1)
+    return copy (ranges[0].first, ranges[0].last - ranges[0].first + 1,
+                 out, user);
+
+  for (i = 0; i < count; ++i) {
+    range_content_range (&ranges[i], size, cr, sizeof(cr));
+    if (range_print (i ? NL "--" BOUNDARY NL : "--" BOUNDARY NL, out))
+      return -1;
+    if (content_type
+        && (range_print ("Content-Type: ", out)
+            || range_print (content_type, out)
+            || range_print (NL, out)))
+      return -1;
+    if (range_print ("Content-Range: ", out)
+        || range_print (cr, out)
+        || range_print (NL NL, out))
+      return -1;
+    if (copy (ranges[i].first, ranges[i].last - ranges[i].first + 1,
+              out, user))
+      return -1;
+  }
+  return count ? range_print (NL "--" BOUNDARY "--" NL, out) : 0;
+}
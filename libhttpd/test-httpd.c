@@ -4,16 +4,25 @@
 #include "libhttp/http-headers.h"
 #include "httpd.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
-/* This is not really a proper test. It doesn't actually check anything
-   except that it doesn't crash (which is something I suppose). The output
-   needs to be looked over manually to verify proper operation. */
+/* Each test serves a request stream read from a pipe, checking how the
+   connection ended and the exact bytes written back, minus the Date headers
+   which change from one run to the next. */
+
+// request heads larger than the buffers are served using blocks from a pool,
+// payloads larger than them are read around them.
+#define LONG "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef" \
+             "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define KILO LONG LONG LONG LONG LONG LONG LONG LONG
 
 static unsigned
 test_head  (minute_http_rq     *rq,
@@ -23,8 +32,9 @@ test_head  (minute_http_rq     *rq,
 {
   char buffer[64];
 
-  snprintf (buffer, sizeof(buffer), "path:%s,query:%s",
-           &((char*)text->data)[rq->path], &((char*)text->data)[rq->query]);
+  snprintf (buffer, sizeof(buffer), "path:%.*s,query:%.*s",
+           rq->path_length, minute_http_text (rq->path, rq, text),
+           rq->query_length, minute_http_text (rq->query, rq, text));
   head->string (http_rsp_set_cookie, buffer, head);
   head->timestamp (http_rsp_last_modified, 1314524588, head);
   return 100;
@@ -52,21 +62,143 @@ test_payload (minute_http_rq    *rq,
   return 200;
 }
 
+static int
+text_equals (unsigned ref, unsigned len, minute_http_rq *rq, textint *text,
+             const char *expected)
+{
+  return len == strlen(expected)
+    && 0 == memcmp(minute_http_text(ref, rq, text), expected, len);
+}
+
 static unsigned
 test_response(minute_http_rq   *rq,
               minute_httpd_out *out,
+              minute_httpd_in  *in,
               textint          *text,
               unsigned          status,
               void             *user)
 {
   char x[64];
-  out->write(x,
-    snprintf (x, sizeof(x), "in response, status: %d\n", status),
-    out
-  );
+  int n = snprintf (x, sizeof(x), "in response, status: %d\n", status);
+  // flushing part of the body before the end has it chunked.
+  if (text_equals (rq->path, rq->path_length, rq, text, "/chunked")) {
+    out->write(x, n, out);
+    out->flush(out);
+  }
+  out->write(x, n, out);
   return 0;
 }
 
+static const char entity[] = "0123456789abcdef";
+
+struct
+test_range
+{
+  minute_http_range ranges[4];
+  int               count;
+  // the entity in a file, sent using sendfile.
+  int               fd;
+};
+
+static unsigned
+test_range_head (minute_http_rq     *rq,
+                 minute_httpd_head  *head,
+                 textint            *text,
+                 void               *user)
+{
+  struct test_range *t = user;
+  unsigned length;
+  const char *range = minute_http_header (http_rq_range, &length, rq, text);
+  head->validators ("\"v1\"", 1314524588, head);
+  t->count = range ? minute_http_ranges (range, length, t->ranges, 4) : -1;
+  // the whole entity's length is declared up front, as for a file.
+  if (t->count < 0) {
+    head->string (http_rsp_content_length, "16", head);
+    return 200;
+  }
+  t->count = minute_http_ranges_resolve (t->ranges, t->count,
+                                         sizeof(entity)-1);
+  minute_httpd_ranges_head (t->ranges, t->count, sizeof(entity)-1,
+                            "text/plain", head);
+  return t->count ? 206 : 416;
+}
+
+static int
+test_range_copy (unsigned long long  offset,
+                 unsigned long long  length,
+                 minute_httpd_out   *out,
+                 void               *user)
+{
+  struct test_range *t = user;
+  if (t)
+    return out->sendfile (t->fd, offset, length, out);
+  return out->write (entity + offset, length, out) != length;
+}
+
+static unsigned
+test_range_response (minute_http_rq   *rq,
+                     minute_httpd_out *out,
+                     minute_httpd_in  *in,
+                     textint          *text,
+                     unsigned          status,
+                     void             *user)
+{
+  struct test_range *t = user;
+  if (t->count < 0)
+    return test_range_copy (0, sizeof(entity)-1, out, 0);
+  if (status == 416)
+    return 1;
+  return minute_httpd_ranges_write (t->ranges, t->count, sizeof(entity)-1,
+                                    "text/plain", test_range_copy, t, out);
+}
+
+static int test_pool_blocks;
+static unsigned test_pool_limit = 0x2000;
+
+static void*
+test_pool_get (unsigned size, minute_httpd_pool *pool)
+{
+  if (size > test_pool_limit)
+    return NULL;
+  test_pool_blocks++;
+  return malloc (size);
+}
+
+static void
+test_pool_put (void *block, unsigned size, minute_httpd_pool *pool)
+{
+  test_pool_blocks--;
+  free (block);
+}
+
+static int
+test_handle(minute_httpd_app *app, void *user)
+{
+  minute_httpd_state state;
+  minute_httpd_pool pool = {
+    test_pool_get,
+    test_pool_put
+  };
+
+  char inbuf[0x100];
+  char outbuf[0x400];
+  char textbuf[0x400];
+  int status;
+
+  minute_httpd_init(0, 1,
+    minute_iobuf_init(sizeof(inbuf), inbuf),
+    minute_iobuf_init(sizeof(outbuf), outbuf),
+    minute_textint_init(sizeof(textbuf), textbuf),
+    &state
+    );
+  minute_httpd_set_pool(&pool, &state);
+
+  while (httpd_client_ok_open == (status = minute_httpd_handle (app,&state,user)))
+    ;
+
+  minute_httpd_release(&state);
+  return test_pool_blocks ? 1 : status;
+}
 
 static int
 test_inetd()
@@ -77,27 +209,435 @@ test_inetd()
     test_response,
     test_error
   };
+  return test_handle (&app, 0);
+}
+
+/* Drive the connection using non-blocking descriptors, as an event loop
+   would. */
+static int
+test_step()
+{
+  minute_httpd_app app = {
+    test_head,
+    test_payload,
+    test_response,
+    test_error
+  };
+  minute_httpd_state state;
+
+  char inbuf[0x100];
+  char outbuf[0x400];
+  char textbuf[0x400];
+  int status;
+
+  fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+  fcntl(1, F_SETFL, fcntl(1, F_GETFL) | O_NONBLOCK);
+  minute_httpd_init(0, 1,
+    minute_iobuf_init(sizeof(inbuf), inbuf),
+    minute_iobuf_init(sizeof(outbuf), outbuf),
+    minute_textint_init(sizeof(textbuf), textbuf),
+    &state
+    );
+
+  while (1) {
+    struct pollfd p = {0, POLLIN, 0};
+    status = minute_httpd_step (&app, &state, 0);
+    if (status == httpd_client_want_write)
+      p.fd = 1, p.events = POLLOUT;
+    else if (status == httpd_client_ok_open)
+      continue;
+    else if (status != httpd_client_want_read)
+      break;
+    poll(&p, 1, -1);
+  }
+
+  return status;
+}
+
+/* Wait on a request that never ends, until the wait times out. */
+static int
+test_timeout()
+{
+  fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+  minute_httpd_fd_timeout = 50;
+  return test_inetd ();
+}
+
+/* Refuse payloads of more than a few bytes as too large, chunked ones once
+   read that far. */
+static unsigned
+test_limit_payload (minute_http_rq    *rq,
+                    minute_httpd_head *head,
+                    minute_httpd_in   *in,
+                    textint           *text,
+                    void              *user)
+{
+  char x[8];
+  int n, length = 0;
+  if (rq->flags & http_content_length && rq->content_length > sizeof(x))
+    return http_request_entity_too_large;
+  while ((n = in->read (x, sizeof(x), in)) > 0)
+    if ((length += n) > sizeof(x))
+      return http_request_entity_too_large;
+  return 200;
+}
+
+/* The rest of a payload too large isn't waited for, the connection is
+   closed instead. */
+static int
+test_limit()
+{
+  minute_httpd_app app = {
+    test_head,
+    test_limit_payload,
+    test_response,
+    test_error
+  };
+  fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+  minute_httpd_fd_timeout = 50;
+  return test_handle (&app, 0);
+}
+
+/* Read the payload in place, checking it's whole and in order. */
+static unsigned
+test_view_payload (minute_http_rq    *rq,
+                   minute_httpd_head *head,
+                   minute_httpd_in   *in,
+                   textint           *text,
+                   void              *user)
+{
+  char x[64];
+  const char *data;
+  unsigned length = 0, sum = 0;
+  int r;
+  while (0 < (r = in->view(&data, in)))
+    for (length += r; r; --r)
+      sum = sum * 31 + (unsigned char) *data++;
+  snprintf(x, sizeof(x), "in view: %u bytes, %08x", length, sum);
+  head->string(http_rsp_etag, x, head);
+  return r ? 400 : 200;
+}
+
+static int
+test_view()
+{
+  minute_httpd_app app = {
+    test_head,
+    test_view_payload,
+    test_response,
+    test_error
+  };
+  return test_handle (&app, 0);
+}
+
+static int
+test_ranges()
+{
+  minute_httpd_app app = {
+    test_range_head,
+    0,
+    test_range_response,
+    test_error
+  };
+  struct test_range t;
+  FILE *f = tmpfile();
+  fputs (entity, f);
+  fflush (f);
+  t.fd = fileno(f);
+  return test_handle (&app, &t);
+}
+
+/* Serve the request stream from memory, counting the calls made to the
+   transport, and pass on the output. */
+static int
+test_counted(minute_httpd_app *app, const char *request, unsigned length,
+             minute_httpd_instrumented_transport *counted)
+{
+  minute_httpd_memory_transport memory;
   minute_httpd_state state;
 
   char inbuf[0x100];
   char outbuf[0x400];
   char textbuf[0x400];
+  char output[0x1000];
   int status;
 
+  minute_httpd_memory_transport_init (request, length,
+                                      output, sizeof(output), &memory);
+  minute_httpd_instrumented_transport_init (&memory.base, counted);
   minute_httpd_init(0, 1,
     minute_iobuf_init(sizeof(inbuf), inbuf),
     minute_iobuf_init(sizeof(outbuf), outbuf),
     minute_textint_init(sizeof(textbuf), textbuf),
     &state
     );
+  minute_httpd_set_transport(&counted->base, &state);
 
-  while (httpd_client_ok_open == (status = minute_httpd_handle (&app,&state,0)))
+  while (httpd_client_ok_open == (status = minute_httpd_handle (app,&state,0)))
     ;
 
+  write (1, output, memory.out_length);
+  if (counted->written_bytes != memory.out_length)
+    return -1;
+  return status;
+}
+
+/* Each of the small responses goes out in a single write. */
+static int
+test_transport()
+{
+  static const char request[] =
+    "GET /a HTTP/1.1\r\n"
+    "\r\n"
+    "GET /b HTTP/1.1\r\n"
+    "\r\n"
+    "GET /c HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+  minute_httpd_app app = {
+    test_head,
+    test_payload,
+    test_response,
+    test_error
+  };
+  minute_httpd_instrumented_transport counted;
+  int status = test_counted (&app, request, sizeof(request)-1, &counted);
+
+  if (counted.writes != 3 || counted.read_bytes != sizeof(request)-1)
+    return -1;
+  return status;
+}
+
+/* Take in the payload by reading it into a buffer larger than the input
+   buffer, or by splicing it into a file, checking it's whole and in
+   order. */
+static unsigned
+test_upload_payload (minute_http_rq    *rq,
+                     minute_httpd_head *head,
+                     minute_httpd_in   *in,
+                     textint           *text,
+                     void              *user)
+{
+  char x[0x400];
+  unsigned length = 0, sum = 0;
+  int r, n, i;
+  if (text_equals (rq->path, rq->path_length, rq, text, "/splice")) {
+    FILE *f = tmpfile();
+    while (0 < (r = in->splice(fileno(f), 0x10000, in)))
+      length += r;
+    rewind(f);
+    while (0 < (n = fread(x, 1, sizeof(x), f)))
+      for (i = 0; i < n; ++i)
+        sum = sum * 31 + (unsigned char) x[i];
+    fclose(f);
+  } else {
+    while (0 < (r = in->read(x, sizeof(x), in)))
+      for (length += r, i = 0; i < r; ++i)
+        sum = sum * 31 + (unsigned char) x[i];
+  }
+  snprintf(x, sizeof(x), "in upload: %u bytes, %08x", length, sum);
+  head->string(http_rsp_etag, x, head);
+  return r ? 400 : 200;
+}
+
+static minute_httpd_app test_upload_app = {
+  test_head,
+  test_upload_payload,
+  test_response,
+  test_error
+};
+
+static int
+test_upload()
+{
+  return test_handle (&test_upload_app, 0);
+}
+
+/* Once the buffered part of the payload has been read, the rest is read
+   straight into the application's buffer, in one go: three reads rather
+   than the five it takes through the input buffer. */
+static int
+test_direct()
+{
+  static const char request[] =
+    "POST /read HTTP/1.1\r\n"
+    "Content-Length: 1024\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    KILO;
+  minute_httpd_instrumented_transport counted;
+  int status = test_counted (&test_upload_app, request, sizeof(request)-1,
+                             &counted);
+
+  if (counted.reads != 3 || counted.read_bytes != sizeof(request)-1)
+    return -1;
   return status;
 }
 
-int run_test(int (*testfunc)(void), const char *request, int expected);
+struct
+test_trickle
+{
+  unsigned  length;
+  unsigned  sum;
+  // a kilobyte in a file, sent using sendfile.
+  int       fd;
+};
+
+/* Read the payload as it arrives, asking to be called again once it's run
+   out, as an application served by minute_httpd_step would. */
+static unsigned
+test_trickle_payload (minute_http_rq    *rq,
+                      minute_httpd_head *head,
+                      minute_httpd_in   *in,
+                      textint           *text,
+                      void              *user)
+{
+  struct test_trickle *t = user;
+  char x[64];
+  int r, i;
+  while (0 < (r = in->read(x, sizeof(x), in)))
+    for (t->length += r, i = 0; i < r; ++i)
+      t->sum = t->sum * 31 + (unsigned char) x[i];
+  if (r < 0 && errno == EAGAIN)
+    return 100;
+  snprintf(x, sizeof(x), "in upload: %u bytes, %08x", t->length, t->sum);
+  head->string(http_rsp_etag, x, head);
+  t->length = t->sum = 0;
+  return r ? 400 : 200;
+}
+
+/* Respond with more than fits the output buffer, or with the file. */
+static unsigned
+test_trickle_response (minute_http_rq   *rq,
+                       minute_httpd_out *out,
+                       minute_httpd_in  *in,
+                       textint          *text,
+                       unsigned          status,
+                       void             *user)
+{
+  struct test_trickle *t = user;
+  int i;
+  if (text_equals (rq->path, rq->path_length, rq, text, "/file"))
+    return out->sendfile (t->fd, 0, sizeof(KILO)-1, out);
+  if (!text_equals (rq->path, rq->path_length, rq, text, "/big"))
+    return test_response (rq, out, in, text, status, user);
+  for (i = 0; i < 3; ++i)
+    out->write (KILO, sizeof(KILO)-1, out);
+  return 0;
+}
+
+/* Serve the request stream from memory trickling in and out a few bytes at
+   a time, stepping the connection until it's done. Sending 100 Continue,
+   reading the payload and flushing the response each have to stop for the
+   connection and resume where they were. */
+static int
+test_trickle()
+{
+  static const char request[] =
+    "POST /upload HTTP/1.1\r\n"
+    "Expect: 100-continue\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "400\r\n"
+    KILO "\r\n"
+    "0\r\n"
+    "\r\n"
+    "GET /big HTTP/1.1\r\n"
+    "\r\n"
+    "GET /file HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+  minute_httpd_app app = {
+    test_head,
+    test_trickle_payload,
+    test_trickle_response,
+    test_error
+  };
+  minute_httpd_pool pool = {
+    test_pool_get,
+    test_pool_put
+  };
+  minute_httpd_memory_transport memory;
+  minute_httpd_state state;
+  struct test_trickle t = {0, 0, -1};
+  FILE *f = tmpfile();
+
+  char inbuf[0x100];
+  char outbuf[0x400];
+  char textbuf[0x400];
+  char output[0x2000];
+  // the length of the 100 Continue.
+  unsigned continued = 25;
+  unsigned in_continue = 0, in_payload = 0, in_flush = 0;
+  int status;
+
+  fputs (KILO, f);
+  fflush (f);
+  t.fd = fileno(f);
+  minute_httpd_memory_transport_init (request, sizeof(request)-1,
+                                      output, sizeof(output), &memory);
+  memory.trickle = 7;
+  minute_httpd_init(0, 1,
+    minute_iobuf_init(sizeof(inbuf), inbuf),
+    minute_iobuf_init(sizeof(outbuf), outbuf),
+    minute_textint_init(sizeof(textbuf), textbuf),
+    &state
+    );
+  minute_httpd_set_transport(&memory.base, &state);
+  minute_httpd_set_pool(&pool, &state);
+
+  while (1) {
+    status = minute_httpd_step (&app, &state, &t);
+    if (status == httpd_client_want_write && memory.out_length < continued)
+      in_continue++;
+    else if (status == httpd_client_want_write)
+      in_flush++;
+    else if (status == httpd_client_want_read && t.length)
+      in_payload++;
+    else if (status != httpd_client_want_read
+             && status != httpd_client_ok_open)
+      break;
+  }
+
+  minute_httpd_release(&state);
+  fclose (f);
+  write (1, output, memory.out_length);
+  if (!in_continue || !in_payload || !in_flush || test_pool_blocks)
+    return -1;
+  return status;
+}
+
+#ifdef MINUTE_HTTPD_ZLIB
+static unsigned
+test_compress_head (minute_http_rq     *rq,
+                    minute_httpd_head  *head,
+                    textint            *text,
+                    void               *user)
+{
+  head->encode (text_equals (rq->path, rq->path_length, rq, text, "/deflate")
+                ? http_coding_deflate : http_coding_gzip, 1, 0, head);
+  return 200;
+}
+
+/* The compressor gets its memory from the pool, and gives all of it back. */
+static int
+test_compress()
+{
+  minute_httpd_app app = {
+    test_compress_head,
+    0,
+    test_response,
+    test_error
+  };
+  test_pool_limit = 0x10000;
+  return test_handle (&app, 0);
+}
+#endif
+
+int run_test(int (*testfunc)(void), const char *request, int expected,
+             const char *response);
+
+
 
 int
 main (void)
@@ -120,20 +660,523 @@ main (void)
     "Content-Length: 5\r\n"
     "\r\n"
     "12345\r\n"
+    "GET /chunked HTTP/1.1\r\n"
+    "\r\n"
     "GET / HTTP/1.1\r\n"
     "Connection: close\r\n"
-    "\r\n", httpd_client_ok_close)
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 100 Continue\r\n"
+    "\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/test/uri,query:with&query string\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: 12345\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/test/uri,query:with&query string\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: 12345\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/chunked,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "19\r\n"
+    "in response, status: 200\n"
+    "\r\n"
+    "19\r\n"
+    "in response, status: 200\n"
+    "\r\n"
+    "0\r\n"
+    "\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
   ||
   run_test (test_inetd,
     "GSET / HTTP/1.1\r\n"
-    "\r\n", -400)
+    "\r\n", -400,
+    "HTTP/1.0 400 Bad Request\r\n"
+    "Server: minuted/0.1\r\n"
+    "Content-Length: 94\r\n"
+    "\r\n"
+    "<html><head><title>400 Bad Request</title></head><body><h1>400 Bad Request</h1></body></html>\n")
+  ||
+  // responses to HTTP/1.0 keep-alive requests can't be chunked.
+  run_test (test_inetd,
+    "GET / HTTP/1.0\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "GET /chunked HTTP/1.0\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.0 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.0 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/chunked,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "in response, status: 200\n")
+  ||
+  // a chunked payload without trailers, followed by another request.
+  run_test (test_inetd,
+    "POST /upload HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "5\r\n"
+    "12345\r\n"
+    "0\r\n"
+    "\r\n"
+    "GET /next HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/upload,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: 12345\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/next,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
+  ||
+  run_test (test_inetd,
+    "GET /" LONG LONG LONG " HTTP/1.1\r\n"
+    "Cookie: " LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG "\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/0123456789abcdef0123456789abcdef0123456789abcdef012345678\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
+  ||
+  run_test (test_inetd,
+    "GET / HTTP/1.1\r\n"
+    "Cookie: " LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG LONG
+               "\r\n"
+    "\r\n", -413,
+    "HTTP/1.1 413 Request Entity Too Large\r\n"
+    "Server: minuted/0.1\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 120\r\n"
+    "\r\n"
+    "<html><head><title>413 Request Entity Too Large</title></head><body><h1>413 Request Entity Too Large</h1></body></html>\n")
+  ||
+  run_test (test_step,
+    "POST /test/uri?with&query%20string HTTP/1.1\r\n"
+    "Host: minute.example.org\r\n"
+    "Content-Length: 5\r\n"
+    "\r\n"
+    "12345"
+    "GET / HTTP/1.1\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/test/uri,query:with&query string\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: 12345\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
+  ||
+  run_test (test_timeout,
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n", httpd_client_no_request,
+    "")
+  ||
+  run_test (test_limit,
+    "POST / HTTP/1.1\r\n"
+    "Content-Length: 100\r\n"
+    "Expect: 100-continue\r\n"
+    "\r\n"
+    "0123456789", httpd_client_ok_close,
+    "HTTP/1.1 100 Continue\r\n"
+    "\r\n"
+    "HTTP/1.1 413 Request Entity Too Large\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 413\n")
+  ||
+  run_test (test_limit,
+    "POST / HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "10\r\n0123456789abcdef\r\n", httpd_client_ok_close,
+    "HTTP/1.1 413 Request Entity Too Large\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 413\n")
+  ||
+  run_test (test_ranges,
+    "GET / HTTP/1.1\r\n"
+    "Range: bytes=-4\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "Range: bytes=0-3,10-\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "Range: bytes=16-\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "If-None-Match: \"v0\", W/\"v1\"\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "If-Modified-Since: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "\r\n"
+    // the declared length is the entity's, not that of the 412's body.
+    "DELETE / HTTP/1.1\r\n"
+    "If-Match: \"v0\"\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 206 Partial Content\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Content-Range: bytes 12-15/16\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 4\r\n"
+    "\r\n"
+    "cdefHTTP/1.1 206 Partial Content\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Content-Type: multipart/byteranges; boundary=minute-7c2f9e41d05b38a6\r\n"
+    "Content-Length: 213\r\n"
+    "\r\n"
+    "--minute-7c2f9e41d05b38a6\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Range: bytes 0-3/16\r\n"
+    "\r\n"
+    "0123\r\n"
+    "--minute-7c2f9e41d05b38a6\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Range: bytes 10-15/16\r\n"
+    "\r\n"
+    "abcdef\r\n"
+    "--minute-7c2f9e41d05b38a6--\r\n"
+    "HTTP/1.1 416 Requested Range Not Satisfiable\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Content-Range: bytes */16\r\n"
+    "Content-Length: 134\r\n"
+    "\r\n"
+    "<html><head><title>416 Requested Range Not Satisfiable</title></head><body><h1>416 Requested Range Not Satisfiable</h1></body></html>\n"
+    "HTTP/1.1 304 Not Modified\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "\r\n"
+    "HTTP/1.1 304 Not Modified\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "\r\n"
+    "HTTP/1.1 412 Precondition Failed\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Content-Length: 110\r\n"
+    "\r\n"
+    "<html><head><title>412 Precondition Failed</title></head><body><h1>412 Precondition Failed</h1></body></html>\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "ETag: \"v1\"\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 16\r\n"
+    "\r\n"
+    "0123456789abcdef")
+  ||
+  // chunk extensions are skipped, and payload wrapping around the end of
+  // the input buffer is read in two parts.
+  run_test (test_view,
+    "POST /view HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "3;name=value\r\n"
+    "abc\r\n"
+    "100\r\n"
+    LONG LONG "\r\n"
+    "a\r\n"
+    "0123456789\r\n"
+    "0\r\n"
+    "\r\n"
+    "POST /bad HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "zz\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/view,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in view: 269 bytes, 5feeb667\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    // the rest of the connection can't be made sense of.
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/bad,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in view: 0 bytes, 00000000\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 400\n")
+  ||
+  run_test (test_upload,
+    "POST /read HTTP/1.1\r\n"
+    "Content-Length: 1024\r\n"
+    "\r\n"
+    KILO
+    "POST /splice HTTP/1.1\r\n"
+    "Content-Length: 1024\r\n"
+    "\r\n"
+    KILO
+    "POST /splice HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "400\r\n"
+    KILO "\r\n"
+    "0\r\n"
+    "\r\n"
+    "GET / HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/read,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 1024 bytes, 70abaa00\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/splice,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 1024 bytes, 70abaa00\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/splice,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 1024 bytes, 70abaa00\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 0 bytes, 00000000\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
+  ||
+  run_test (test_direct, "", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/read,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 1024 bytes, 70abaa00\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
+  ||
+  run_test (test_transport, "", httpd_client_ok_close,
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/a,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/b,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/c,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in payload: \r\n"
+    "Connection: close\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n")
+  ||
+  run_test (test_trickle, "", httpd_client_ok_close,
+    "HTTP/1.1 100 Continue\r\n"
+    "\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/upload,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 1024 bytes, 70abaa00\r\n"
+    "Content-Length: 25\r\n"
+    "\r\n"
+    "in response, status: 200\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/big,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 0 bytes, 00000000\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "400\r\n"
+    KILO "\r\n"
+    "800\r\n"
+    KILO KILO "\r\n"
+    "0\r\n"
+    "\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Server: minuted/0.1\r\n"
+    "Set-Cookie: path:/file,query:\r\n"
+    "Last-Modified: Sun, 28 Aug 2011 09:43:08 GMT\r\n"
+    "ETag: in upload: 0 bytes, 00000000\r\n"
+    "Connection: close\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "400\r\n"
+    KILO "\r\n"
+    "0\r\n"
+    "\r\n")
+#ifdef MINUTE_HTTPD_ZLIB
+  ||
+  run_test (test_compress,
+    "GET / HTTP/1.1\r\n"
+    "\r\n"
+    "GET /deflate HTTP/1.1\r\n"
+    "\r\n"
+    "HEAD / HTTP/1.1\r\n"
+    "Connection: close\r\n"
+    "\r\n", httpd_client_ok_close,
+    // the compressed output depends on the zlib version.
+    NULL)
+#endif
   ;
 }
 
+/* Drop the Date headers from the output, returning the remaining length. */
+static size_t
+strip_dates (char *output, size_t length)
+{
+  size_t i = 0, j;
+  while (i + 8 <= length) {
+    if (memcmp (output+i, "\r\nDate: ", 8)) {
+      i++;
+      continue;
+    }
+    for (j = i+2; j+1 < length && memcmp (output+j, "\r\n", 2); ++j)
+      ;
+    memmove (output+i, output+j, length-j);
+    length -= j-i;
+  }
+  return length;
+}
+
 int
 run_test (int (*testfunc)(void),
           const char *request,
-          int expected)
+          int expected,
+          const char *response)
 {
   int toch[2];
   int topa[2];
@@ -141,23 +1184,38 @@ run_test (int (*testfunc)(void),
   int status;
   pipe(toch);
   pipe(topa);
+  // the child would write out whatever is still buffered.
+  fflush(stdout);
   if ((child = fork())) {
-    int to, from, c;
-    char buffer[4096];
+    int to, from, c, failed;
+    size_t size = 0x1000, length = 0;
+    char *output = malloc(size);
     /*parent*/
     close(toch[0]);
     close(topa[1]);
     to = toch[1];
     from = topa[0];
     write(to, request, strlen(request));
-    while((c = read(from, buffer, 4096)) > 0) {
-      write(1, buffer, c);
+    while((c = read(from, output+length, size-length)) > 0) {
+      length += c;
+      if (length == size)
+        output = realloc(output, size *= 2);
     }
+    close(to);
+    close(from);
     waitpid(child, &status, 0);
-    if (WEXITSTATUS(status)) {
+    if ((failed = WEXITSTATUS(status))) {
       printf ("Exit status: %d\n", WEXITSTATUS(status));
     }
-    return WEXITSTATUS(status);
+    length = strip_dates(output, length);
+    if (response && (length != strlen(response)
+                     || memcmp(output, response, length))) {
+      printf ("Request:\n%s\nExpected:\n%s\nGot:\n%.*s\n",
+              request, response, (int) length, output);
+      failed = 1;
+    }
+    free(output);
+    return failed;
   } else {
     /*child*/
     close(0);
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include "httpd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef offsetof
+# define offsetof(type,memb) ((char*)&(((type*)0)->memb)-((char*)0))
+#endif
+#define downcast(type,memb,var) ((type*)(((char*)var)-offsetof(type,memb)))
+
+static int
+fd_readv (int fd, const struct iovec *iov, int count,
+          minute_httpd_transport *t)
+{
+  return readv (fd, iov, count);
+}
+
+static int
+fd_writev (int fd, const struct iovec *iov, int count,
+           minute_httpd_transport *t)
+{
+  return writev (fd, iov, count);
+}
+
+static int
+fd_sendfile (int fd, int file, unsigned long long *offset, unsigned count,
+             minute_httpd_transport *t)
+{
+  off_t off = *offset;
+  ssize_t r = sendfile (fd, file, &off, count);
+  *offset = off;
+  return r;
+}
+
+/* Write out what's left in the pipe, should the destination not take
+   spliced data. */
+static int
+fd_drain (int pipe, int to, unsigned count)
+{
+  char buffer[0x1000];
+  while (count) {
+    int n = read (pipe, buffer, count < sizeof(buffer) ? count
+                                                       : sizeof(buffer));
+    int w = 0, r;
+    if (n <= 0)
+      return -1;
+    for (; w < n; w += r)
+      if ((0 > (r = write (to, buffer + w, n - w)) && errno != EINTR)
+          || (!r && (errno = EIO)))
+        return -1;
+      else if (r < 0)
+        r = 0;
+    count -= n;
+  }
+  return 0;
+}
+
+/* The data goes through the connection's pipe, splice needing one at either
+   end, made on first use. Like a read, returns once some has been moved. */
+static int
+fd_splice (int fd, int to, unsigned count, int pipe[2],
+           minute_httpd_transport *t)
+{
+  int err;
+  ssize_t n, m, moved = 0;
+
+  if (pipe[0] < 0 && pipe2 (pipe, O_CLOEXEC))
+    return -1;
+  n = splice (fd, NULL, pipe[1], NULL, count, SPLICE_F_MOVE);
+  err = errno;
+  while (n > moved && 0 < (m = splice (pipe[0], NULL, to, NULL, n - moved,
+                                       SPLICE_F_MOVE)))
+    moved += m;
+  // the data is already out of the connection, so it has to be written one
+  // way or another; what can't be would be taken for the next call's.
+  if (n > moved && fd_drain (pipe[0], to, n - moved)) {
+    err = errno;
+    n = -1;
+    close (pipe[0]);
+    close (pipe[1]);
+    pipe[0] = pipe[1] = -1;
+  }
+  errno = err;
+  return n;
+}
+
+static void
+fd_cork (int fd, int on, minute_httpd_transport *t)
+{
+  setsockopt (fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+/* TODO timeout. */
+int minute_httpd_fd_timeout = 60 * 1000;
+
+static int
+fd_wait (int fd, short events, minute_httpd_transport *t)
+{
+  struct pollfd p = {fd, events, 0};
+  int r;
+  while (0 > (r = poll (&p, 1, minute_httpd_fd_timeout)) && errno == EINTR)
+    ;
+  if (!r)
+    errno = ETIMEDOUT;
+  return r > 0 ? 0 : -1;
+}
+
+static int
+fd_close (int fd, minute_httpd_transport *t)
+{
+  return close (fd);
+}
+
+minute_httpd_transport minute_httpd_fd_transport = {
+  fd_readv,
+  fd_writev,
+  fd_sendfile,
+  fd_splice,
+  fd_cork,
+  fd_wait,
+  fd_close
+};
+
+/* Whether the call is to fail with EAGAIN, trickling; sets the most bytes
+   it may move otherwise. */
+static int
+memory_stall (minute_httpd_memory_transport *m, unsigned *most)
+{
+  *most = ~0u;
+  if (!m->trickle)
+    return 0;
+  *most = m->trickle;
+  if (++m->calls & 1)
+    return 0;
+  errno = EAGAIN;
+  return 1;
+}
+
+static int
+memory_readv (int fd, const struct iovec *iov, int count,
+              minute_httpd_transport *t)
+{
+  minute_httpd_memory_transport *m =
+    downcast(minute_httpd_memory_transport, base, t);
+  unsigned most = ~0u;
+  int i, r = 0;
+  if (m->in_length && memory_stall (m, &most))
+    return -1;
+  for (i = 0; i < count && m->in_length && (unsigned) r < most; ++i) {
+    unsigned n = iov[i].iov_len < m->in_length ? iov[i].iov_len
+                                               : m->in_length;
+    if (n > most - r)
+      n = most - r;
+    memcpy (iov[i].iov_base, m->in, n);
+    m->in += n;
+    m->in_length -= n;
+    r += n;
+  }
+  return r;
+}
+
+static int
+memory_writev (int fd, const struct iovec *iov, int count,
+               minute_httpd_transport *t)
+{
+  minute_httpd_memory_transport *m =
+    downcast(minute_httpd_memory_transport, base, t);
+  unsigned most;
+  int i, r = 0;
+  if (memory_stall (m, &most))
+    return -1;
+  if (m->out && m->out_length == m->out_size) {
+    for (i = 0; i < count && !iov[i].iov_len; ++i)
+      ;
+    if (i < count) {
+      errno = ENOSPC;
+      return -1;
+    }
+  }
+  for (i = 0; i < count && (unsigned) r < most; ++i) {
+    unsigned n = iov[i].iov_len < most - r ? iov[i].iov_len : most - r;
+    if (m->out && n) {
+      if (n > m->out_size - m->out_length)
+        n = m->out_size - m->out_length;
+      memcpy (m->out + m->out_length, iov[i].iov_base, n);
+    }
+    m->out_length += n;
+    r += n;
+    if (n < iov[i].iov_len)
+      break;
+  }
+  return r;
+}
+
+static int
+memory_wait (int fd, short events, minute_httpd_transport *t)
+{
+  return 0;
+}
+
+static int
+memory_close (int fd, minute_httpd_transport *t)
+{
+  return 0;
+}
+
+void
+minute_httpd_memory_transport_init (const char                    *in,
+                                    unsigned                       in_length,
+                                    char                          *out,
+                                    unsigned                       out_size,
+                                    minute_httpd_memory_transport *transport)
+{
+  static const minute_httpd_transport memory = {
+    memory_readv,
+    memory_writev,
+    NULL,
+    NULL,
+    NULL,
+    memory_wait,
+    memory_close
+  };
+  transport->base = memory;
+  transport->in = in;
+  transport->in_length = in_length;
+  transport->out = out;
+  transport->out_size = out_size;
+  transport->out_length = 0;
+  transport->trickle = 0;
+  transport->calls = 0;
+}
+
+static int
+instrumented_readv (int fd, const struct iovec *iov, int count,
+                    minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  int r = i->next->readv (fd, iov, count, i->next);
+  i->reads++;
+  if (r > 0)
+    i->read_bytes += r;
+  return r;
+}
+
+static int
+instrumented_writev (int fd, const struct iovec *iov, int count,
+                     minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  int r = i->next->writev (fd, iov, count, i->next);
+  i->writes++;
+  if (r > 0)
+    i->written_bytes += r;
+  return r;
+}
+
+static int
+instrumented_sendfile (int fd, int file, unsigned long long *offset,
+                       unsigned count, minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  int r;
+  if (!i->next->sendfile) {
+    errno = EINVAL;
+    return -1;
+  }
+  r = i->next->sendfile (fd, file, offset, count, i->next);
+  i->sendfiles++;
+  if (r > 0)
+    i->written_bytes += r;
+  return r;
+}
+
+static int
+instrumented_splice (int fd, int to, unsigned count, int pipe[2],
+                     minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  int r;
+  if (!i->next->splice) {
+    errno = EINVAL;
+    return -1;
+  }
+  r = i->next->splice (fd, to, count, pipe, i->next);
+  i->splices++;
+  if (r > 0)
+    i->read_bytes += r;
+  return r;
+}
+
+static void
+instrumented_cork (int fd, int on, minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  if (i->next->cork)
+    i->next->cork (fd, on, i->next);
+}
+
+static int
+instrumented_wait (int fd, short events, minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  i->waits++;
+  return i->next->wait (fd, events, i->next);
+}
+
+static int
+instrumented_close (int fd, minute_httpd_transport *t)
+{
+  minute_httpd_instrumented_transport *i =
+    downcast(minute_httpd_instrumented_transport, base, t);
+  return i->next->close (fd, i->next);
+}
+
+void
+minute_httpd_instrumented_transport_init (
+  minute_httpd_transport              *next,
+  minute_httpd_instrumented_transport *transport)
+{
+  static const minute_httpd_transport instrumented = {
+    instrumented_readv,
+    instrumented_writev,
+    instrumented_sendfile,
+    instrumented_splice,
+    instrumented_cork,
+    instrumented_wait,
+    instrumented_close
+  };
+  memset (transport, 0, sizeof(*transport));
+  transport->base = instrumented;
+  transport->next = next;
+}
@@ -0,0 +1,58 @@
+#include "httpd.h"
+#include "libhttp/http-headers.h"
+#include "libhttp/http-text.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+static const char*
+variant_suffix[http_coding_count] =
+{
+  "",     // identity
+  ".gz",  // gzip
+  ".br",  // br
+  ".zst", // zstd
+  NULL    // deflate, not looked for
+};
+
+int
+minute_httpd_variant (const char                 *path,
+                      const minute_http_codings  *codings,
+                      char                       *variant,
+                      unsigned                    size,
+                      struct stat                *st,
+                      minute_httpd_head          *head)
+{
+  enum http_content_coding ranked[http_coding_count];
+  struct stat sts[http_coding_count];
+  unsigned available = 0, n, i, len = strlen (path);
+
+  // look for all of them, not only the acceptable ones; Vary is about what
+  // other clients might get.
+  for (i = 0; i < http_coding_count; ++i) {
+    unsigned slen = variant_suffix[i] ? strlen (variant_suffix[i]) : size;
+    if (len + slen >= size)
+      continue;
+    memcpy (variant, path, len);
+    memcpy (variant + len, variant_suffix[i], slen + 1);
+    if (0 == stat (variant, &sts[i]) && S_ISREG(sts[i].st_mode))
+      available |= MINUTE_HTTP_CODING(i);
+  }
+
+  if (available & ~MINUTE_HTTP_CODING(http_coding_identity))
+    head->string (http_rsp_vary, "Accept-Encoding", head);
+
+  n = minute_http_codings_rank (codings, available, ranked);
+  if (!n)
+    return -1;
+
+  memcpy (variant, path, len);
+  memcpy (variant + len, variant_suffix[ranked[0]],
+          strlen (variant_suffix[ranked[0]]) + 1);
+  if (st)
+    *st = sts[ranked[0]];
+  if (ranked[0] != http_coding_identity)
+    head->string (http_rsp_content_encoding,
+                  minute_http_coding_text (ranked[0]), head);
+  return ranked[0];
+}
@@ -5,15 +5,22 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
+
 #include <assert.h>
 
 enum config_state_string_names
 {
   cs__errorinfo,
   cs_application,
+  cs_compress,
   cs_eval,
+  cs_header,
   cs_namespace,
+  cs_payload_limit,
   cs_source,
+  cs_spool,
+  cs_static,
   cs_nsMinuted,
   cs_nsMinutedVhost,
   cs_COUNT
@@ -57,6 +64,212 @@ vhost_tcl_application  (ClientData  clientData,
   return TCL_OK;
 }
 
+/* header name value: a header sent on every response of the vhost. The
+   headers are serialized here, once, and added to the responses as is. */
+static int
+vhost_tcl_header  (ClientData  clientData,
+                   Tcl_Interp *tcl,
+                   int         objc,
+                   Tcl_Obj    *const objv[])
+{
+  int r, length, i;
+  const char *name, *value;
+  Tcl_Obj *header;
+
+  if(objc != 3) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "name value");
+    return TCL_ERROR;
+  }
+
+  configure_state *cs = clientData;
+
+  name = Tcl_GetStringFromObj(objv[1], &length);
+  for(i = 0; i < length; ++i)
+    if(name[i] <= ' ' || name[i] == ':' || name[i] == 0x7f)
+      break;
+  value = Tcl_GetString(objv[2]);
+  if(!length || i < length || strpbrk(value, "\r\n")) {
+    Tcl_AddErrorInfo(tcl, "invalid header");
+    return TCL_ERROR;
+  }
+
+  if((r = Tcl_DictObjGet(tcl, cs->current, cs->string[cs_header], &header))
+      != TCL_OK)
+    return r;
+  if(!header)
+    header = Tcl_NewObj();
+  else if(Tcl_IsShared(header))
+    header = Tcl_DuplicateObj(header);
+  Tcl_AppendStringsToObj(header, name, ": ", value, "\r\n", NULL);
+
+  Tcl_DictObjPut(tcl, cs->current, cs->string[cs_header], header);
+
+  return TCL_OK;
+}
+
+/* compress types ?level? ?min-size?: compress the responses of the listed
+   content types for the clients accepting it. Kept as a list of the types,
+   the level and the minimum size. */
+static int
+vhost_tcl_compress  (ClientData  clientData,
+                     Tcl_Interp *tcl,
+                     int         objc,
+                     Tcl_Obj    *const objv[])
+{
+  int level = 6, min_size = 1024, n;
+  Tcl_Obj **types;
+
+  if(objc < 2 || objc > 4) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "types ?level? ?min-size?");
+    return TCL_ERROR;
+  }
+
+  configure_state *cs = clientData;
+
+  if(Tcl_ListObjGetElements(tcl, objv[1], &n, &types) != TCL_OK)
+    return TCL_ERROR;
+  if(objc > 2 && (Tcl_GetIntFromObj(tcl, objv[2], &level) != TCL_OK
+                  || level < 1 || level > 9)) {
+    Tcl_AddErrorInfo(tcl, ": invalid compression level");
+    return TCL_ERROR;
+  }
+  if(objc > 3 && (Tcl_GetIntFromObj(tcl, objv[3], &min_size) != TCL_OK
+                  || min_size < 0)) {
+    Tcl_AddErrorInfo(tcl, ": invalid minimum size");
+    return TCL_ERROR;
+  }
+
+  Tcl_Obj *compress[] = {
+    objv[1], Tcl_NewIntObj(level), Tcl_NewIntObj(min_size)
+  };
+  Tcl_DictObjPut(tcl, cs->current, cs->string[cs_compress],
+    Tcl_NewListObj(3, compress));
+
+  return TCL_OK;
+}
+
+/* static prefix docroot: serve the files of docroot under the path prefix,
+   without going through the application. Kept as a list of prefixes and
+   document roots. */
+static int
+vhost_tcl_static  (ClientData  clientData,
+                   Tcl_Interp *tcl,
+                   int         objc,
+                   Tcl_Obj    *const objv[])
+{
+  int r;
+  Tcl_Obj *statics;
+  struct stat st;
+
+  if(objc != 3) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "prefix docroot");
+    return TCL_ERROR;
+  }
+
+  configure_state *cs = clientData;
+
+  if(Tcl_GetString(objv[1])[0] != '/') {
+    Tcl_AppendObjToErrorInfo(tcl, objv[1]);
+    Tcl_AddErrorInfo(tcl, ": prefix doesn't start with a slash.");
+    return TCL_ERROR;
+  }
+  if(stat(Tcl_GetString(objv[2]), &st) || !S_ISDIR(st.st_mode)
+      || Tcl_FSAccess(objv[2], R_OK|X_OK)) {
+    Tcl_AppendObjToErrorInfo(tcl, objv[2]);
+    Tcl_AddErrorInfo(tcl, ": directory not found or insufficient privileges.");
+    return TCL_ERROR;
+  }
+
+  if((r = Tcl_DictObjGet(tcl, cs->current, cs->string[cs_static], &statics))
+      != TCL_OK)
+    return r;
+  if(!statics)
+    statics = Tcl_NewObj();
+  else if(Tcl_IsShared(statics))
+    statics = Tcl_DuplicateObj(statics);
+  Tcl_ListObjAppendElement(tcl, statics, objv[1]);
+  Tcl_ListObjAppendElement(tcl, statics, objv[2]);
+
+  Tcl_DictObjPut(tcl, cs->current, cs->string[cs_static], statics);
+
+  return TCL_OK;
+}
+
+/* spool min-size ?directory?: have payloads of at least min-size bytes
+   written to a file in directory before the payload function is called. Kept as a list of the size and the directory, which defaults to
+   TMPDIR or /tmp. */
+static int
+vhost_tcl_spool  (ClientData  clientData,
+                  Tcl_Interp *tcl,
+                  int         objc,
+                  Tcl_Obj    *const objv[])
+{
+  int min_size;
+  Tcl_Obj *dir;
+  struct stat st;
+
+  if(objc != 2 && objc != 3) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "min-size ?directory?");
+    return TCL_ERROR;
+  }
+
+  configure_state *cs = clientData;
+
+  if(Tcl_GetIntFromObj(tcl, objv[1], &min_size) != TCL_OK || min_size < 0) {
+    Tcl_AddErrorInfo(tcl, ": invalid minimum size");
+    return TCL_ERROR;
+  }
+  if(objc > 2)
+    dir = objv[2];
+  else
+    dir = Tcl_NewStringObj(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", -1);
+  Tcl_IncrRefCount(dir);
+  if(stat(Tcl_GetString(dir), &st) || !S_ISDIR(st.st_mode)
+      || Tcl_FSAccess(dir, W_OK|X_OK)) {
+    Tcl_AppendObjToErrorInfo(tcl, dir);
+    Tcl_AddErrorInfo(tcl, ": directory not found or insufficient privileges.");
+    Tcl_DecrRefCount(dir);
+    return TCL_ERROR;
+  }
+
+  Tcl_Obj *spool[] = {
+    Tcl_NewIntObj(min_size), dir
+  };
+  Tcl_DictObjPut(tcl, cs->current, cs->string[cs_spool],
+    Tcl_NewListObj(2, spool));
+  Tcl_DecrRefCount(dir);
+
+  return TCL_OK;
+}
+
+/* payload-limit max-size: answer payloads of more than max-size bytes with
+   413, before reading any of them if their length is known. */
+static int
+vhost_tcl_payload_limit (ClientData  clientData,
+                         Tcl_Interp *tcl,
+                         int         objc,
+                         Tcl_Obj    *const objv[])
+{
+  Tcl_WideInt max_size;
+
+  if(objc != 2) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "max-size");
+    return TCL_ERROR;
+  }
+
+  configure_state *cs = clientData;
+
+  if(Tcl_GetWideIntFromObj(tcl, objv[1], &max_size) != TCL_OK
+     || max_size < 0) {
+    Tcl_AddErrorInfo(tcl, ": invalid maximum size");
+    return TCL_ERROR;
+  }
+
+  Tcl_DictObjPut(tcl, cs->current, cs->string[cs_payload_limit], objv[1]);
+
+  return TCL_OK;
+}
+
 static int
 minuted_tcl_vhost  (ClientData  clientData,
                     Tcl_Interp *tcl,
@@ -171,6 +384,77 @@ minuted_tcl_listen (ClientData  clientData,
   return r;
 }
 
+static int
+minuted_tcl_workers (ClientData  clientData,
+                     Tcl_Interp *tcl,
+                     int         objc,
+                     Tcl_Obj    *const objv[])
+{
+  static const char *modes[] = {
+    "prefork", "epoll",
+#ifdef MINUTED_URING
+    "io_uring",
+#endif
+    NULL
+  };
+  configure_state *cs = clientData;
+  int mode, processes = cs->conf->processes;
+  int connections = cs->conf->connections;
+
+  if(objc < 2 || objc > 4) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "mode ?processes? ?connections?");
+    return TCL_ERROR;
+  }
+
+  if(Tcl_GetIndexFromObj(tcl, objv[1], modes, "mode", 0, &mode) != TCL_OK)
+    return TCL_ERROR;
+  if(objc > 2 && (Tcl_GetIntFromObj(tcl, objv[2], &processes) != TCL_OK
+                  || processes < 1)) {
+    Tcl_AddErrorInfo(tcl, ": invalid number of processes");
+    return TCL_ERROR;
+  }
+  if(objc > 3 && (Tcl_GetIntFromObj(tcl, objv[3], &connections) != TCL_OK
+                  || connections < 1)) {
+    Tcl_AddErrorInfo(tcl, ": invalid number of connections");
+    return TCL_ERROR;
+  }
+
+  cs->conf->workers = mode;
+  cs->conf->processes = processes;
+  cs->conf->connections = connections;
+  return TCL_OK;
+}
+
+static int
+minuted_tcl_timeout (ClientData  clientData,
+                     Tcl_Interp *tcl,
+                     int         objc,
+                     Tcl_Obj    *const objv[])
+{
+  configure_state *cs = clientData;
+  int timeout, keepalive;
+
+  if(objc < 2 || objc > 3) {
+    Tcl_WrongNumArgs(tcl, 1, objv, "seconds ?keep-alive?");
+    return TCL_ERROR;
+  }
+
+  if(Tcl_GetIntFromObj(tcl, objv[1], &timeout) != TCL_OK || timeout < 1) {
+    Tcl_AddErrorInfo(tcl, ": invalid timeout");
+    return TCL_ERROR;
+  }
+  keepalive = timeout;
+  if(objc > 2 && (Tcl_GetIntFromObj(tcl, objv[2], &keepalive) != TCL_OK
+                  || keepalive < 1)) {
+    Tcl_AddErrorInfo(tcl, ": invalid keep-alive timeout");
+    return TCL_ERROR;
+  }
+
+  cs->conf->timeout = timeout;
+  cs->conf->keepalive = keepalive;
+  return TCL_OK;
+}
+
 /** Function for syntactic suger comment blocks of the configuration.
     In global namespace to allow to be used in any namespace. */
 static int
@@ -209,9 +493,14 @@ minuted_configure_init (Tcl_Interp *tcl)
 
   CREATE_STRING (cs__errorinfo,   "-errorinfo");
   CREATE_STRING (cs_application,  "application");
+  CREATE_STRING (cs_compress,     "compress");
   CREATE_STRING (cs_eval,         "eval");
+  CREATE_STRING (cs_header,       "header");
   CREATE_STRING (cs_namespace,    "namespace");
+  CREATE_STRING (cs_payload_limit, "payload-limit");
   CREATE_STRING (cs_source,       "source");
+  CREATE_STRING (cs_spool,        "spool");
+  CREATE_STRING (cs_static,       "static");
 
   CREATE_STRING (cs_nsMinuted,       "::Minuted");
   CREATE_STRING (cs_nsMinutedVhost,  "::Minuted::Vhost");
@@ -229,7 +518,14 @@ minuted_configure_init (Tcl_Interp *tcl)
   CREATE_COMMAND("disabled", _tcl_comment);
   CREATE_COMMAND("::Minuted::listen", minuted_tcl_listen);
   CREATE_COMMAND("::Minuted::vhost", minuted_tcl_vhost);
+  CREATE_COMMAND("::Minuted::workers", minuted_tcl_workers);
+  CREATE_COMMAND("::Minuted::timeout", minuted_tcl_timeout);
   CREATE_COMMAND("::Minuted::Vhost::application", vhost_tcl_application);
+  CREATE_COMMAND("::Minuted::Vhost::header", vhost_tcl_header);
+  CREATE_COMMAND("::Minuted::Vhost::compress", vhost_tcl_compress);
+  CREATE_COMMAND("::Minuted::Vhost::static", vhost_tcl_static);
+  CREATE_COMMAND("::Minuted::Vhost::spool", vhost_tcl_spool);
+  CREATE_COMMAND("::Minuted::Vhost::payload-limit", vhost_tcl_payload_limit);
 
   return cs;
 }
@@ -260,6 +556,14 @@ minuted_configure  (const char       *filename,
   if(c->listen)
     Tcl_DecrRefCount(c->listen);
 
+  c->workers = workers_prefork;
+  c->processes = sysconf(_SC_NPROCESSORS_ONLN);
+  if(c->processes < 1)
+    c->processes = 1;
+  c->connections = 1024;
+  c->timeout = 60;
+  c->keepalive = 15;
+
   if(! filename)
     return 0;
 
@@ -8,11 +8,33 @@
 
 typedef struct configure_state configure_state;
 
+/* How requests are spread over the worker processes, see the workers
+   command. */
+enum
+minuted_workers
+{
+  /* each worker serves a single connection at a time. */
+  workers_prefork,
+  /* each worker multiplexes many connections using epoll. */
+  workers_epoll,
+  /* likewise, using io_uring; only if built with URING=1. */
+  workers_uring
+};
+
 typedef struct
 configuration
 {
   Tcl_Obj  *vhosts;
   Tcl_Obj  *listen;
+
+  enum
+  minuted_workers workers;
+  /* event workers: the number of processes, and of connections each. */
+  int       processes;
+  int       connections;
+  /* seconds a connection may wait on the client, and between requests. */
+  int       timeout;
+  int       keepalive;
 }
 configuration;
 
@@ -2,6 +2,10 @@
 #include "minuted.h"
 #include "tap.h"
 #include "config.h"
+#include "static.h"
+#ifdef MINUTED_URING
+# include "uring.h"
+#endif
 
 //TODO transitive include?
 #include "libhttp/http.h"
@@ -23,6 +27,7 @@
 #include <mqueue.h>
 #include <signal.h>
 
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -30,9 +35,14 @@
 #include <sys/wait.h>
 
 static const char *s_application = "application";
+static const char *s_compress = "compress";
+static const char *s_header = "header";
 static const char *s_headers = "headers";
 static const char *s_payload = "payload";
 static const char *s_response = "response";
+static const char *s_spool = "spool";
+static const char *s_payload_limit = "payload-limit";
+static const char *s_static = "static";
 
 static const char *s__minuted = "/minuted";
 
@@ -152,13 +162,24 @@ minuted_serve_load (runstate *rs)
   Tcl_Obj *name, *vhost;
   //TODO interned strings.
   Tcl_Obj *application = Tcl_NewStringObj(s_application, -1);
+  Tcl_Obj *header = Tcl_NewStringObj(s_header, -1);
+  Tcl_Obj *compress = Tcl_NewStringObj(s_compress, -1), *o;
+  Tcl_Obj *statics = Tcl_NewStringObj(s_static, -1);
+  Tcl_Obj *spool = Tcl_NewStringObj(s_spool, -1);
+  Tcl_Obj *limit = Tcl_NewStringObj(s_payload_limit, -1);
   Tcl_DictSearch ds;
   int r, i, done, res = 0;
+  Tcl_WideInt max_size;
 
   if(Tcl_DictObjFirst(tcl, c->vhosts, &ds, &name, &vhost, &done) != TCL_OK)
     return -1;
 
   Tcl_IncrRefCount(application);
+  Tcl_IncrRefCount(header);
+  Tcl_IncrRefCount(compress);
+  Tcl_IncrRefCount(statics);
+  Tcl_IncrRefCount(spool);
+  Tcl_IncrRefCount(limit);
 
   for(i = 0; !done; ++i, Tcl_DictObjNext(&ds, &name, &vhost, &done)) {
     Tcl_Obj *app;
@@ -201,12 +222,92 @@ minuted_serve_load (runstate *rs)
         break;
       }
 
+      if(Tcl_DictObjGet(tcl, vhost, header, &rs->tap.v[i].header) != TCL_OK) {
+        res = -1;
+        break;
+      }
+      if(rs->tap.v[i].header)
+        Tcl_IncrRefCount(rs->tap.v[i].header);
+
+      if(Tcl_DictObjGet(tcl, vhost, compress, &o) != TCL_OK) {
+        res = -1;
+        break;
+      }
+      if(o) {
+        // validated by the configuration: types, level and minimum size.
+        Tcl_Obj **list;
+        int n;
+        Tcl_ListObjGetElements(tcl, o, &n, &list);
+        Tcl_IncrRefCount(rs->tap.v[i].compress = list[0]);
+        Tcl_GetIntFromObj(tcl, list[1], &rs->tap.v[i].compress_level);
+        Tcl_GetIntFromObj(tcl, list[2], &rs->tap.v[i].compress_min);
+      }
+
+      if(Tcl_DictObjGet(tcl, vhost, statics, &o) != TCL_OK) {
+        res = -1;
+        break;
+      }
+      if(o) {
+        // pairs of prefixes and document roots.
+        struct tap_static *st;
+        Tcl_Obj **list;
+        int n, j;
+        Tcl_ListObjGetElements(tcl, o, &n, &list);
+        if(!(st = calloc(n/2, sizeof(*st)))) {
+          error("Out of memory");
+          res = -1;
+          break;
+        }
+        for(j = 0; j < n/2; ++j)
+          st[j].root = -1;
+        rs->tap.v[i].statics = st;
+        rs->tap.v[i].nstatic = n/2;
+        for(j = 0; j < n/2; ++j) {
+          Tcl_IncrRefCount(st[j].prefix = list[2*j]);
+          st[j].root = minuted_static_root(Tcl_GetString(list[2*j+1]));
+          if(st[j].root < 0) {
+            error("%s: %s", Tcl_GetString(list[2*j+1]), strerror(errno));
+            res = -1;
+            break;
+          }
+        }
+        if(res)
+          break;
+      }
+
+      if(Tcl_DictObjGet(tcl, vhost, spool, &o) != TCL_OK) {
+        res = -1;
+        break;
+      }
+      if(o) {
+        // validated by the configuration: minimum size and directory.
+        Tcl_Obj **list;
+        int n;
+        Tcl_ListObjGetElements(tcl, o, &n, &list);
+        Tcl_GetIntFromObj(tcl, list[0], &rs->tap.v[i].spool_min);
+        Tcl_IncrRefCount(rs->tap.v[i].spool_dir = list[1]);
+      }
+
+      if(Tcl_DictObjGet(tcl, vhost, limit, &o) != TCL_OK) {
+        res = -1;
+        break;
+      }
+      // validated by the configuration.
+      if(o)
+        Tcl_GetWideIntFromObj(tcl, o, &max_size);
+      rs->tap.v[i].payload_max = o ? max_size : TAP_PAYLOAD_MAX;
+
       rs->tap.v[i].tcl = s;
       Tcl_DictObjPut(tcl, rs->tap.vhostMap, name, Tcl_NewIntObj(i));
       info("Application loaded: %s", Tcl_GetString(app));
     }
   }
 
+  Tcl_DecrRefCount(limit);
+  Tcl_DecrRefCount(spool);
+  Tcl_DecrRefCount(statics);
+  Tcl_DecrRefCount(compress);
+  Tcl_DecrRefCount(header);
   Tcl_DecrRefCount(application);
   return res;
 }
@@ -281,6 +382,868 @@ minuted_serve_processor(runstate *rs,
   return res;
 }
 
+/* A connection served by an epoll worker, the events it waits for, and
+   since when, see minuted_events_now. */
+typedef struct
+minuted_event_conn
+{
+  tap_connection *c;
+  unsigned        events;
+  long            since;
+}
+minuted_event_conn;
+
+/* Seconds on a clock that doesn't jump, for timing out connections. */
+static long
+minuted_events_now (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/* Whether the connection has been waiting on the client for longer than the
+   timeout, or between requests for longer than the keep-alive timeout. */
+static int
+minuted_events_expired (runstate           *rs,
+                        minuted_event_conn *ec,
+                        long                now)
+{
+  configuration *c = rs->tap.c;
+  return now - ec->since >= (minuted_tap_idle(ec->c) ? c->keepalive
+                                                      : c->timeout);
+}
+
+/* Serve the connection until it would block, returning what it's waiting
+   for, or zero once it has been closed. */
+static int
+minuted_events_serve (minuted_event_conn *conns,
+                      int                 slot,
+                      int                *nconns)
+{
+  minuted_event_conn *ec = &conns[slot];
+  int r;
+
+  while((r = minuted_tap_step(ec->c)) == httpd_client_ok_open)
+    ;
+
+  if(r == httpd_client_want_read || r == httpd_client_want_write)
+    return r;
+  minuted_tap_close(ec->c);
+  ec->c = NULL;
+  --*nconns;
+  return 0;
+}
+
+/* Start or stop waiting for connections on the listening sockets. Epoll
+   event data below the number of listening sockets identify the socket,
+   above they identify the connection. */
+static void
+minuted_events_listen (runstate *rs,
+                       int       ep,
+                       int       on)
+{
+  int i;
+  for(i = 0; i < rs->nssocks; ++i) {
+    struct epoll_event ev = {EPOLLIN};
+#ifdef EPOLLEXCLUSIVE
+    // only wake one of the workers for each incoming connection.
+    ev.events |= EPOLLEXCLUSIVE;
+#endif
+    ev.data.u64 = i;
+    if(on)
+      epoll_ctl(ep, EPOLL_CTL_ADD, rs->ssocks[i], &ev);
+    else
+      epoll_ctl(ep, EPOLL_CTL_DEL, rs->ssocks[i], &ev);
+  }
+}
+
+/* Serve the connection until it would block, or is closed. */
+static void
+minuted_events_step (runstate           *rs,
+                     int                 ep,
+                     minuted_event_conn *conns,
+                     int                 slot,
+                     int                *nconns)
+{
+  minuted_event_conn *ec = &conns[slot];
+  // closing the socket takes it out of the epoll set.
+  int r = minuted_events_serve(conns, slot, nconns);
+
+  ec->since = minuted_events_now();
+  if(r) {
+    unsigned events = r == httpd_client_want_read ? EPOLLIN : EPOLLOUT;
+    if(ec->events != events) {
+      struct epoll_event ev = {events};
+      ev.data.u64 = rs->nssocks + slot;
+      ec->events = events;
+      epoll_ctl(ep, EPOLL_CTL_MOD, minuted_tap_socket(ec->c), &ev);
+    }
+  }
+}
+
+/* Accept connections on a listening socket until it would block, or the
+   worker is full. */
+static void
+minuted_events_accept (runstate           *rs,
+                       int                 ep,
+                       int                 listenId,
+                       minuted_event_conn *conns,
+                       int                *nconns)
+{
+  int max = rs->tap.c->connections;
+  int slot = 0;
+  while(*nconns < max) {
+    struct epoll_event ev = {EPOLLIN};
+    int sock = accept(rs->ssocks[listenId], NULL, NULL);
+    if(sock < 0) {
+      if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR
+         && errno != ECONNABORTED)
+        error(strerror(errno));
+      break;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    while(conns[slot].c)
+      ++slot;
+    if(!(conns[slot].c = minuted_tap_open(sock, listenId, &rs->tap))) {
+      error("Unable to allocate connection");
+      close(sock);
+      break;
+    }
+    ++*nconns;
+
+    ev.data.u64 = rs->nssocks + slot;
+    conns[slot].events = EPOLLIN;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev);
+    // the request may well be there already.
+    minuted_events_step(rs, ep, conns, slot, nconns);
+  }
+}
+
+/* Worker multiplexing connections using epoll. Requests are served to
+   completion once read, but waiting for requests, or for the client to
+   accept the end of the response, does not hold up the worker. */
+static int
+minuted_serve_events (runstate *rs)
+{
+  int max = rs->tap.c->connections;
+  minuted_event_conn *conns = calloc(max, sizeof(*conns));
+  struct epoll_event events[64];
+  int i, ep, nconns = 0, listening = 1, res = 0;
+  long now, swept = minuted_events_now();
+
+  if(!conns || 0 > (ep = epoll_create1(EPOLL_CLOEXEC))) {
+    error("Unable to set up event loop: %s", strerror(errno));
+    free(conns);
+    return 5;
+  }
+
+  for(i = 0; i < rs->nssocks; ++i)
+    fcntl(rs->ssocks[i], F_SETFL, fcntl(rs->ssocks[i], F_GETFL) | O_NONBLOCK);
+  minuted_events_listen(rs, ep, 1);
+
+  while(listening || nconns) {
+    // wake up every second to time out the connections.
+    int n = epoll_wait(ep, events, sizeof(events)/sizeof(events[0]),
+                       nconns ? 1000 : 60 * 1000);
+    if(n < 0 && errno != EINTR) {
+      res = 4;
+      break;
+    }
+
+    for(i = 0; i < n; ++i) {
+      int id = events[i].data.u64;
+      if(id < rs->nssocks) {
+        if(listening)
+          minuted_events_accept(rs, ep, id, conns, &nconns);
+      } else if(conns[id - rs->nssocks].c) {
+        minuted_events_step(rs, ep, conns, id - rs->nssocks, &nconns);
+      }
+    }
+
+    // stop accepting once asked to quit, and while full.
+    if(sighup_flag && listening) {
+      debug("SIGHUP received; child");
+      if(listening > 0)
+        minuted_events_listen(rs, ep, 0);
+      listening = 0;
+    } else if(listening > 0 && nconns == max) {
+      minuted_events_listen(rs, ep, 0);
+      listening = -1;
+    } else if(listening < 0 && nconns < max) {
+      minuted_events_listen(rs, ep, 1);
+      listening = 1;
+    }
+    if(!listening) {
+      // finish the requests in progress, but don't wait for new ones.
+      for(i = 0; i < max; ++i) {
+        if(conns[i].c && conns[i].events == EPOLLIN
+           && minuted_tap_idle(conns[i].c)) {
+          minuted_tap_close(conns[i].c);
+          conns[i].c = NULL;
+          --nconns;
+        }
+      }
+    }
+    if((now = minuted_events_now()) != swept) {
+      swept = now;
+      for(i = 0; i < max; ++i) {
+        if(conns[i].c && minuted_events_expired(rs, &conns[i], now)) {
+          minuted_tap_close(conns[i].c);
+          conns[i].c = NULL;
+          --nconns;
+        }
+      }
+    }
+  }
+
+  for(i = 0; i < max; ++i)
+    if(conns[i].c)
+      minuted_tap_close(conns[i].c);
+  close(ep);
+  free(conns);
+  sighup_flag = 0;
+  if(res)
+    error("child exiting: %d", res);
+  return res;
+}
+
+#ifdef MINUTED_URING
+// completions of the listening sockets, and of requests whose outcome we
+// don't care about; the rest are the operation and slot of a connection.
+#define URING_LISTEN  (1ull << 63)
+#define URING_IGNORE  (1ull << 62)
+#define URING_TIMER   (1ull << 61)
+#define URING_RECV    (1ull << 32)
+#define URING_SEND    (2ull << 32)
+#define URING_POLL    (3ull << 32)
+#define URING_OP      (3ull << 32)
+
+// the connection's input is read ahead into a registered buffer, and its
+// output gathered for sending, as libhttpd reuses its buffers on return.
+#define URING_IN_SIZE   0x1000
+#define URING_OUT_SIZE  0x4000
+
+struct minuted_uring_worker;
+
+/* The transport of a connection served by an io_uring worker, doing its I/O
+   through the ring. The slot isn't reused until the requests on the socket
+   have completed, the last of which closes it once the connection has been
+   closed, so the end of the response still goes out. */
+typedef struct
+minuted_uring_io
+{
+  minute_httpd_transport       base;
+  struct minuted_uring_worker *w;
+  int                          slot;
+  int                          sock;
+  // requests in flight, and whether one is a poll.
+  int                          ops;
+  int                          polling;
+  int                          ready;
+
+  char                        *in;
+  unsigned                     in_read;
+  unsigned                     in_write;
+  int                          in_pending;
+  int                          in_eof;
+  int                          in_error;
+
+  // the bytes sent, in sends submitted, and written to the buffer.
+  char                        *out;
+  unsigned                     out_sent;
+  unsigned                     out_queued;
+  unsigned                     out_write;
+  int                          out_inflight;
+  int                          out_error;
+  // the ring's tail after the last send, to link the next one to it.
+  unsigned                     out_tail;
+}
+minuted_uring_io;
+
+typedef struct
+minuted_uring_worker
+{
+  runstate           *rs;
+  minuted_uring       ring;
+  int                 fixed;
+  char               *buffers;
+
+  int                 max;
+  minuted_event_conn *conns;
+  minuted_uring_io   *io;
+  int                 nconns;
+  // closed connections with requests still in flight.
+  int                 lingering;
+  int                 listening;
+  // armed accepts, which hold on to the listening sockets.
+  int                 accepting;
+
+  // slots with completions, to be stepped.
+  int                *ready;
+  int                 nready;
+
+  // a second's timeout, waking the worker to time out the connections.
+  struct __kernel_timespec tick;
+  int                 ticking;
+}
+minuted_uring_worker;
+
+/* Start or stop accepting connections on the listening sockets. */
+static void
+minuted_uring_accept (minuted_uring_worker *w,
+                      int                   on)
+{
+  runstate *rs = w->rs;
+  int i;
+  for(i = 0; i < rs->nssocks; ++i) {
+    struct io_uring_sqe *sqe = minuted_uring_sqe(&w->ring);
+    if(!sqe)
+      break;
+    if(on) {
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = rs->ssocks[i];
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+      sqe->user_data = URING_LISTEN | i;
+      w->accepting++;
+    } else {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = URING_LISTEN | i;
+      sqe->user_data = URING_IGNORE;
+    }
+  }
+}
+
+static void
+minuted_uring_ready (minuted_uring_io *io)
+{
+  if(!io->ready) {
+    io->ready = 1;
+    io->w->ready[io->w->nready++] = io->slot;
+  }
+}
+
+static void
+minuted_uring_cancel (minuted_uring_worker *w,
+                      unsigned long long    data)
+{
+  struct io_uring_sqe *sqe = minuted_uring_sqe(&w->ring);
+  if(sqe) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = URING_IGNORE;
+  }
+}
+
+/* Read ahead as much as fits the buffer. */
+static int
+minuted_uring_recv (minuted_uring_io *io)
+{
+  struct io_uring_sqe *sqe = minuted_uring_sqe(&io->w->ring);
+  if(!sqe)
+    return -1;
+  if(io->w->fixed) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->buf_index = 0;
+  } else {
+    sqe->opcode = IORING_OP_READ;
+  }
+  sqe->fd = io->sock;
+  sqe->addr = (unsigned long) io->in;
+  sqe->len = URING_IN_SIZE;
+  sqe->off = -1;
+  sqe->user_data = URING_RECV | io->slot;
+  io->in_pending = 1;
+  io->ops++;
+  return 0;
+}
+
+/* Send what's been written since the last send. Sends only run alongside
+   each other linked, in the order they were submitted in; otherwise the
+   rest waits for those in flight to complete. */
+static void
+minuted_uring_send (minuted_uring_io *io)
+{
+  minuted_uring *ring = &io->w->ring;
+  struct io_uring_sqe *sqe;
+  int link = io->out_inflight && minuted_uring_linkable(ring, io->out_tail);
+
+  if(io->out_error || io->out_queued == io->out_write
+     || (io->out_inflight && !link))
+    return;
+  if(link)
+    ring->sqes[(io->out_tail - 1) & *ring->sq_mask].flags |= IOSQE_IO_LINK;
+  if(!(sqe = minuted_uring_sqe(ring))) {
+    io->out_error = errno;
+    return;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = io->sock;
+  sqe->addr = (unsigned long) (io->out + io->out_queued);
+  sqe->len = io->out_write - io->out_queued;
+  // a short send breaks the link, and what's left is sent again.
+  sqe->msg_flags = MSG_WAITALL|MSG_NOSIGNAL;
+  sqe->user_data = URING_SEND | io->slot;
+  io->out_tail = *ring->sq_tail;
+  io->out_queued = io->out_write;
+  io->out_inflight++;
+  io->ops++;
+}
+
+static void
+minuted_uring_accepted (minuted_uring_worker *w,
+                        unsigned long long    data,
+                        int                   r,
+                        unsigned              flags)
+{
+  runstate *rs = w->rs;
+  int slot, listenId = data & 0xffff;
+
+  if(r >= 0) {
+    for(slot = 0; slot < w->max && w->io[slot].sock >= 0; ++slot)
+      ;
+    if(w->listening <= 0 || w->nconns == w->max || slot == w->max) {
+      close(r);
+    } else if(!(w->conns[slot].c = minuted_tap_open(r, listenId, &rs->tap))) {
+      error("Unable to allocate connection");
+      close(r);
+    } else {
+      minuted_uring_io *io = &w->io[slot];
+      io->sock = r;
+      io->in_read = io->in_write = io->in_eof = io->in_error = 0;
+      io->out_sent = io->out_queued = io->out_write = io->out_error = 0;
+      minuted_tap_set_transport(w->conns[slot].c, &io->base);
+      w->conns[slot].events = 0;
+      ++w->nconns;
+      minuted_uring_ready(io);
+    }
+  } else if(r != -ECANCELED && r != -EINTR && r != -EAGAIN) {
+    error(strerror(-r));
+  }
+  // the accept is no longer armed; after an error rather than having been
+  // cancelled, arm it again.
+  if(!(flags & IORING_CQE_F_MORE)) {
+    struct io_uring_sqe *sqe;
+    w->accepting--;
+    if(r != -ECANCELED && w->listening > 0
+       && (sqe = minuted_uring_sqe(&w->ring))) {
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = rs->ssocks[listenId];
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+      sqe->user_data = data;
+      w->accepting++;
+    }
+  }
+}
+
+/* Account for a completion. Connections are only marked ready here, and
+   stepped by the worker once the completions have been reaped. */
+static void
+minuted_uring_complete (minuted_uring_worker *w,
+                        unsigned long long    data,
+                        int                   r,
+                        unsigned              flags)
+{
+  minuted_uring_io *io;
+
+  if(data & URING_IGNORE)
+    return;
+  if(data & URING_TIMER) {
+    w->ticking = 0;
+    return;
+  }
+  if(data & URING_LISTEN) {
+    minuted_uring_accepted(w, data, r, flags);
+    return;
+  }
+
+  io = &w->io[data & 0xffffffff];
+  io->ops--;
+  switch(data & URING_OP) {
+    case URING_RECV:
+      io->in_pending = 0;
+      if(r > 0) {
+        io->in_read = 0;
+        io->in_write = r;
+      } else if(!r) {
+        io->in_eof = 1;
+      } else if(r != -ECANCELED) {
+        io->in_error = -r;
+      }
+      break;
+    case URING_SEND:
+      io->out_inflight--;
+      if(r > 0)
+        io->out_sent += r;
+      else if(r < 0 && r != -ECANCELED && !io->out_error)
+        io->out_error = -r;
+      if(!io->out_inflight) {
+        if(io->out_sent == io->out_write) {
+          io->out_sent = io->out_queued = io->out_write = 0;
+        } else {
+          io->out_queued = io->out_sent;
+          minuted_uring_send(io);
+        }
+      }
+      break;
+    case URING_POLL:
+      io->polling = 0;
+      break;
+  }
+
+  if(w->conns[io->slot].c) {
+    minuted_uring_ready(io);
+  } else if(!io->ops) {
+    close(io->sock);
+    io->sock = -1;
+    w->lingering--;
+  }
+}
+
+/* Submit the pending requests, and account for the completions, waiting
+   for one if wait is set. */
+static int
+minuted_uring_reap (minuted_uring_worker *w,
+                    unsigned              wait)
+{
+  struct io_uring_cqe *cqe;
+
+  if(minuted_uring_submit(&w->ring, wait) < 0 && errno != EINTR)
+    return -1;
+  while((cqe = minuted_uring_cqe(&w->ring))) {
+    unsigned long long data = cqe->user_data;
+    int r = cqe->res;
+    unsigned flags = cqe->flags;
+    minuted_uring_seen(&w->ring);
+    minuted_uring_complete(w, data, r, flags);
+  }
+  return 0;
+}
+
+#define uring_io(t) ((minuted_uring_io*) (t))
+
+static int
+minuted_uring_readv (int fd, const struct iovec *iov, int count,
+                     minute_httpd_transport *t)
+{
+  minuted_uring_io *io = uring_io(t);
+  int i, r = 0;
+
+  if(io->in_read < io->in_write) {
+    for(i = 0; i < count && io->in_read < io->in_write; ++i) {
+      unsigned n = io->in_write - io->in_read;
+      if(n > iov[i].iov_len)
+        n = iov[i].iov_len;
+      memcpy(iov[i].iov_base, io->in + io->in_read, n);
+      io->in_read += n;
+      r += n;
+    }
+    return r;
+  }
+  if(io->in_eof)
+    return 0;
+  if(io->in_error) {
+    errno = io->in_error;
+    return -1;
+  }
+  if(!io->in_pending && minuted_uring_recv(io))
+    return -1;
+  errno = EAGAIN;
+  return -1;
+}
+
+static int
+minuted_uring_writev (int fd, const struct iovec *iov, int count,
+                      minute_httpd_transport *t)
+{
+  minuted_uring_io *io = uring_io(t);
+  int i, r = 0;
+
+  if(io->out_error) {
+    errno = io->out_error;
+    return -1;
+  }
+  for(i = 0; i < count && io->out_write < URING_OUT_SIZE; ++i) {
+    unsigned n = URING_OUT_SIZE - io->out_write;
+    if(n > iov[i].iov_len)
+      n = iov[i].iov_len;
+    memcpy(io->out + io->out_write, iov[i].iov_base, n);
+    io->out_write += n;
+    r += n;
+  }
+  if(!r && i < count) {
+    errno = EAGAIN;
+    return -1;
+  }
+  minuted_uring_send(io);
+  return r;
+}
+
+/* The file goes straight to the socket once what's been written before it
+   has been sent. */
+static int
+minuted_uring_sendfile (int fd, int file, unsigned long long *offset,
+                        unsigned count, minute_httpd_transport *t)
+{
+  minuted_uring_io *io = uring_io(t);
+  minute_httpd_transport *ft = &minute_httpd_fd_transport;
+
+  if(io->out_error) {
+    errno = io->out_error;
+    return -1;
+  }
+  if(io->out_inflight) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return ft->sendfile(io->sock, file, offset, count, ft);
+}
+
+static void
+minuted_uring_cork (int fd, int on, minute_httpd_transport *t)
+{
+  minute_httpd_transport *ft = &minute_httpd_fd_transport;
+  ft->cork(uring_io(t)->sock, on, ft);
+}
+
+/* The connections are only ever stepped, being woken by the completion of
+   the request the transport made, or by polling the socket; waiting on one
+   of them would hold up the rest. */
+static int
+minuted_uring_wait (int fd, short events, minute_httpd_transport *t)
+{
+  errno = EWOULDBLOCK;
+  return -1;
+}
+
+/* Stop writing on failure; the socket is closed by the worker. */
+static int
+minuted_uring_close (int fd, minute_httpd_transport *t)
+{
+  minuted_uring_io *io = uring_io(t);
+  if(!io->out_error)
+    io->out_error = EPIPE;
+  return 0;
+}
+
+/* Payloads are read through the buffer, as read ahead, rather than spliced
+   from the socket. */
+static const minute_httpd_transport minuted_uring_transport = {
+  minuted_uring_readv,
+  minuted_uring_writev,
+  minuted_uring_sendfile,
+  NULL,
+  minuted_uring_cork,
+  minuted_uring_wait,
+  minuted_uring_close
+};
+
+/* Free the connection, cancelling the requests which could wait forever;
+   the socket is closed once the rest have completed. */
+static void
+minuted_uring_close_conn (minuted_uring_worker *w,
+                          int                   slot)
+{
+  minuted_uring_io *io = &w->io[slot];
+
+  minuted_tap_release(w->conns[slot].c);
+  w->conns[slot].c = NULL;
+  --w->nconns;
+  if(io->in_pending)
+    minuted_uring_cancel(w, URING_RECV | slot);
+  if(io->polling)
+    minuted_uring_cancel(w, URING_POLL | slot);
+  if(io->ops) {
+    w->lingering++;
+  } else {
+    close(io->sock);
+    io->sock = -1;
+  }
+}
+
+/* Serve the connection until it would block. It's woken by the completion
+   of the request the transport made, or else by polling the socket. */
+static void
+minuted_uring_step (minuted_uring_worker *w,
+                    int                   slot)
+{
+  minuted_uring_io *io = &w->io[slot];
+  struct io_uring_sqe *sqe;
+  int r;
+
+  while((r = minuted_tap_step(w->conns[slot].c)) == httpd_client_ok_open)
+    ;
+
+  w->conns[slot].since = minuted_events_now();
+  if(r != httpd_client_want_read && r != httpd_client_want_write) {
+    minuted_uring_close_conn(w, slot);
+    return;
+  }
+  w->conns[slot].events = r == httpd_client_want_read ? POLLIN : POLLOUT;
+  if(io->polling
+     || (r == httpd_client_want_read ? io->in_pending : io->out_inflight))
+    return;
+  if(!(sqe = minuted_uring_sqe(&w->ring))) {
+    error("Unable to poll connection: %s", strerror(errno));
+    minuted_uring_close_conn(w, slot);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = io->sock;
+  sqe->poll32_events = w->conns[slot].events;
+  sqe->user_data = URING_POLL | slot;
+  io->polling = 1;
+  io->ops++;
+}
+
+/* Have the worker woken in a second, to time out the connections. */
+static void
+minuted_uring_tick (minuted_uring_worker *w)
+{
+  struct io_uring_sqe *sqe = minuted_uring_sqe(&w->ring);
+  if(sqe) {
+    w->tick.tv_sec = 1;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long) &w->tick;
+    sqe->len = 1;
+    sqe->user_data = URING_TIMER;
+    w->ticking = 1;
+  }
+}
+
+/* Worker multiplexing connections like minuted_serve_events, but doing all
+   of its I/O using io_uring: connections are accepted using multishot
+   accept, read into registered buffers, and written using sends linked
+   together, all submitted along with the wait for the next completions in
+   a single system call. */
+static int
+minuted_serve_uring (runstate *rs)
+{
+  minuted_uring_worker w = {rs};
+  int i, res = 0;
+  long now, swept = minuted_events_now();
+
+  w.max = rs->tap.c->connections;
+  w.conns = calloc(w.max, sizeof(*w.conns));
+  w.io = calloc(w.max, sizeof(*w.io));
+  w.ready = calloc(w.max, sizeof(*w.ready));
+  w.buffers = malloc((unsigned long) w.max
+                     * (URING_IN_SIZE + URING_OUT_SIZE));
+  if(!w.conns || !w.io || !w.ready || !w.buffers
+     || minuted_uring_init(&w.ring, 256)) {
+    error("Unable to set up io_uring: %s", strerror(errno));
+    free(w.buffers);
+    free(w.ready);
+    free(w.io);
+    free(w.conns);
+    return 5;
+  }
+  // registering pins the input buffers, which the memory lock limit may not
+  // allow for; plain reads into them will do then.
+  w.fixed = !minuted_uring_register(&w.ring, w.buffers,
+                                    (unsigned long) w.max * URING_IN_SIZE);
+  if(!w.fixed)
+    info("Unable to register io_uring buffers: %s", strerror(errno));
+  for(i = 0; i < w.max; ++i) {
+    w.io[i].base = minuted_uring_transport;
+    w.io[i].w = &w;
+    w.io[i].slot = i;
+    w.io[i].sock = -1;
+    w.io[i].in = w.buffers + (unsigned long) i * URING_IN_SIZE;
+    w.io[i].out = w.buffers + (unsigned long) w.max * URING_IN_SIZE
+                + (unsigned long) i * URING_OUT_SIZE;
+  }
+
+  w.listening = 1;
+  minuted_uring_accept(&w, 1);
+
+  // the listening sockets are only let go of once the accepts are done, so
+  // that they can be bound again on reload.
+  while(w.listening || w.nconns || w.lingering || w.accepting) {
+    if(w.nconns && !w.ticking)
+      minuted_uring_tick(&w);
+    if(minuted_uring_reap(&w, 1)) {
+      res = 4;
+      break;
+    }
+
+    while(w.nready) {
+      int slot = w.ready[--w.nready];
+      w.io[slot].ready = 0;
+      if(w.conns[slot].c)
+        minuted_uring_step(&w, slot);
+    }
+
+    // stop accepting once asked to quit, and while full.
+    if(sighup_flag && w.listening) {
+      debug("SIGHUP received; child");
+      if(w.listening > 0)
+        minuted_uring_accept(&w, 0);
+      w.listening = 0;
+    } else if(w.listening > 0 && w.nconns == w.max) {
+      minuted_uring_accept(&w, 0);
+      w.listening = -1;
+    } else if(w.listening < 0 && w.nconns < w.max) {
+      minuted_uring_accept(&w, 1);
+      w.listening = 1;
+    }
+    if(!w.listening) {
+      // finish the requests in progress, but don't wait for new ones.
+      for(i = 0; i < w.max; ++i)
+        if(w.conns[i].c && w.conns[i].events == POLLIN
+           && minuted_tap_idle(w.conns[i].c))
+          minuted_uring_close_conn(&w, i);
+    }
+    if((now = minuted_events_now()) != swept) {
+      swept = now;
+      for(i = 0; i < w.max; ++i)
+        if(w.conns[i].c && minuted_events_expired(rs, &w.conns[i], now))
+          minuted_uring_close_conn(&w, i);
+    }
+  }
+
+  for(i = 0; i < w.max; ++i)
+    if(w.conns[i].c)
+      minuted_tap_release(w.conns[i].c);
+  // the ring goes first, as its requests hold on to the sockets.
+  minuted_uring_exit(&w.ring);
+  for(i = 0; i < w.max; ++i)
+    if(w.io[i].sock >= 0)
+      close(w.io[i].sock);
+  free(w.buffers);
+  free(w.ready);
+  free(w.io);
+  free(w.conns);
+  sighup_flag = 0;
+  if(res)
+    error("child exiting: %d", res);
+  return res;
+}
+#endif
+
+/* Serve requests in a worker process, the way the configuration says. */
+static int
+minuted_serve_worker (runstate *rs,
+                      sem_t    *sem)
+{
+  switch(rs->tap.c->workers) {
+    case workers_epoll:
+      return minuted_serve_events(rs);
+#ifdef MINUTED_URING
+    case workers_uring:
+      return minuted_serve_uring(rs);
+#endif
+    default:
+      return minuted_serve_processor(rs, sem);
+  }
+}
+
 typedef struct
 minuted_forks
 {
@@ -304,7 +1267,7 @@ minuted_fork       (minuted_forks *forks,
   } else if(0 == (pid = fork())) {
     signal(SIGPIPE, SIG_IGN);
     static_log_mqd = mqd;
-    int r = minuted_serve_processor(rs, sem);
+    int r = minuted_serve_worker(rs, sem);
     static_log_mqd = -1;
     sem_close(sem);
     mq_close(mqd);
@@ -468,7 +1431,7 @@ minuted_serve_single   (runstate *rs)
   signal(SIGPIPE, SIG_IGN);
 
   while(!sighup_flag && !sigterm_flag) {
-    minuted_serve_processor(rs, sem);
+    minuted_serve_worker(rs, sem);
   }
 
   sem_close(sem);
@@ -488,6 +1451,11 @@ minuted_serve_prefork  (runstate *rs)
   int max_spares = 6;
   int init_forks = 6;
 
+  // event workers don't report their connections, thus the number of
+  // processes stays as configured.
+  if(rs->tap.c->workers != workers_prefork)
+    max_forks = init_forks = rs->tap.c->processes;
+
   int serving = 0;
 
   minuted_forks forks = {max_forks};
@@ -660,7 +1628,7 @@ minuted_serve_prefork  (runstate *rs)
 int
 minuted_serve  (configuration *c, Tcl_Interp *tcl)
 {
-  int i, r, res = -1;
+  int i, j, r, res = -1;
   runstate rstate = {{tcl, c}};
   runstate *rs = &rstate;
 
@@ -694,9 +1662,24 @@ minuted_serve  (configuration *c, Tcl_Interp *tcl)
 
   Tcl_DecrRefCount(rs->tap.vhostMap);
 
-  for(i = 0; i < rs->tap.nv; ++i)
+  minuted_static_clear();
+  for(i = 0; i < rs->tap.nv; ++i) {
     if(rs->tap.v[i].tcl != 0)
       Tcl_DeleteInterp(rs->tap.v[i].tcl);
+    if(rs->tap.v[i].header)
+      Tcl_DecrRefCount(rs->tap.v[i].header);
+    if(rs->tap.v[i].compress)
+      Tcl_DecrRefCount(rs->tap.v[i].compress);
+    if(rs->tap.v[i].spool_dir)
+      Tcl_DecrRefCount(rs->tap.v[i].spool_dir);
+    for(j = 0; j < rs->tap.v[i].nstatic; ++j) {
+      if(rs->tap.v[i].statics[j].prefix)
+        Tcl_DecrRefCount(rs->tap.v[i].statics[j].prefix);
+      if(rs->tap.v[i].statics[j].root >= 0)
+        close(rs->tap.v[i].statics[j].root);
+    }
+    free(rs->tap.v[i].statics);
+  }
 
   for(i = 0; i < rs->nssocks; ++i)
     if(rs->ssocks[i] >= 0)
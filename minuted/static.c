@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include "static.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef SYS_openat2
+# include <linux/openat2.h>
+#endif
+
+/* The number of open files kept, and how often a cached file is checked
+   against the file system, in seconds. */
+#define STATIC_CACHE_SIZE 256
+#define STATIC_HASH_SIZE  512
+#define STATIC_CHECK_INTERVAL 1
+
+typedef struct static_entry static_entry;
+struct
+static_entry
+{
+  minuted_static_file  file;
+
+  int                  root;
+  char                *path;
+  unsigned             hash;
+  /* what the file was when opened, and when that was last checked. */
+  dev_t                dev;
+  ino_t                ino;
+  struct timespec      mtime;
+  time_t               checked;
+
+  /* the number of requests using the file; it's not closed until they're
+     done, even if dropped from the cache. */
+  unsigned             users;
+  int                  dropped;
+
+  static_entry        *chain;
+  static_entry        *newer;
+  static_entry        *older;
+};
+
+static static_entry *static_buckets[STATIC_HASH_SIZE];
+static static_entry *static_newest;
+static static_entry *static_oldest;
+static unsigned      static_count;
+
+static const struct {
+  const char *extension;
+  const char *type;
+} static_types[] = {
+  { "css",   "text/css" },
+  { "gif",   "image/gif" },
+  { "htm",   "text/html" },
+  { "html",  "text/html" },
+  { "ico",   "image/x-icon" },
+  { "jpeg",  "image/jpeg" },
+  { "jpg",   "image/jpeg" },
+  { "js",    "text/javascript" },
+  { "json",  "application/json" },
+  { "mjs",   "text/javascript" },
+  { "mp4",   "video/mp4" },
+  { "pdf",   "application/pdf" },
+  { "png",   "image/png" },
+  { "svg",   "image/svg+xml" },
+  { "txt",   "text/plain" },
+  { "wasm",  "application/wasm" },
+  { "webp",  "image/webp" },
+  { "woff",  "font/woff" },
+  { "woff2", "font/woff2" },
+  { "xml",   "application/xml" }
+};
+
+static const char*
+static_type (const char *path)
+{
+  const char *dot = strrchr (path, '.');
+  unsigned i;
+  if (dot && !strchr (dot, '/'))
+    for (i = 0; i < sizeof(static_types)/sizeof(static_types[0]); ++i)
+      if (!strcasecmp (dot+1, static_types[i].extension))
+        return static_types[i].type;
+  return "application/octet-stream";
+}
+
+/* Non-zero if none of the segments of path are . or .., which could lead
+   out of the root. */
+static int
+static_safe (const char *path)
+{
+  while (*path) {
+    size_t n = strcspn (path, "/");
+    if (path[0] == '.' && (n == 1 || (n == 2 && path[1] == '.')))
+      return 0;
+    path += n;
+    path += *path == '/';
+  }
+  return 1;
+}
+
+static unsigned
+static_hash (int root, const char *path)
+{
+  unsigned h = 2166136261u ^ root;
+  while (*path)
+    h = (h ^ (unsigned char) *path++) * 16777619u;
+  return h;
+}
+
+/* Open path beneath root; where the kernel can't be told to keep the lookup
+   beneath the root, symbolic links are followed wherever they lead. */
+static int
+static_openat (int root, const char *path)
+{
+#ifdef SYS_openat2
+  struct open_how how;
+  int fd;
+  memset (&how, 0, sizeof(how));
+  how.flags = O_RDONLY|O_CLOEXEC;
+  how.resolve = RESOLVE_BENEATH|RESOLVE_NO_MAGICLINKS;
+  if (0 <= (fd = syscall (SYS_openat2, root, path, &how, sizeof(how)))
+      || errno != ENOSYS)
+    return fd;
+#endif
+  return openat (root, path, O_RDONLY|O_CLOEXEC);
+}
+
+static void
+static_free (static_entry *e)
+{
+  close (e->file.fd);
+  free (e->path);
+  free (e);
+}
+
+static void
+static_unlink (static_entry *e)
+{
+  if (e->newer)
+    e->newer->older = e->older;
+  else
+    static_newest = e->older;
+  if (e->older)
+    e->older->newer = e->newer;
+  else
+    static_oldest = e->newer;
+  e->newer = e->older = NULL;
+}
+
+static void
+static_link (static_entry *e)
+{
+  e->older = static_newest;
+  if (static_newest)
+    static_newest->newer = e;
+  else
+    static_oldest = e;
+  static_newest = e;
+}
+
+/* Drop the entry from the cache, closing the file unless it's in use. */
+static void
+static_drop (static_entry *e)
+{
+  static_entry **p = &static_buckets[e->hash % STATIC_HASH_SIZE];
+  while (*p != e)
+    p = &(*p)->chain;
+  *p = e->chain;
+  static_unlink (e);
+  static_count--;
+  if (e->users)
+    e->dropped = 1;
+  else
+    static_free (e);
+}
+
+static static_entry*
+static_load (int root, const char *path, unsigned hash, time_t now)
+{
+  static_entry *e, *old;
+  struct stat st;
+  int fd;
+
+  if (0 > (fd = static_openat (root, path)))
+    return NULL;
+  if (fstat (fd, &st))
+    st.st_mode = 0;
+  if (!S_ISREG(st.st_mode)) {
+    int err = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+    close (fd);
+    errno = err;
+    return NULL;
+  }
+  if (!(e = calloc (1, sizeof(*e))) || !(e->path = strdup (path))) {
+    free (e);
+    close (fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  e->file.fd = fd;
+  e->file.size = st.st_size;
+  e->file.last_modified = st.st_mtime;
+  snprintf (e->file.etag, sizeof(e->file.etag), "\"%llx-%llx-%llx\"",
+            (unsigned long long) st.st_ino, (unsigned long long) st.st_size,
+            (unsigned long long) st.st_mtim.tv_sec * 1000000000ull
+                                 + st.st_mtim.tv_nsec);
+  e->file.type = static_type (path);
+  e->root = root;
+  e->hash = hash;
+  e->dev = st.st_dev;
+  e->ino = st.st_ino;
+  e->mtime = st.st_mtim;
+  e->checked = now;
+
+  // make room, passing over the files in use.
+  for (old = static_oldest; old && static_count >= STATIC_CACHE_SIZE; ) {
+    static_entry *newer = old->newer;
+    if (!old->users)
+      static_drop (old);
+    old = newer;
+  }
+
+  e->chain = static_buckets[hash % STATIC_HASH_SIZE];
+  static_buckets[hash % STATIC_HASH_SIZE] = e;
+  static_link (e);
+  static_count++;
+  return e;
+}
+
+int
+minuted_static_root (const char *docroot)
+{
+  return open (docroot, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+}
+
+minuted_static_file*
+minuted_static_open (int root, const char *path)
+{
+  char index[PATH_MAX];
+  static_entry *e;
+  unsigned hash;
+  time_t now = time (NULL);
+  const char *slash = path;
+  size_t n;
+
+  while (*path == '/')
+    path++;
+  n = strlen (path);
+  if (!n && path == slash) {
+    errno = EISDIR;
+    return NULL;
+  }
+  if (!n || path[n-1] == '/') {
+    if (n + sizeof("index.html") > sizeof(index)) {
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+    memcpy (index, path, n);
+    memcpy (index+n, "index.html", sizeof("index.html"));
+    path = index;
+  }
+  if (!static_safe (path)) {
+    errno = EACCES;
+    return NULL;
+  }
+
+  hash = static_hash (root, path);
+  for (e = static_buckets[hash % STATIC_HASH_SIZE]; e; e = e->chain)
+    if (e->hash == hash && e->root == root && !strcmp (e->path, path))
+      break;
+
+  // a file replaced or changed since it was opened is opened anew.
+  if (e && now - e->checked >= STATIC_CHECK_INTERVAL) {
+    struct stat st;
+    if (fstatat (root, path, &st, 0) || st.st_dev != e->dev
+        || st.st_ino != e->ino || st.st_size != e->file.size
+        || st.st_mtim.tv_sec != e->mtime.tv_sec
+        || st.st_mtim.tv_nsec != e->mtime.tv_nsec) {
+      static_drop (e);
+      e = NULL;
+    } else {
+      e->checked = now;
+    }
+  }
+
+  if (!e && !(e = static_load (root, path, hash, now)))
+    return NULL;
+
+  static_unlink (e);
+  static_link (e);
+  e->users++;
+  return &e->file;
+}
+
+void
+minuted_static_clear (void)
+{
+  while (static_oldest)
+    static_drop (static_oldest);
+}
+
+void
+minuted_static_release (minuted_static_file *file)
+{
+  static_entry *e = (static_entry*) file;
+  if (!--e->users && e->dropped)
+    static_free (e);
+}
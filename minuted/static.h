@@ -0,0 +1,40 @@
+#ifndef __MINUTED_STATIC_H__
+#define __MINUTED_STATIC_H__
+
+#include <sys/types.h>
+
+/* Files served straight from a document root, without going through the
+   application. Open files are kept in a bounded cache, most recently used
+   first, along with what's known about them, so that a popular file costs
+   neither an open nor a stat per request. Each worker process has a cache
+   of its own. */
+typedef struct
+minuted_static_file
+{
+  int          fd;
+  off_t        size;
+  unsigned     last_modified;
+  /* the entity tag, quotes included. */
+  char         etag[48];
+  /* the content type, going by the extension. */
+  const char  *type;
+}
+minuted_static_file;
+
+/* Open a document root, returning the directory descriptor or -1. */
+int   minuted_static_root    (const char          *docroot);
+
+/* Open the file at path, relative to the document root given as a directory
+   descriptor, refusing paths leading out of it. A path ending in a slash
+   names the index.html of the directory. Returns NULL with errno set on
+   failure; EISDIR if the path is a directory. The file stays valid until
+   released, whatever else is opened in the meantime. */
+minuted_static_file*
+      minuted_static_open    (int                  root,
+                              const char          *path);
+void  minuted_static_release (minuted_static_file *file);
+
+/* Close the cached files, as the document roots are about to be. */
+void  minuted_static_clear   (void);
+
+#endif /* idempotent include guard */
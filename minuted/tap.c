@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
+
 #include "tap.h"
 #include "config.h"
 #include "main.h"
+#include "static.h"
 
 #include "libhttp/http.h"
 #include "libhttp/http-headers.h"
@@ -9,10 +12,16 @@
 #include "libhttpd/httpd.h"
 
 #include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <strings.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 
 typedef struct tap_runtime tap_runtime;
@@ -35,6 +44,15 @@ tap_rq_data
 
   // set by head()
   tap_vhost    *vhost;
+  // served from a document root, see tap_static_head.
+  int           native;
+  minuted_static_file *file;
+  // the payload, spooled to a file by tap_spool, or else read into memory
+  // by tap_buffer, as it arrives.
+  Tcl_Obj      *o_spool;
+  int           spool;
+  unsigned long long spooled;
+  Tcl_Obj      *o_payload;
   Tcl_Obj      *o_path;
   Tcl_Obj      *o_query;
   Tcl_Obj      *o_host;
@@ -67,6 +85,8 @@ typedef struct
 tap_request_resp
 {
   tap_request_base    base;
+  minute_httpd_out   *out;
+  Tcl_Channel         channel;
 }
 tap_request_resp;
 
@@ -74,6 +94,9 @@ typedef struct
 {
   minute_httpd_in *in;
   minute_httpd_out *out;
+  // the payload read into memory, read rather than in if set.
+  const unsigned char *data;
+  int length;
 }
 minuted_tap_channel;
 
@@ -81,8 +104,8 @@ static int
 minuted_tap_close_proc   (ClientData  instanceData,
                           Tcl_Interp *tcl)
 {
-  minuted_tap_channel *ch = instanceData;
-  ch->out->flush(ch->out);
+  // what's left in the output buffer is written once the response function
+  // returns, flushing it here would rule out a Content-Length.
   return 0;
 }
 
@@ -100,7 +123,17 @@ minuted_tap_input_proc   (ClientData  instanceData,
                           int        *errorCodePtr)
 {
   minuted_tap_channel *ch = instanceData;
-  return ch->in->read(buf, toWrite, ch->in);
+  int r;
+  if(ch->data) {
+    r = toWrite < ch->length ? toWrite : ch->length;
+    memcpy(buf, ch->data, r);
+    ch->data += r;
+    ch->length -= r;
+    return r;
+  }
+  if(0 > (r = ch->in->read(buf, toWrite, ch->in)))
+    *errorCodePtr = errno;
+  return r;
 }
 
 static int
@@ -201,20 +234,21 @@ minuted_tap_binary_search(const char *s, const char *ls[], int sz)
   return -1;
 }
 
+/* The response header names aren't sorted, and are few. */
 static enum http_response_header
 minuted_tap_response_header(const char *name)
 {
-  int h = minuted_tap_binary_search(name, http_response_header_names,
-    http_response_header_names_count);
-  return h > 0 ? (enum http_response_header) h : http_rsp_unknown_header;
+  int h;
+  for(h = 1; h < http_response_header_names_count; ++h)
+    if(!strcasecmp(name, http_response_header_names[h]))
+      return (enum http_response_header) h;
+  return http_rsp_unknown_header;
 }
 
 static enum http_request_header
 minuted_tap_request_header(const char *name)
 {
-  int h = minuted_tap_binary_search(name, http_request_header_names,
-    http_request_header_names_count);
-  return h > 0 ? (enum http_request_header) h : http_rq_unknown_header;
+  return (enum http_request_header) minute_http_header_id(name);
 }
 
 /* reset rqd for next request. */
@@ -222,12 +256,26 @@ static void
 minuted_tap_reset (tap_rq_data *rqd)
 {
   rqd->vhost = NULL;
+  rqd->native = 0;
+  if(rqd->file) {
+    minuted_static_release(rqd->file);
+    rqd->file = NULL;
+  }
+  if(rqd->o_spool) {
+    unlink(Tcl_GetString(rqd->o_spool));
+    if(rqd->spool >= 0)
+      close(rqd->spool);
+  }
+  rqd->spool = -1;
+  rqd->spooled = 0;
 
   rqd->method = http_unknown_method;
   rqd->code   = 0;
 
   Tcl_Obj **refs[] = {
     &rqd->status,
+    &rqd->o_spool,
+    &rqd->o_payload,
     &rqd->o_path,
     &rqd->o_query,
     &rqd->o_host
@@ -270,6 +318,129 @@ minuted_tap_status (tap_rq_data *rqd)
   return res;
 }
 
+static void
+tap_accept_encoding  (tap_request_base    *trq,
+                      minute_http_codings *codings);
+
+/* Compress the response if its content type is one of those listed for the
+   vhost, a subtype of * matching any, and the client prefers gzip or deflate
+   to identity. Returns the coding, identity if the response is sent as is. */
+static enum http_content_coding
+tap_compress         (tap_request_head *trq,
+                      const char       *type)
+{
+  tap_vhost *v = trq->base.rqd->vhost;
+  minute_http_codings codings;
+  enum http_content_coding ranked[http_coding_count];
+  Tcl_Obj **types;
+  int n, i, length, tl;
+
+  if(!v->compress
+     || Tcl_ListObjGetElements(NULL, v->compress, &n, &types) != TCL_OK)
+    return http_coding_identity;
+
+  tl = strcspn(type, "; \t");
+  for(i = 0; i < n; ++i) {
+    const char *t = Tcl_GetStringFromObj(types[i], &length);
+    if(length > 1 && t[length-1] == '*' && t[length-2] == '/'
+        ? length-1 <= tl && !strncasecmp(t, type, length-1)
+        : length == tl && !strncasecmp(t, type, length))
+      break;
+  }
+  if(i == n)
+    return http_coding_identity;
+
+  trq->head->string(http_rsp_vary, "Accept-Encoding", trq->head);
+  tap_accept_encoding(&trq->base, &codings);
+  if(!minute_http_codings_rank(&codings, MINUTE_HTTP_CODING(http_coding_gzip)
+       | MINUTE_HTTP_CODING(http_coding_deflate)
+       | MINUTE_HTTP_CODING(http_coding_identity), ranked)
+     || ranked[0] == http_coding_identity
+     || trq->head->encode(ranked[0], v->compress_level, v->compress_min,
+                          trq->head))
+    return http_coding_identity;
+  return ranked[0];
+}
+
+/* Serve the request from a document root of the vhost, if the path is
+   under one of the prefixes; zero if it isn't. */
+static unsigned
+tap_static_head      (tap_request_head *trq,
+                      Tcl_Obj          *o_path)
+{
+  tap_vhost *v = trq->base.rqd->vhost;
+  minute_httpd_head *head = trq->head;
+  minuted_static_file *file;
+  int i, length, path_length;
+  enum http_content_coding coding;
+  char etag[sizeof(file->etag)+8];
+  const char *prefix, *path = Tcl_GetStringFromObj(o_path, &path_length);
+
+  for(i = 0; i < v->nstatic; ++i) {
+    prefix = Tcl_GetStringFromObj(v->statics[i].prefix, &length);
+    if(!strncmp(path, prefix, length) && (prefix[length-1] == '/'
+        || path[length] == '/' || !path[length]))
+      break;
+  }
+  if(i == v->nstatic)
+    return 0;
+
+  switch(trq->base.rq->request_method) {
+    case http_get:
+    case http_head:
+      break;
+    default:
+      head->string(http_rsp_allow, "GET, HEAD", head);
+      return http_method_not_allowed;
+  }
+  // an escaped NUL would cut the path short.
+  if(strlen(path) != (size_t) path_length)
+    return http_not_found;
+
+  if(!(file = minuted_static_open(v->statics[i].root, path + length))) {
+    switch(errno) {
+      case EISDIR:
+        for(i = 0; path[i] && (unsigned char) path[i] >= ' '; ++i)
+          ;
+        if(path[i] || path_length > 4000)
+          return http_not_found;
+        Tcl_Obj *location = Tcl_ObjPrintf("%s/", path);
+        Tcl_IncrRefCount(location);
+        head->string(http_rsp_location, Tcl_GetString(location), head);
+        Tcl_DecrRefCount(location);
+        return http_moved_permanently;
+      case ENOENT:
+      case ENOTDIR:
+      case ENAMETOOLONG:
+        return http_not_found;
+      case EACCES:
+      case EPERM:
+      case EXDEV:
+      case ELOOP:
+        return http_forbidden;
+      default:
+        error("%s: %s", path, strerror(errno));
+        return 500;
+    }
+  }
+
+  trq->base.rqd->file = file;
+  head->string(http_rsp_content_type, file->type, head);
+  if((coding = tap_compress(trq, file->type)) != http_coding_identity) {
+    // the compressed body is a different representation, with a tag of
+    // its own.
+    length = strlen(file->etag);
+    snprintf(etag, sizeof(etag), "%.*s-%s\"", length-1, file->etag,
+             minute_http_coding_text(coding));
+    head->validators(etag, file->last_modified, head);
+  } else {
+    head->validators(file->etag, file->last_modified, head);
+    snprintf(etag, sizeof(etag), "%llu", (unsigned long long) file->size);
+    head->string(http_rsp_content_length, etag, head);
+  }
+  return 200;
+}
+
 static int
 tap_tcl_add_header   (tap_request_head *trq,
                       Tcl_Interp       *tcl,
@@ -284,6 +455,10 @@ tap_tcl_add_header   (tap_request_head *trq,
     case http_rsp_unknown_header:
       Tcl_AddErrorInfo(tcl, "unknown header");
       return TCL_ERROR;
+    case http_rsp_content_type:
+      trq->head->string(h, Tcl_GetString(value), trq->head);
+      tap_compress(trq, Tcl_GetString(value));
+      break;
     // TODO handle timestamps.
     default:
       trq->head->string(h, Tcl_GetString(value), trq->head);
@@ -302,9 +477,14 @@ tap_tcl_get_header   (tap_request_base *trq,
 
   switch(h) {
     case http_rq_unknown_header:
-      Tcl_AddErrorInfo(tcl, "unknown header");
-      return TCL_ERROR;
-
+    {
+      unsigned length;
+      const char *value = minute_http_unknown_header(Tcl_GetString(header),
+        &length, trq->rq, trq->text);
+      if(value)
+        Tcl_SetObjResult(tcl, Tcl_NewStringObj(value, length));
+      break;
+    }
     case http_rq_content_length:
       if(trq->rq->flags & http_content_length)
         Tcl_SetObjResult(tcl, Tcl_NewIntObj(trq->rq->content_length));
@@ -315,20 +495,59 @@ tap_tcl_get_header   (tap_request_base *trq,
       break;
     default:
     {
-      textint *text = trq->text;
-      int i, ints = minute_textint_intsize(text);
-      char *value;
-      for(i = 0; i < ints; i += 2)
-        if(minute_textint_geti(i, text) == h) {
-          value = minute_textint_gets(minute_textint_geti(i+1, text), text);
-          Tcl_SetResult(tcl, value, TCL_STATIC);
-          break;
-        }
+      unsigned length;
+      const char *value = minute_http_header(h, &length, trq->rq, trq->text);
+      if(value)
+        Tcl_SetObjResult(tcl, Tcl_NewStringObj(value, length));
     }
   }
 
   return TCL_OK;
 }
+static void
+tap_accept_encoding  (tap_request_base    *trq,
+                      minute_http_codings *codings)
+{
+  unsigned length;
+  const char *value = minute_http_header(http_rq_accept_encoding, &length,
+    trq->rq, trq->text);
+  minute_http_accept_encoding(value, length, codings);
+}
+
+static int
+tap_tcl_accept_encoding (tap_request_base *trq,
+                         Tcl_Interp       *tcl)
+{
+  minute_http_codings codings;
+  enum http_content_coding ranked[http_coding_count];
+  unsigned i, n;
+
+  tap_accept_encoding(trq, &codings);
+  n = minute_http_codings_rank(&codings, ~0u, ranked);
+
+  Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+  for(i = 0; i < n; ++i)
+    Tcl_ListObjAppendElement(tcl, list,
+      Tcl_NewStringObj(minute_http_coding_text(ranked[i]), -1));
+  Tcl_SetObjResult(tcl, list);
+  return TCL_OK;
+}
+
+static int
+tap_tcl_variant      (tap_request_head *trq,
+                      Tcl_Interp       *tcl,
+                      Tcl_Obj          *path)
+{
+  minute_http_codings codings;
+  char variant[4096];
+
+  tap_accept_encoding(&trq->base, &codings);
+  if(0 <= minute_httpd_variant(Tcl_GetString(path), &codings,
+      variant, sizeof(variant), NULL, trq->head))
+    Tcl_SetObjResult(tcl, Tcl_NewStringObj(variant, -1));
+  return TCL_OK;
+}
+
 static int
 tap_tcl_headers_meta (ClientData  clientData,
                       Tcl_Interp *tcl,
@@ -336,8 +555,12 @@ tap_tcl_headers_meta (ClientData  clientData,
                       Tcl_Obj    *const objv[])
 {
   static const char *cmds[] = {
+    "accept-encoding",
     "add-header",
-    "get-header"
+    "get-header",
+    "payload-file",
+    "validators",
+    "variant"
   };
   tap_request_head *trq = clientData;
   if(objc < 2) {
@@ -351,21 +574,97 @@ tap_tcl_headers_meta (ClientData  clientData,
     default:
     case -1:
       break;
-    case 0: { // add-header
+    case 0: { // accept-encoding
+      if (objc != 2) {
+        Tcl_WrongNumArgs(tcl, 2, objv, "");
+        return TCL_ERROR;
+      }
+      return tap_tcl_accept_encoding(&trq->base, tcl);
+    } break;
+    case 1: { // add-header
       if (objc != 4) {
         Tcl_WrongNumArgs(tcl, 2, objv, "header-name value");
         return TCL_ERROR;
       }
       return tap_tcl_add_header(trq, tcl, objv[2], objv[3]);
     } break;
-    case 1: { // get-header
+    case 2: { // get-header
       if (objc != 3) {
         Tcl_WrongNumArgs(tcl, 2, objv, "header-name");
         return TCL_ERROR;
       }
       return tap_tcl_get_header(&trq->base, tcl, objv[2]);
     } break;
+    case 3: { // payload-file
+      if (objc != 2) {
+        Tcl_WrongNumArgs(tcl, 2, objv, "");
+        return TCL_ERROR;
+      }
+      if (trq->base.rqd->o_spool)
+        Tcl_SetObjResult(tcl, trq->base.rqd->o_spool);
+    } break;
+    case 4: { // validators
+      Tcl_WideInt lastmod = 0;
+      const char *etag;
+      if (objc != 3 && objc != 4) {
+        Tcl_WrongNumArgs(tcl, 2, objv, "etag ?last-modified?");
+        return TCL_ERROR;
+      }
+      if (objc == 4 && Tcl_GetWideIntFromObj(tcl, objv[3], &lastmod) != TCL_OK)
+        return TCL_ERROR;
+      etag = Tcl_GetString(objv[2]);
+      trq->head->validators(*etag ? etag : NULL, lastmod, trq->head);
+    } break;
+    case 5: { // variant
+      if (objc != 3) {
+        Tcl_WrongNumArgs(tcl, 2, objv, "path");
+        return TCL_ERROR;
+      }
+      return tap_tcl_variant(trq, tcl, objv[2]);
+    } break;
+  }
+  return TCL_OK;
+}
+
+/* Send a file, or part of it, as the response payload, without it passing
+   through the channel. */
+static int
+tap_tcl_sendfile (tap_request_resp *trq,
+                  Tcl_Interp       *tcl,
+                  int               objc,
+                  Tcl_Obj          *const objv[])
+{
+  Tcl_WideInt offset = 0, length = -1;
+  struct stat st;
+  int fd, r;
+
+  if(objc > 3 && Tcl_GetWideIntFromObj(tcl, objv[3], &offset) != TCL_OK)
+    return TCL_ERROR;
+  if(objc > 4 && Tcl_GetWideIntFromObj(tcl, objv[4], &length) != TCL_OK)
+    return TCL_ERROR;
+
+  if(0 > (fd = open(Tcl_GetString(objv[2]), O_RDONLY))) {
+    Tcl_AppendResult(tcl, Tcl_GetString(objv[2]), ": ", strerror(errno),
+                     NULL);
+    return TCL_ERROR;
+  }
+  if(fstat(fd, &st) || offset < 0 || offset > st.st_size) {
+    close(fd);
+    Tcl_AppendResult(tcl, Tcl_GetString(objv[2]), ": invalid offset", NULL);
+    return TCL_ERROR;
   }
+  if(length < 0 || length > st.st_size - offset)
+    length = st.st_size - offset;
+
+  // anything written to the channel goes first.
+  Tcl_Flush(trq->channel);
+  r = trq->out->sendfile(fd, offset, length, trq->out);
+  close(fd);
+  if(r) {
+    Tcl_AppendResult(tcl, "sendfile failed", NULL);
+    return TCL_ERROR;
+  }
+  Tcl_SetObjResult(tcl, Tcl_NewWideIntObj(length));
   return TCL_OK;
 }
 
@@ -376,7 +675,8 @@ tap_tcl_response_meta(ClientData  clientData,
                       Tcl_Obj    *const objv[])
 {
   static const char *cmds[] = {
-    "get-header"
+    "get-header",
+    "sendfile"
   };
   tap_request_resp *trq = clientData;
   if(objc < 2) {
@@ -397,6 +697,13 @@ tap_tcl_response_meta(ClientData  clientData,
       }
       return tap_tcl_get_header(&trq->base, tcl, objv[2]);
     } break;
+    case 1: { // sendfile
+      if (objc < 3 || objc > 5) {
+        Tcl_WrongNumArgs(tcl, 2, objv, "path ?offset? ?length?");
+        return TCL_ERROR;
+      }
+      return tap_tcl_sendfile(trq, tcl, objc, objv);
+    } break;
   }
   return TCL_OK;
 }
@@ -426,26 +733,21 @@ minuted_tap_head (minute_http_rq     *rq,
   int r,i;
   int res = 500;
 
-  const char *path = rq->path ? minute_textint_gets(rq->path, text) : "";
-  const char *query = rq->query ? minute_textint_gets(rq->query, text) : "";
-
-  const char *host_header = s_default;
+  const char *path = rq->path ? minute_http_text(rq->path, rq, text) : "";
+  const char *query = rq->query ? minute_http_text(rq->query, rq, text) : "";
 
-  int ints = minute_textint_intsize(text);
-  for(i = 0; i < ints; i += 2)
-    switch(minute_textint_geti(i, text)) {
-      // look for host header to determine vhost.
-      case http_rq_host: {
-        host_header = minute_textint_gets(
-          minute_textint_geti(i+1, text), text);
-      }
-    }
+  // look for host header to determine vhost.
+  unsigned length;
+  const char *host_header = minute_http_header(http_rq_host, &length, rq, text);
+  int host_length = host_header ? (int) length : -1;
+  if(!host_header)
+    host_header = s_default;
 
   Tcl_Obj *vhost, *id, *acthost;
 
   Tcl_Obj *vhosts = rs->vhostListen[rqd->listenId];
 
-  Tcl_Obj *host = Tcl_NewStringObj(host_header, -1);
+  Tcl_Obj *host = Tcl_NewStringObj(host_header, host_length);
   Tcl_Obj *defhost = Tcl_NewStringObj(s_default, -1);
 
   Tcl_IncrRefCount(host);
@@ -463,8 +765,8 @@ minuted_tap_head (minute_http_rq     *rq,
   Tcl_DecrRefCount(defhost);
   Tcl_DecrRefCount(host);
 
-  Tcl_IncrRefCount(rqd->o_path = Tcl_NewStringObj(path, -1));
-  Tcl_IncrRefCount(rqd->o_query = Tcl_NewStringObj(query, -1));
+  Tcl_IncrRefCount(rqd->o_path = Tcl_NewStringObj(path, rq->path_length));
+  Tcl_IncrRefCount(rqd->o_query = Tcl_NewStringObj(query, rq->query_length));
 
   if(r != TCL_OK) {
     res = 500;
@@ -485,11 +787,23 @@ minuted_tap_head (minute_http_rq     *rq,
   } else {
     tap_vhost *v = rqd->vhost = &rs->v[i];
 
+    if(v->header) {
+      int length;
+      const char *header = Tcl_GetStringFromObj(v->header, &length);
+      head->raw(header, length, head);
+    }
+
+    tap_request_head trq = {{rq, text, rqd}, head};
+    if(v->nstatic && (res = tap_static_head(&trq, rqd->o_path))) {
+      rqd->native = 1;
+      rqd->method = rq->request_method;
+      return rqd->code = res;
+    }
+
     //TODO interned strings.
     Tcl_Obj *o_proc = Tcl_NewStringObj(s_head, -1);
     Tcl_Obj *o_meta;
 
-    tap_request_head trq = {{rq, text, rqd}, head};
     Tcl_Command meta = tap_create_meta(v->tcl, tap_tcl_headers_meta, &trq,
       &o_meta);
 
@@ -511,8 +825,11 @@ minuted_tap_head (minute_http_rq     *rq,
     if(r != TCL_OK) {
       error("Head processing failed: %s", Tcl_GetStringResult(v->tcl));
       res = 500;
-    } else {
-      res = minuted_tap_status(rqd);
+    } else if((res = minuted_tap_status(rqd)) == 100
+              && rq->flags & http_content_length
+              && rq->content_length > v->payload_max) {
+      // refused before the client is told to go on and send it.
+      res = http_request_entity_too_large;
     }
   }
 
@@ -522,6 +839,110 @@ minuted_tap_head (minute_http_rq     *rq,
   return res;
 }
 
+/* Whether the payload is to be spooled from the start; chunked ones, of
+   unknown length, are once as much has been read, see tap_buffer. */
+static int
+tap_spool_wanted     (minute_http_rq   *rq,
+                      tap_vhost        *v)
+{
+  return v->spool_dir && rq->flags & http_content_length
+         && rq->content_length >= (unsigned) v->spool_min;
+}
+
+/* Create the spool file, in the spool directory of the vhost; it's removed
+   along with the request. */
+static int
+tap_spool_open       (tap_rq_data      *rqd)
+{
+  char path[4096];
+
+  if((size_t) snprintf(path, sizeof(path), "%s/minuted-XXXXXX",
+       Tcl_GetString(rqd->vhost->spool_dir)) >= sizeof(path)
+     || 0 > (rqd->spool = mkostemp(path, O_CLOEXEC)))
+    return -1;
+  Tcl_IncrRefCount(rqd->o_spool = Tcl_NewStringObj(path, -1));
+  return 0;
+}
+
+/* Move the payload to the spool file as it arrives. Returns zero once it's
+   all there, the file being left to read from the start, one if more is yet
+   to arrive, or -1, errno ECONNRESET if the client sent less than it said,
+   or EFBIG if it's more than the vhost accepts. */
+static int
+tap_spool            (tap_request_head *trq,
+                      minute_httpd_in  *in)
+{
+  tap_rq_data *rqd = trq->base.rqd;
+  minute_http_rq *rq = trq->base.rq;
+  int r;
+
+  if(!rqd->o_spool && tap_spool_open(rqd))
+    return -1;
+
+  // the payload goes from the connection to the file through the kernel.
+  while(0 < (r = in->splice(rqd->spool, 0x10000, in)))
+    if((rqd->spooled += r) > rqd->vhost->payload_max) {
+      errno = EFBIG;
+      return -1;
+    }
+  if(r < 0 && errno == EAGAIN)
+    return 1;
+  if(!r && rq->flags & http_content_length && rqd->spooled != rq->content_length)
+    errno = ECONNRESET;
+  else if(!r && !lseek(rqd->spool, 0, SEEK_SET))
+    return 0;
+  return -1;
+}
+
+/* Read the payload into memory as it arrives, for the payload function to
+   read once it's all there, or once there's as much as spool_min of it,
+   move it to the spool file and spool the rest. Returns as tap_spool. */
+static int
+tap_buffer           (tap_request_head *trq,
+                      minute_httpd_in  *in)
+{
+  tap_rq_data *rqd = trq->base.rqd;
+  tap_vhost *v = rqd->vhost;
+  const char *data;
+  unsigned char *bytes;
+  int r, length = 0;
+
+  if(!rqd->o_payload)
+    Tcl_IncrRefCount(rqd->o_payload = Tcl_NewByteArrayObj(NULL, 0));
+  while(0 < (r = in->view(&data, in))) {
+    Tcl_GetByteArrayFromObj(rqd->o_payload, &length);
+    if((unsigned long long) length + r > v->payload_max) {
+      errno = EFBIG;
+      return -1;
+    }
+    memcpy(Tcl_SetByteArrayLength(rqd->o_payload, length + r) + length,
+           data, r);
+    length += r;
+    if(v->spool_dir && length >= v->spool_min)
+      break;
+  }
+  if(r < 0 && errno == EAGAIN)
+    return 1;
+  if(r <= 0)
+    return r;
+
+  // too much to keep in memory after all.
+  if(tap_spool_open(rqd))
+    return -1;
+  bytes = Tcl_GetByteArrayFromObj(rqd->o_payload, &length);
+  while(rqd->spooled < (unsigned) length) {
+    if(0 > (r = write(rqd->spool, bytes + rqd->spooled,
+                      length - rqd->spooled)) && errno != EINTR)
+      return -1;
+    rqd->spooled += r > 0 ? r : 0;
+  }
+  Tcl_DecrRefCount(rqd->o_payload);
+  rqd->o_payload = NULL;
+  return tap_spool(trq, in);
+}
+
+/* Called again whenever reading the payload would block, until it's all been
+   read, before the payload function of the vhost is called. */
 static unsigned
 minuted_tap_payload  (minute_http_rq     *rq,
                       minute_httpd_head  *head,
@@ -537,18 +958,40 @@ minuted_tap_payload  (minute_http_rq     *rq,
     return rqd->code = 500;
 
   minuted_tap_channel ch = {in, NULL};
-
-  //TODO generate channel name.
-  Tcl_Channel channel = Tcl_CreateChannel(
-    &minuted_tap_input_channel, s_tap_io,
-    &ch, TCL_READABLE
-  );
+  tap_request_head trq = {{rq, text, rqd}, head};
+  Tcl_Channel channel;
+
+  if(rqd->o_spool || tap_spool_wanted(rq, v))
+    r = tap_spool(&trq, in);
+  else
+    r = tap_buffer(&trq, in);
+
+  if(r > 0) {
+    return 100;
+  } else if(r < 0 && errno == EFBIG) {
+    return rqd->code = http_request_entity_too_large;
+  } else if(r < 0) {
+    error("Payload %s failed: %s", rqd->o_spool ? "spooling" : "reading",
+          strerror(errno));
+    return rqd->code = errno == ECONNRESET ? http_bad_request : 500;
+  } else if(rqd->o_spool) {
+    // closed along with the channel.
+    channel = Tcl_MakeFileChannel((ClientData)(intptr_t) rqd->spool,
+                                  TCL_READABLE);
+    rqd->spool = -1;
+  } else {
+    ch.data = Tcl_GetByteArrayFromObj(rqd->o_payload, &ch.length);
+    //TODO generate channel name.
+    channel = Tcl_CreateChannel(
+      &minuted_tap_input_channel, s_tap_io,
+      &ch, TCL_READABLE
+    );
+  }
 
   Tcl_Obj *o_proc = Tcl_NewStringObj(s_payload, -1);
-  Tcl_Obj *o_channel = Tcl_NewStringObj(s_tap_io, -1);
+  Tcl_Obj *o_channel = Tcl_NewStringObj(Tcl_GetChannelName(channel), -1);
   Tcl_Obj *o_meta;
 
-  tap_request_head trq = {{rq, text, rqd}, head};
   Tcl_Command meta = tap_create_meta(v->tcl, tap_tcl_headers_meta, &trq,
     &o_meta);
 
@@ -591,6 +1034,9 @@ minuted_tap_response (minute_http_rq   *rq,
 
   if (!v)
     return 1;
+  if (rqd->native)
+    return !rqd->file || status != 200
+           || out->sendfile(rqd->file->fd, 0, rqd->file->size, out);
 
   //channel will be destroyed before we leave this function, so it's ok
   //to just keep it on the stack.
@@ -605,7 +1051,7 @@ minuted_tap_response (minute_http_rq   *rq,
   Tcl_Obj *o_proc = Tcl_NewStringObj(s_response, -1);
   Tcl_Obj *o_channel = Tcl_NewStringObj(s_tap_io, -1);
   Tcl_Obj *o_meta = Tcl_NewObj();
-  tap_request_resp trq = {{rq, text, rqd}};
+  tap_request_resp trq = {{rq, text, rqd}, out, channel};
 
   Tcl_Command meta = tap_create_meta(v->tcl, tap_tcl_response_meta, &trq,
     &o_meta);
@@ -689,17 +1135,111 @@ minuted_tap_create (Tcl_Interp *tcl,
   return s;
 }
 
+/* Blocks lent to connections whose request heads don't fit the fixed
+   buffers, heads larger than the largest block are refused, and to the
+   compressor of response bodies. A few blocks of each size are kept for
+   reuse, as much as compressing a response takes. */
+#define TAP_POOL_MAX_SHIFT 16
+#define TAP_POOL_DEPTH 4
+
+static void *tap_pool_blocks[TAP_POOL_MAX_SHIFT+1][TAP_POOL_DEPTH];
+static unsigned tap_pool_count[TAP_POOL_MAX_SHIFT+1];
+
+static unsigned
+tap_pool_shift (unsigned size)
+{
+  unsigned shift = 0;
+  while ((1u << shift) < size)
+    shift++;
+  return shift;
+}
+
+static void*
+tap_pool_get (unsigned size, minute_httpd_pool *pool)
+{
+  unsigned shift = tap_pool_shift (size);
+  void *block;
+  if (shift > TAP_POOL_MAX_SHIFT)
+    return NULL;
+  if (tap_pool_count[shift])
+    block = tap_pool_blocks[shift][--tap_pool_count[shift]];
+  else
+    block = malloc (size);
+  return block;
+}
+
+static void
+tap_pool_put (void *block, unsigned size, minute_httpd_pool *pool)
+{
+  unsigned shift = tap_pool_shift (size);
+  if (tap_pool_count[shift] == TAP_POOL_DEPTH)
+    free (block);
+  else
+    tap_pool_blocks[shift][tap_pool_count[shift]++] = block;
+}
+
+static minute_httpd_app tap_app = {
+  minuted_tap_head,
+  minuted_tap_payload,
+  minuted_tap_response,
+  minuted_tap_error
+};
+
+static minute_httpd_pool tap_pool = {
+  tap_pool_get,
+  tap_pool_put
+};
+
+/* Log the outcome of a call to minute_httpd_handle or minute_httpd_step,
+   returning the connection status. */
+static int
+minuted_tap_served (int r, tap_rq_data *rqd)
+{
+  if(r < 0) {
+    rqd->code = -r;
+    r = httpd_client_ok_close;
+  }
+
+  switch(r) {
+    case httpd_client_ok_open:
+    case httpd_client_ok_close:
+      minuted_tap_access(rqd);
+      break;
+    case httpd_client_want_read:
+    case httpd_client_want_write:
+      return r;
+  }
+  minuted_tap_reset (rqd);
+  return r;
+}
+
+/* Whether the connection is between requests, with nothing read. */
+static int
+tap_idle (minute_httpd_state *state)
+{
+  return state->next == state->batched && !minute_iobuf_used(state->in);
+}
+
+/* Wait for the socket to become ready, as the step wants, for no longer
+   than the timeout, or the keep-alive timeout between requests. Non-zero
+   once it's up. */
+static int
+tap_wait (int r, minute_httpd_state *state, tap_rq_data *rqd)
+{
+  configuration *c = rqd->rs->c;
+  struct pollfd p = {rqd->sock, r == httpd_client_want_read ? POLLIN : POLLOUT};
+  int timeout = 1000 * (tap_idle(state) ? c->keepalive : c->timeout);
+
+  while(0 > (r = poll(&p, 1, timeout)) && errno == EINTR)
+    ;
+  return r <= 0;
+}
+
 unsigned
 minuted_tap_handle (int           sock,
                     int           listenId,
                     tap_runtime  *tr)
 {
-  minute_httpd_app app = {
-    minuted_tap_head,
-    minuted_tap_payload,
-    minuted_tap_response,
-    minuted_tap_error
-  };
   tap_rq_data rqd = {tr, listenId, sock};
 
   minute_httpd_state state;
@@ -714,26 +1254,100 @@ minuted_tap_handle (int           sock,
     minute_iobuf_init(sizeof(outbuf), outbuf),
     minute_textint_init(sizeof(textbuf), textbuf),
     &state);
+  minute_httpd_set_pool (&tap_pool, &state);
 
   // should be superfluous, but just in case something shouldn't be zero,
   // do a proper initial reset.
   minuted_tap_reset (&rqd);
 
-
+  // waiting ourselves, so as not to wait on the client indefinitely.
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
   do {
-    if(0> (r = minute_httpd_handle(&app,&state,&rqd))) {
-      rqd.code = -r;
-      r = httpd_client_ok_close;
-    }
-
-    switch(r) {
-      case httpd_client_ok_open:
-      case httpd_client_ok_close:
-        minuted_tap_access(&rqd);
+    while((r = minute_httpd_step(&tap_app,&state,&rqd))
+            == httpd_client_want_read || r == httpd_client_want_write)
+      if(tap_wait(r, &state, &rqd)) {
+        r = httpd_client_no_request;
         break;
-    }
-    minuted_tap_reset (&rqd);
+      }
+    r = minuted_tap_served (r, &rqd);
   } while(r == httpd_client_ok_open);
 
+  minute_httpd_release (&state);
   return r;
 }
+
+struct
+tap_connection
+{
+  minute_httpd_state  state;
+  tap_rq_data         rqd;
+
+  char                inbuf[0x100];
+  char                outbuf[0x400];
+  int                 textbuf[0x400/sizeof(int)];
+};
+
+tap_connection*
+minuted_tap_open  (int           sock,
+                   int           listenId,
+                   tap_runtime  *tr)
+{
+  tap_connection *c = malloc(sizeof(*c));
+  tap_rq_data rqd = {tr, listenId, sock};
+  if(!c)
+    return NULL;
+
+  minute_httpd_init (sock, sock,
+    minute_iobuf_init(sizeof(c->inbuf), c->inbuf),
+    minute_iobuf_init(sizeof(c->outbuf), c->outbuf),
+    minute_textint_init(sizeof(c->textbuf), c->textbuf),
+    &c->state);
+  minute_httpd_set_pool (&tap_pool, &c->state);
+
+  c->rqd = rqd;
+  minuted_tap_reset (&c->rqd);
+  return c;
+}
+
+int
+minuted_tap_step  (tap_connection *c)
+{
+  return minuted_tap_served (minute_httpd_step(&tap_app,&c->state,&c->rqd),
+                             &c->rqd);
+}
+
+int
+minuted_tap_socket(tap_connection *c)
+{
+  return c->rqd.sock;
+}
+
+int
+minuted_tap_idle  (tap_connection *c)
+{
+  return tap_idle(&c->state);
+}
+
+void
+minuted_tap_set_transport (tap_connection         *c,
+                           minute_httpd_transport *t)
+{
+  minute_httpd_set_transport (t, &c->state);
+}
+
+void
+minuted_tap_release (tap_connection *c)
+{
+  // a request cut short leaves its spooled payload behind.
+  minuted_tap_reset (&c->rqd);
+  minute_httpd_release (&c->state);
+  free (c);
+}
+
+void
+minuted_tap_close (tap_connection *c)
+{
+  int sock = c->rqd.sock;
+  minuted_tap_release (c);
+  close (sock);
+}
@@ -4,14 +4,42 @@
 #include <tcl8.5/tcl.h>
 
 struct configuration;
+struct minute_httpd_transport;
+
+/* A document root served without the application, see the static command
+   of the configuration. */
+struct tap_static
+{
+  Tcl_Obj    *prefix;
+  int         root;
+};
 
 #define TAP_NO_PAYLOAD 0x01
+/* The largest payload accepted unless the payload-limit command says. */
+#define TAP_PAYLOAD_MAX (1 << 20)
 
 struct tap_vhost
 {
   Tcl_Interp *tcl;
 
   unsigned    flags;
+  /* headers set on every response, serialized from the configuration. */
+  Tcl_Obj    *header;
+  /* content types compressed for the clients accepting it, the compression
+     level and the size of the smallest body compressed. */
+  Tcl_Obj    *compress;
+  int         compress_level;
+  int         compress_min;
+  /* document roots, and the path prefixes they're served under. */
+  struct tap_static *statics;
+  int         nstatic;
+  /* directory payloads of at least spool_min bytes are moved to before the
+     payload function is called, chunked ones once that much has arrived;
+     NULL if none. */
+  Tcl_Obj    *spool_dir;
+  int         spool_min;
+  /* the largest payload accepted, see TAP_PAYLOAD_MAX. */
+  unsigned long long payload_max;
 
   Tcl_CmdInfo headers;
   Tcl_CmdInfo payload;
@@ -36,4 +64,24 @@ unsigned  minuted_tap_handle (int                 sock,
                               int                 listenId,
                               struct tap_runtime *tr);
 
+/* Connections served from an event loop, one step at a time; see
+   minute_httpd_step. The socket is expected to be non-blocking, and is
+   closed along with the connection. */
+typedef struct tap_connection tap_connection;
+
+tap_connection* minuted_tap_open  (int                 sock,
+                                   int                 listenId,
+                                   struct tap_runtime *tr);
+int             minuted_tap_step  (tap_connection     *c);
+int             minuted_tap_socket(tap_connection     *c);
+/* Non-zero if the connection is between requests, with nothing read. */
+int             minuted_tap_idle  (tap_connection     *c);
+/* Do the connection's I/O using the transport rather than system calls on
+   the socket. */
+void            minuted_tap_set_transport (tap_connection *c,
+                                           struct minute_httpd_transport *t);
+void            minuted_tap_close (tap_connection     *c);
+/* Free the connection like minuted_tap_close, but leave the socket open. */
+void            minuted_tap_release (tap_connection *c);
+
 #endif /* idempotent include guard */
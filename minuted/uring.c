@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static int
+io_uring_setup (unsigned entries, struct io_uring_params *p)
+{
+  return syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter (int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+  return syscall (__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int
+io_uring_register (int fd, unsigned opcode, void *arg, unsigned count)
+{
+  return syscall (__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+int
+minuted_uring_init (minuted_uring *ring,
+                    unsigned       entries)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset (ring, 0, sizeof(*ring));
+  memset (&p, 0, sizeof(p));
+  if (0 > (ring->fd = io_uring_setup (entries, &p)))
+    return -1;
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = p.cq_off.cqes
+                     + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  sq = mmap (0, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+             MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  cq = mmap (0, ring->cq_ring_size, PROT_READ|PROT_WRITE,
+             MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap (0, ring->sqes_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  ring->sq_ring = sq;
+  ring->cq_ring = cq;
+  if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    int e = errno;
+    minuted_uring_exit (ring);
+    errno = e;
+    return -1;
+  }
+
+  ring->sq_head  = (unsigned*)(sq + p.sq_off.head);
+  ring->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+  ring->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+  ring->cq_head  = (unsigned*)(cq + p.cq_off.head);
+  ring->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+  ring->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+void
+minuted_uring_exit (minuted_uring *ring)
+{
+  if (ring->sqes && ring->sqes != MAP_FAILED)
+    munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != MAP_FAILED)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+    munmap (ring->sq_ring, ring->sq_ring_size);
+  close (ring->fd);
+  ring->fd = -1;
+}
+
+int
+minuted_uring_register (minuted_uring *ring,
+                        void          *base,
+                        unsigned long  length)
+{
+  struct iovec iov = {base, length};
+  return io_uring_register (ring->fd, IORING_REGISTER_BUFFERS, &iov, 1);
+}
+
+struct io_uring_sqe*
+minuted_uring_sqe (minuted_uring *ring)
+{
+  unsigned tail = *ring->sq_tail, mask = *ring->sq_mask, index;
+  struct io_uring_sqe *sqe;
+
+  if (tail - __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE) > mask
+      && minuted_uring_submit (ring, 0) < 0)
+    return NULL;
+
+  index = tail & mask;
+  sqe = &ring->sqes[index];
+  memset (sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  __atomic_store_n (ring->sq_tail, tail+1, __ATOMIC_RELEASE);
+  ring->sq_pending++;
+  return sqe;
+}
+
+int
+minuted_uring_linkable (minuted_uring *ring,
+                        unsigned       tail)
+{
+  return ring->sq_pending && tail == *ring->sq_tail
+         && tail - __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE)
+            <= *ring->sq_mask;
+}
+
+int
+minuted_uring_submit (minuted_uring *ring,
+                      unsigned       wait)
+{
+  int r = io_uring_enter (ring->fd, ring->sq_pending, wait,
+                          wait ? IORING_ENTER_GETEVENTS : 0);
+  if (r >= 0)
+    ring->sq_pending -= r < ring->sq_pending ? r : ring->sq_pending;
+  return r;
+}
+
+struct io_uring_cqe*
+minuted_uring_cqe (minuted_uring *ring)
+{
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+void
+minuted_uring_seen (minuted_uring *ring)
+{
+  __atomic_store_n (ring->cq_head, *ring->cq_head+1, __ATOMIC_RELEASE);
+}
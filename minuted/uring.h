@@ -0,0 +1,65 @@
+#ifndef __MINUTED_URING_H__
+#define __MINUTED_URING_H__
+
+#include <linux/io_uring.h>
+
+/* Minimal io_uring submission/completion rings, set up using the raw system
+   calls rather than depending on liburing. */
+typedef struct
+minuted_uring
+{
+  int                   fd;
+
+  unsigned             *sq_head;
+  unsigned             *sq_tail;
+  unsigned             *sq_mask;
+  unsigned             *sq_array;
+  struct io_uring_sqe  *sqes;
+  unsigned              sq_pending;
+
+  unsigned             *cq_head;
+  unsigned             *cq_tail;
+  unsigned             *cq_mask;
+  struct io_uring_cqe  *cqes;
+
+  void                 *sq_ring;
+  unsigned              sq_ring_size;
+  void                 *cq_ring;
+  unsigned              cq_ring_size;
+  unsigned              sqes_size;
+}
+minuted_uring;
+
+/* Set up the rings with room for entries submissions. */
+int   minuted_uring_init   (minuted_uring *ring,
+                            unsigned       entries);
+void  minuted_uring_exit   (minuted_uring *ring);
+
+/* Register length bytes from base as fixed buffer 0, for the _FIXED reads
+   and writes; fails if the memory can't be locked. */
+int   minuted_uring_register (minuted_uring *ring,
+                              void          *base,
+                              unsigned long  length);
+
+/* Get a cleared submission entry, submitting the pending ones first if the
+   ring is full. */
+struct io_uring_sqe*
+      minuted_uring_sqe    (minuted_uring *ring);
+
+/* Whether the entry returned by minuted_uring_sqe, after which the tail
+   was tail, is the last one and still pending, and the next one will be
+   submitted along with it; i.e. whether the next can be linked to it. */
+int   minuted_uring_linkable (minuted_uring *ring,
+                              unsigned       tail);
+
+/* Submit the pending entries, and wait for at least wait completions. */
+int   minuted_uring_submit (minuted_uring *ring,
+                            unsigned       wait);
+
+/* The next completion, or NULL if there is none; consume it using
+   minuted_uring_seen. */
+struct io_uring_cqe*
+      minuted_uring_cqe    (minuted_uring *ring);
+void  minuted_uring_seen   (minuted_uring *ring);
+
+#endif /* idempotent include guard */
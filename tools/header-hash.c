@@ -0,0 +1,181 @@
+/* Tool for generating a perfect hash recognizer for header names, given a
+  list of canonically cased header names on stdin, one per line. The output is
+  a C header defining the hash step function and a single table mapping hash
+  slots to header enum values, where the enum symbols are the lower cased
+  header names prefixed by the first argument, with non-alphanumeric
+  characters replaced by underscores (i.e. the same naming as patricia-build).
+
+  Given -x before the prefix, it instead writes the X-macro listing each
+  header's enum symbol and canonical name in input order, from which the
+  enum and the name table are declared, so that neither can drift from the
+  list the hash was built for.
+
+  The hash is a simple multiplicative byte-wise hash which can be computed
+  incrementally while the name is being read. We search for a multiplier
+  which maps all names to distinct slots of the smallest possible table,
+  which for the standard header list takes a fraction of a second.
+*/
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXNAMES  256
+#define MAXLEN    64
+#define MAXBITS   10
+#define TRIES     (1u<<22)
+
+/* Printed verbatim into the output as well, so the parser is guaranteed to
+   use the same function. */
+#define HASH_STEP_TEXT "(((h) ^ (unsigned char)(c)) * HEADER_HASH_MULT)"
+#define HASH_SLOT_TEXT "((((h) & 0xffffffffu) >> (32-HEADER_HASH_BITS)))"
+
+static uint32_t HEADER_HASH_MULT;
+static unsigned HEADER_HASH_BITS;
+#define HEADER_HASH_STEP(h,c) (((h) ^ (unsigned char)(c)) * HEADER_HASH_MULT)
+#define HEADER_HASH_SLOT(h) ((((h) & 0xffffffffu) >> (32-HEADER_HASH_BITS)))
+
+static char  *names[MAXNAMES];      // lower cased, as hashed
+static char  *canonical[MAXNAMES];
+static int    nnames;
+
+static uint32_t
+hash(const char *s)
+{
+  uint32_t h = 0;
+  while(*s)
+    h = HEADER_HASH_STEP(h, *s++);
+  return h;
+}
+
+static uint32_t
+xorshift(void)
+{
+  static uint32_t x = 2463534242u;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+static int
+fits(int *table)
+{
+  int i;
+  memset(table, 0, sizeof(int) << HEADER_HASH_BITS);
+  for(i = 0; i < nnames; ++i) {
+    uint32_t slot = HEADER_HASH_SLOT(hash(names[i]));
+    if(table[slot])
+      return 0;
+    table[slot] = i+1;
+  }
+  return 1;
+}
+
+static void
+print_symbol(const char *prefix, const char *name)
+{
+  printf("%s", prefix);
+  for(; *name; ++name)
+    putchar(isalnum(*name) ? *name : '_');
+}
+
+static void
+print_xmacro(const char *prefix)
+{
+  int i;
+  printf("/* Generated by tools/header-hash, do not edit. */\n");
+  printf("#define HTTP_REQUEST_HEADERS(X)");
+  for(i = 0; i < nnames; ++i) {
+    printf(" \\\n  X(");
+    print_symbol(prefix, names[i]);
+    printf(", \"%s\")", canonical[i]);
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  static int table[1<<MAXBITS];
+  char buffer[MAXLEN+2];
+  int xmacro = argc > 1 && !strcmp(argv[1], "-x");
+  const char *prefix = argc > 1+xmacro ? argv[1+xmacro] : "";
+  int ln = 0, maxlen = 0, i;
+  unsigned tries;
+
+  while(fgets(buffer, sizeof(buffer), stdin))
+  {
+    int len = strlen(buffer);
+    ln++;
+    while(len && (buffer[len-1] == '\n' || buffer[len-1] == '\r'))
+      buffer[--len] = 0;
+    if(!len)
+      continue;
+    for(i = 0; i < len; ++i)
+      if(!isalnum(buffer[i]) && buffer[i] != '-') {
+        fprintf(stderr, "Line %d: '%s' is not a header name\n", ln, buffer);
+        return 1;
+      }
+    if(nnames == MAXNAMES) {
+      fprintf(stderr, "Too many header names\n");
+      return 1;
+    }
+    if(len > maxlen)
+      maxlen = len;
+    canonical[nnames] = strdup(buffer);
+    for(i = 0; i < len; ++i)
+      buffer[i] = tolower(buffer[i]);
+    for(i = 0; i < nnames; ++i)
+      if(!strcmp(names[i], buffer)) {
+        fprintf(stderr, "Line %d: '%s' is listed twice\n", ln, buffer);
+        return 1;
+      }
+    names[nnames++] = strdup(buffer);
+  }
+
+  if(xmacro) {
+    print_xmacro(prefix);
+    return 0;
+  }
+
+  for(HEADER_HASH_BITS = 1; (1 << HEADER_HASH_BITS) < nnames;)
+    ++HEADER_HASH_BITS;
+
+  for(; HEADER_HASH_BITS <= MAXBITS; ++HEADER_HASH_BITS) {
+    for(tries = 0; tries < TRIES; ++tries) {
+      HEADER_HASH_MULT = xorshift() | 1;
+      if(fits(table))
+        break;
+    }
+    if(tries < TRIES)
+      break;
+  }
+  if(HEADER_HASH_BITS > MAXBITS) {
+    fprintf(stderr, "Failed to find a perfect hash.\n");
+    return 1;
+  }
+  fprintf(stderr, "Found %d bit hash after %u tries.\n",
+    HEADER_HASH_BITS, tries+1);
+
+  printf("/* Generated by tools/header-hash, do not edit. */\n");
+  printf("#define HEADER_HASH_MULT   0x%08xu\n", (unsigned) HEADER_HASH_MULT);
+  printf("#define HEADER_HASH_BITS   %u\n", HEADER_HASH_BITS);
+  printf("#define HEADER_HASH_MAXLEN %d\n", maxlen);
+  printf("#define HEADER_HASH_NAMES  %d\n", nnames);
+  printf("#define HEADER_HASH_STEP(h,c) %s\n", HASH_STEP_TEXT);
+  printf("#define HEADER_HASH_SLOT(h) %s\n", HASH_SLOT_TEXT);
+  printf("\nstatic const unsigned char\nheader_hash[1<<HEADER_HASH_BITS] =\n{");
+  for(i = 0; i < 1 << HEADER_HASH_BITS; ++i) {
+    printf("%s\n  ", i ? "," : "");
+    if(table[i]) {
+      print_symbol(prefix, names[table[i]-1]);
+    } else {
+      printf("0");
+    }
+  }
+  printf("\n};\n");
+  return 0;
+}